@@ -0,0 +1,405 @@
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aur-internal.h"
+
+/* Microbenchmarks of the decode, format and request building paths, over
+ * answers recorded in bench/fixtures. Each benchmark runs in a child of its
+ * own, so that the peak RSS it reports is its own, and prints one line of
+ * JSON on stdout:
+ *
+ *   {"bench":"decode/info-full","version":"...","packages":300,
+ *    "iterations":1234,"ns_per_package":850.2,"allocs_per_package":31.0,
+ *    "peak_rss_kb":4321}
+ *
+ * A summary goes to stderr, compared against an earlier run's output when
+ * one is passed with --baseline. */
+
+#ifdef GIT_VERSION
+#define BENCH_VERSION GIT_VERSION
+#else
+#define BENCH_VERSION PACKAGE_VERSION
+#endif
+
+#define MAX_BASELINE 64
+
+static uint64_t min_runtime_ns = 500 * 1000 * 1000ULL;
+
+/* Allocations are counted on their way to glibc's allocator, which also
+ * sees those made by curl and yajl. */
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+
+static uint64_t nallocs;
+
+void *malloc(size_t size) {
+  ++nallocs;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+  ++nallocs;
+  return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  ++nallocs;
+  return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+  __libc_free(ptr);
+}
+
+struct fixture_t {
+  char *data;
+  size_t len;
+
+  struct package_t *packages;
+  const struct package_t **ptrs;
+  int count;
+
+  aur_request_t **requests;
+  int nrequests;
+  FILE *devnull;
+};
+
+/* runs one iteration, returning the number of packages it went through */
+typedef int (*bench_fn)(struct fixture_t *f);
+
+struct bench_t {
+  const char *name;
+  const char *fixture;
+  bench_fn fn;
+  int (*setup)(struct fixture_t *f);
+};
+
+struct baseline_t {
+  char name[64];
+  double ns_per_package;
+};
+
+static struct baseline_t baseline[MAX_BASELINE];
+static int nbaseline;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int bench_decode(struct fixture_t *f) {
+  struct package_t *packages;
+  int r, count;
+
+  r = aur_packages_from_json(f->data, &packages, &count);
+  if (r < 0)
+    return r;
+
+  aur_package_list_free(packages);
+
+  return count;
+}
+
+static int bench_format(struct fixture_t *f) {
+  aur_packages_format(f->devnull, "%n %v %o %a %m\n  %d\n  %D\n", f->ptrs, NULL);
+
+  return f->count;
+}
+
+static int bench_build(struct fixture_t *f) {
+  int n = 0;
+
+  for (int i = 0; i < f->nrequests; ++i) {
+    int argc, r;
+
+    r = request_build_internal(f->requests[i], "https", "aur.archlinux.org", 5);
+    if (r < 0)
+      return r;
+
+    aur_request_get_args(f->requests[i], &argc);
+    n += argc;
+  }
+
+  return n;
+}
+
+static int setup_format(struct fixture_t *f) {
+  f->ptrs = calloc(f->count + 1, sizeof(struct package_t *));
+  if (f->ptrs == NULL)
+    return -ENOMEM;
+
+  for (int i = 0; i < f->count; ++i)
+    f->ptrs[i] = &f->packages[i];
+
+  f->devnull = fopen("/dev/null", "we");
+  if (f->devnull == NULL)
+    return -errno;
+
+  return 0;
+}
+
+static int setup_requests(struct fixture_t *f, int type, int per_request) {
+  f->requests = calloc(f->count, sizeof(aur_request_t *));
+  if (f->requests == NULL)
+    return -ENOMEM;
+
+  for (int i = 0; i < f->count; ++i) {
+    int r;
+
+    if (i % per_request == 0) {
+      r = aur_request_new(&f->requests[f->nrequests++], type, NULL);
+      if (r < 0)
+        return r;
+    }
+
+    r = aur_request_append_arg(f->requests[f->nrequests - 1], f->packages[i].name);
+    if (r < 0)
+      return r;
+  }
+
+  return 0;
+}
+
+static int setup_info(struct fixture_t *f) {
+  return setup_requests(f, REQUEST_INFO, 1);
+}
+
+static int setup_multiinfo(struct fixture_t *f) {
+  return setup_requests(f, REQUEST_MULTIINFO, f->count);
+}
+
+static const struct bench_t benches[] = {
+  { "decode/info-small",   "info-small.json",   bench_decode, NULL },
+  { "decode/search-large", "search-large.json", bench_decode, NULL },
+  { "decode/info-full",    "info-full.json",    bench_decode, NULL },
+  { "format/search-large", "search-large.json", bench_format, setup_format },
+  { "format/info-full",    "info-full.json",    bench_format, setup_format },
+  { "build/info",          "info-full.json",    bench_build,  setup_info },
+  { "build/multiinfo",     "info-full.json",    bench_build,  setup_multiinfo },
+};
+
+static int load_fixture(struct fixture_t *f, const char *dir, const char *name) {
+  _cleanup_free_ char *path = NULL;
+  FILE *fp;
+  long len;
+
+  if (asprintf(&path, "%s/%s", dir, name) < 0)
+    return -ENOMEM;
+
+  fp = fopen(path, "re");
+  if (fp == NULL)
+    return -errno;
+
+  if (fseek(fp, 0, SEEK_END) < 0 || (len = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) < 0) {
+    fclose(fp);
+    return -EIO;
+  }
+
+  f->data = malloc(len + 1);
+  if (f->data == NULL) {
+    fclose(fp);
+    return -ENOMEM;
+  }
+
+  f->len = fread(f->data, 1, len, fp);
+  f->data[f->len] = '\0';
+  fclose(fp);
+
+  return aur_packages_from_json(f->data, &f->packages, &f->count);
+}
+
+static const struct baseline_t *find_baseline(const char *name) {
+  for (int i = 0; i < nbaseline; ++i)
+    if (strcmp(baseline[i].name, name) == 0)
+      return &baseline[i];
+
+  return NULL;
+}
+
+/* picks the fields needed out of lines as run_bench prints them */
+static int read_baseline(const char *path) {
+  _cleanup_free_ char *line = NULL;
+  size_t linelen = 0;
+  FILE *fp;
+
+  fp = fopen(path, "re");
+  if (fp == NULL)
+    return -errno;
+
+  while (nbaseline < MAX_BASELINE && getline(&line, &linelen, fp) > 0) {
+    struct baseline_t *b = &baseline[nbaseline];
+    const char *ns = strstr(line, "\"ns_per_package\":");
+
+    if (sscanf(line, "{\"bench\":\"%63[^\"]\"", b->name) != 1 || ns == NULL)
+      continue;
+
+    if (sscanf(ns, "\"ns_per_package\":%lf", &b->ns_per_package) == 1)
+      ++nbaseline;
+  }
+
+  fclose(fp);
+
+  return 0;
+}
+
+static int run_bench(const struct bench_t *b, const char *dir) {
+  struct fixture_t f = { 0 };
+  const struct baseline_t *base;
+  uint64_t start, elapsed, allocs, iterations = 0, packages = 0;
+  struct rusage ru;
+  double ns;
+  int r;
+
+  r = load_fixture(&f, dir, b->fixture);
+  if (r < 0) {
+    fprintf(stderr, "error: failed to load %s/%s: %s\n", dir, b->fixture, strerror(-r));
+    return r;
+  }
+
+  if (b->setup != NULL) {
+    r = b->setup(&f);
+    if (r < 0) {
+      fprintf(stderr, "error: %s: setup failed: %s\n", b->name, strerror(-r));
+      return r;
+    }
+  }
+
+  /* the first round warms up caches, and counts allocations */
+  allocs = nallocs;
+  r = b->fn(&f);
+  allocs = nallocs - allocs;
+  if (r <= 0) {
+    fprintf(stderr, "error: %s: %s\n", b->name, r < 0 ? strerror(-r) : "no packages");
+    return r < 0 ? r : -EINVAL;
+  }
+
+  start = now_ns();
+  do {
+    packages += b->fn(&f);
+    ++iterations;
+    elapsed = now_ns() - start;
+  } while (elapsed < min_runtime_ns);
+
+  getrusage(RUSAGE_SELF, &ru);
+  ns = (double)elapsed / packages;
+
+  printf("{\"bench\":\"%s\",\"version\":\"%s\",\"packages\":%d,\"iterations\":%llu,"
+         "\"ns_per_package\":%.1f,\"allocs_per_package\":%.1f,\"peak_rss_kb\":%ld}\n",
+         b->name, BENCH_VERSION, r, (unsigned long long)iterations, ns, (double)allocs / r,
+         ru.ru_maxrss);
+  fflush(stdout);
+
+  fprintf(stderr, "%-22s %10.1f ns/pkg %7.1f allocs/pkg %8ld KiB", b->name, ns,
+      (double)allocs / r, ru.ru_maxrss);
+  base = find_baseline(b->name);
+  if (base != NULL && base->ns_per_package > 0)
+    fprintf(stderr, "  %+6.1f%%", (ns / base->ns_per_package - 1) * 100);
+  fputc('\n', stderr);
+
+  return 0;
+}
+
+static int selected(const char *name, int argc, char **argv) {
+  if (argc == 0)
+    return 1;
+
+  for (int i = 0; i < argc; ++i)
+    if (strncmp(name, argv[i], strlen(argv[i])) == 0)
+      return 1;
+
+  return 0;
+}
+
+static void usage(FILE *stream, const char *argv0) {
+  fprintf(stream, "usage: %s [options] FIXTURES [BENCH...]\n\n", argv0);
+  fprintf(stream,
+         "Runs the benchmarks whose names start with one of BENCH, or all of them.\n\n"
+         "Options:\n"
+         "   -h, --help            show this help\n"
+         "       --baseline=FILE   compare against the output of an earlier run\n"
+         "       --min-time=MS     run each benchmark for at least MS milliseconds\n\n"
+         "Benchmarks:\n");
+
+  for (size_t i = 0; i < ARRAYSIZE(benches); ++i)
+    fprintf(stream, "   %s\n", benches[i].name);
+}
+
+int main(int argc, char **argv) {
+  enum {
+    OPT_BASELINE = 1000,
+    OPT_MIN_TIME,
+  };
+  static const struct option opts[] = {
+    { "help",     no_argument,       0, 'h' },
+    { "baseline", required_argument, 0, OPT_BASELINE },
+    { "min-time", required_argument, 0, OPT_MIN_TIME },
+    { 0, 0, 0, 0 },
+  };
+  int ret = 0;
+
+  for (;;) {
+    int opt = getopt_long(argc, argv, "h", opts, NULL), r;
+    if (opt < 0)
+      break;
+
+    switch (opt) {
+    case 'h':
+      usage(stdout, argv[0]);
+      return 0;
+    case OPT_BASELINE:
+      r = read_baseline(optarg);
+      if (r < 0) {
+        fprintf(stderr, "error: failed to read %s: %s\n", optarg, strerror(-r));
+        return 1;
+      }
+      break;
+    case OPT_MIN_TIME:
+      min_runtime_ns = strtoull(optarg, NULL, 10) * 1000 * 1000;
+      break;
+    default:
+      usage(stderr, argv[0]);
+      return 1;
+    }
+  }
+
+  if (argc - optind < 1) {
+    usage(stderr, argv[0]);
+    return 1;
+  }
+
+  for (size_t i = 0; i < ARRAYSIZE(benches); ++i) {
+    int status;
+    pid_t pid;
+
+    if (!selected(benches[i].name, argc - optind - 1, argv + optind + 1))
+      continue;
+
+    pid = fork();
+    if (pid < 0) {
+      fprintf(stderr, "error: fork failed: %s\n", strerror(errno));
+      return 1;
+    }
+
+    if (pid == 0)
+      _exit(run_bench(&benches[i], argv[optind]) < 0);
+
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      ret = 1;
+  }
+
+  return ret;
+}
+
+/* vim: set et ts=2 sw=2: */
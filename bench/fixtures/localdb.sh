@@ -0,0 +1,38 @@
+#!/bin/sh
+#
+# Writes a pacman local database for cow outdated to check against aur-stub:
+# pkg1 to pkgN at version 1.0-1, all of them foreign, and a repository
+# glibc that outdated leaves out unless given --all.
+#
+#   bench/fixtures/localdb.sh /tmp/fixture 2500
+#   ./aur-stub --synthetic=2500 &
+#   time ./cow --root=/tmp/fixture outdated
+
+set -e
+
+if [ $# -lt 1 ]; then
+  echo "usage: $0 ROOT [COUNT]" >&2
+  exit 1
+fi
+
+local="$1/var/lib/pacman/local"
+count="${2:-2500}"
+
+mkdir -p "$local"
+echo 9 > "$local/ALPM_DB_VERSION"
+
+package() {
+  mkdir -p "$local/$1-$2"
+  printf '%%NAME%%\n%s\n\n%%VERSION%%\n%s\n\n%%DESC%%\nx\n\n%%VALIDATION%%\n%s\n\n' \
+    "$1" "$2" "$3" > "$local/$1-$2/desc"
+}
+
+package glibc 2.40-1 pgp
+
+i=1
+while [ "$i" -le "$count" ]; do
+  package "pkg$i" 1.0-1 none
+  i=$((i + 1))
+done
+
+# vim: set et ts=2 sw=2:
@@ -0,0 +1,510 @@
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "aur.h"
+#include "macro.h"
+
+/* Drives libaur against an AUR, normally aur-stub, for a while and reports
+ * how it went: how many requests got answers, how fast, and how long they
+ * took. A fixed number of requests is kept queued, a new one taking the
+ * place of each that finishes, so that with no --rate this is a closed
+ * loop at the given concurrency; --rate has aur_run's rate limiter pace
+ * them instead.
+ *
+ * The results go to stdout as one line of JSON, and a summary to stderr:
+ *
+ *   {"load":"info","version":"...","concurrency":16,"rate":0.0,
+ *    "seconds":10.00,"requests":51234,"ok":51200,"failed":34,"throttled":0,
+ *    "requests_per_second":5123.4,"bytes_per_second":8123456.0,
+ *    "p50_ms":2.1,"p99_ms":7.9,"e2e_p50_ms":2.3,"e2e_p99_ms":9.0}
+ *
+ * p50 and p99 are of single transfers, as aur_get_metric has them; the e2e
+ * ones are from queueing a request to its done callback, retries and
+ * waiting to be admitted included. */
+
+#ifdef GIT_VERSION
+#define LOAD_VERSION GIT_VERSION
+#else
+#define LOAD_VERSION PACKAGE_VERSION
+#endif
+
+struct load_t {
+  uint64_t start_us;
+  uint64_t deadline_us;
+  uint64_t max_requests;
+
+  uint64_t queued;
+  uint64_t completed;
+  uint64_t ok;
+  uint64_t failed;
+  uint64_t throttled;
+  uint64_t server_errors;
+  uint64_t packages;
+  uint64_t bytes;
+
+  uint64_t *e2e_us;
+  size_t e2e_len;
+  size_t e2e_cap;
+
+  unsigned int seed;
+  int stop;
+};
+
+static const char *opt_domain = "localhost:8080";
+static int opt_secure;
+static int opt_concurrency = 16;
+static double opt_rate;
+static double opt_duration_s = 10;
+static uint64_t opt_requests;
+static int opt_type = REQUEST_INFO;
+static int opt_batch = 50;
+static int opt_retries;
+static long opt_timeout_ms;
+static int opt_decode;
+static int opt_stats;
+
+static char **names;
+static int nnames;
+
+static struct load_t load;
+
+static uint64_t now_us(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static const char *type_name(int type) {
+  switch (type) {
+  case REQUEST_INFO:
+    return "info";
+  case REQUEST_MULTIINFO:
+    return "multiinfo";
+  case REQUEST_SEARCH:
+    return "search";
+  case REQUEST_MSEARCH:
+    return "msearch";
+  default:
+    return NULL;
+  }
+}
+
+static int type_from_name(const char *name) {
+  if (strcmp(name, "info") == 0)
+    return REQUEST_INFO;
+  if (strcmp(name, "multiinfo") == 0)
+    return REQUEST_MULTIINFO;
+  if (strcmp(name, "search") == 0)
+    return REQUEST_SEARCH;
+  if (strcmp(name, "msearch") == 0)
+    return REQUEST_MSEARCH;
+  return -EINVAL;
+}
+
+static int add_name(char *name) {
+  static int cap;
+
+  if (nnames == cap) {
+    int newcap = cap ? cap * 2 : 1024;
+    char **newalloc = realloc(names, newcap * sizeof(char *));
+
+    if (newalloc == NULL)
+      return -ENOMEM;
+    names = newalloc;
+    cap = newcap;
+  }
+
+  names[nnames++] = name;
+  return 0;
+}
+
+static int read_names(const char *path) {
+  _cleanup_free_ char *line = NULL;
+  size_t linelen = 0;
+  ssize_t len;
+  FILE *fp;
+
+  fp = fopen(path, "re");
+  if (fp == NULL)
+    return -errno;
+
+  while ((len = getline(&line, &linelen, fp)) > 0) {
+    char *name;
+
+    line[strcspn(line, "\n")] = '\0';
+    if (line[0] == '\0')
+      continue;
+
+    name = strdup(line);
+    if (name == NULL || add_name(name) < 0) {
+      free(name);
+      fclose(fp);
+      return -ENOMEM;
+    }
+  }
+
+  fclose(fp);
+
+  return 0;
+}
+
+/* the names aur-stub --synthetic makes up */
+static int make_names(int n) {
+  for (int i = 1; i <= n; ++i) {
+    char *name;
+
+    if (asprintf(&name, "pkg%d", i) < 0)
+      return -ENOMEM;
+
+    if (add_name(name) < 0) {
+      free(name);
+      return -ENOMEM;
+    }
+  }
+
+  return 0;
+}
+
+static void record_e2e(uint64_t us) {
+  if (load.e2e_len == load.e2e_cap) {
+    size_t cap = load.e2e_cap ? load.e2e_cap * 2 : 4096;
+    uint64_t *newalloc = realloc(load.e2e_us, cap * sizeof(uint64_t));
+
+    /* losing a sample is better than losing the run */
+    if (newalloc == NULL)
+      return;
+    load.e2e_us = newalloc;
+    load.e2e_cap = cap;
+  }
+
+  load.e2e_us[load.e2e_len++] = us;
+}
+
+static int queue_one(aur_t *aur);
+
+static int request_done(aur_t *aur, aur_request_t *req, const void *response, int responselen) {
+  uint64_t *queued_us = aur_request_get_userdata(req);
+  int status = aur_request_get_http_status(req);
+
+  ++load.completed;
+  record_e2e(now_us() - *queued_us);
+  free(queued_us);
+
+  if (status == 429)
+    ++load.throttled;
+  else if (status >= 500)
+    ++load.server_errors;
+
+  if (aur_request_get_result(req) < 0 || status != 200) {
+    ++load.failed;
+  } else {
+    ++load.ok;
+    load.bytes += responselen;
+
+    if (opt_decode) {
+      struct package_t *packages;
+      int count;
+
+      if (aur_packages_from_json(response, &packages, &count) == 0) {
+        load.packages += count;
+        aur_package_list_free(packages);
+      }
+    }
+  }
+
+  if (!load.stop)
+    queue_one(aur);
+
+  return 0;
+}
+
+static int queue_one(aur_t *aur) {
+  aur_request_t *req;
+  uint64_t *queued_us;
+  int nargs, r;
+
+  if ((opt_requests > 0 && load.queued >= opt_requests) || now_us() >= load.deadline_us) {
+    load.stop = 1;
+    return 0;
+  }
+
+  r = aur_request_new(&req, opt_type, request_done);
+  if (r < 0)
+    return r;
+
+  nargs = opt_type == REQUEST_MULTIINFO ? opt_batch : 1;
+  for (int i = 0; i < nargs; ++i) {
+    r = aur_request_append_arg(req, names[rand_r(&load.seed) % nnames]);
+    if (r < 0)
+      goto finish;
+  }
+
+  queued_us = malloc(sizeof(uint64_t));
+  if (queued_us == NULL) {
+    r = -ENOMEM;
+    goto finish;
+  }
+  *queued_us = now_us();
+
+  aur_request_set_userdata(req, queued_us);
+  if (opt_retries > 0)
+    aur_request_set_retry(req, opt_retries, 100);
+  if (opt_timeout_ms > 0)
+    aur_request_set_timeout(req, opt_timeout_ms);
+
+  r = aur_queue_request(aur, req);
+  if (r < 0) {
+    free(queued_us);
+    goto finish;
+  }
+
+  ++load.queued;
+
+finish:
+  aur_request_unref(req);
+  return r;
+}
+
+static int u64_cmp(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+static double e2e_percentile_ms(double percentile) {
+  size_t i;
+
+  if (load.e2e_len == 0)
+    return 0;
+
+  i = (size_t)(percentile / 100 * (load.e2e_len - 1) + 0.5);
+  return load.e2e_us[i] / 1000.0;
+}
+
+static void report(aur_t *aur, uint64_t elapsed_us) {
+  struct metric_summary_t total;
+  double seconds = elapsed_us / 1e6;
+  double rps = seconds > 0 ? load.completed / seconds : 0;
+  double bps = seconds > 0 ? load.bytes / seconds : 0;
+
+  aur_get_metric(aur, METRIC_TOTAL, &total);
+  qsort(load.e2e_us, load.e2e_len, sizeof(uint64_t), u64_cmp);
+
+  printf("{\"load\":\"%s\",\"version\":\"%s\",\"concurrency\":%d,\"rate\":%.1f,"
+         "\"seconds\":%.2f,\"requests\":%llu,\"ok\":%llu,\"failed\":%llu,\"throttled\":%llu,"
+         "\"server_errors\":%llu,",
+         type_name(opt_type), LOAD_VERSION, opt_concurrency, opt_rate, seconds,
+         (unsigned long long)load.completed, (unsigned long long)load.ok,
+         (unsigned long long)load.failed, (unsigned long long)load.throttled,
+         (unsigned long long)load.server_errors);
+  if (opt_decode)
+    printf("\"packages\":%llu,", (unsigned long long)load.packages);
+  printf("\"requests_per_second\":%.1f,\"bytes_per_second\":%.1f,"
+         "\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"e2e_p50_ms\":%.3f,\"e2e_p99_ms\":%.3f}\n",
+         rps, bps, total.p50 / 1000.0, total.p99 / 1000.0,
+         e2e_percentile_ms(50), e2e_percentile_ms(99));
+  fflush(stdout);
+
+  fprintf(stderr, "%s: %llu requests in %.2fs, %.1f req/s, %.1f KiB/s\n",
+      type_name(opt_type), (unsigned long long)load.completed, seconds, rps, bps / 1024);
+  fprintf(stderr, "  ok %llu, failed %llu (429: %llu, 5xx: %llu)\n",
+      (unsigned long long)load.ok, (unsigned long long)load.failed,
+      (unsigned long long)load.throttled, (unsigned long long)load.server_errors);
+  fprintf(stderr, "  transfer p50 %.3fms p99 %.3fms, e2e p50 %.3fms p99 %.3fms\n",
+      total.p50 / 1000.0, total.p99 / 1000.0, e2e_percentile_ms(50), e2e_percentile_ms(99));
+
+  if (opt_stats) {
+    fputc('\n', stderr);
+    aur_dump_stats(aur, stderr);
+  }
+}
+
+static void usage(FILE *stream, const char *argv0) {
+  fprintf(stream, "usage: %s [options]\n\n", argv0);
+  fprintf(stream,
+         "Sends requests through libaur for a while, and reports throughput and latency.\n\n"
+         "Options:\n"
+         "   -h, --help              show this help\n"
+         "   -d, --domain=HOST       send requests to HOST (default: localhost:8080)\n"
+         "       --https             use https\n"
+         "   -c, --concurrency=N     keep N requests going (default: 16)\n"
+         "   -r, --rate=R            send at most R requests per second\n"
+         "   -t, --duration=S        stop queueing requests after S seconds (default: 10)\n"
+         "   -n, --requests=N        stop queueing requests after N of them\n"
+         "       --type=TYPE         info, multiinfo, search or msearch (default: info)\n"
+         "       --batch=N           ask for N packages per multiinfo (default: 50)\n"
+         "       --packages=N        ask for pkg1 to pkgN, as aur-stub makes up (default: 1000)\n"
+         "       --names=FILE        ask for, or search for, the names in FILE instead\n"
+         "       --retries=N         retry failed requests up to N times (default: 0)\n"
+         "       --timeout=MS        give up on requests after MS milliseconds\n"
+         "       --decode            decode the answers, counting packages\n"
+         "       --seed=N            seed the choice of names with N\n"
+         "       --stats             dump libaur's metrics to stderr at the end\n");
+}
+
+static int parse_options(int argc, char **argv) {
+  enum {
+    OPT_HTTPS = 1000,
+    OPT_TYPE,
+    OPT_BATCH,
+    OPT_PACKAGES,
+    OPT_NAMES,
+    OPT_RETRIES,
+    OPT_TIMEOUT,
+    OPT_DECODE,
+    OPT_SEED,
+    OPT_STATS,
+  };
+  static const struct option opts[] = {
+    { "help",        no_argument,       0, 'h' },
+    { "domain",      required_argument, 0, 'd' },
+    { "https",       no_argument,       0, OPT_HTTPS },
+    { "concurrency", required_argument, 0, 'c' },
+    { "rate",        required_argument, 0, 'r' },
+    { "duration",    required_argument, 0, 't' },
+    { "requests",    required_argument, 0, 'n' },
+    { "type",        required_argument, 0, OPT_TYPE },
+    { "batch",       required_argument, 0, OPT_BATCH },
+    { "packages",    required_argument, 0, OPT_PACKAGES },
+    { "names",       required_argument, 0, OPT_NAMES },
+    { "retries",     required_argument, 0, OPT_RETRIES },
+    { "timeout",     required_argument, 0, OPT_TIMEOUT },
+    { "decode",      no_argument,       0, OPT_DECODE },
+    { "seed",        required_argument, 0, OPT_SEED },
+    { "stats",       no_argument,       0, OPT_STATS },
+    { 0, 0, 0, 0 },
+  };
+  int npackages = 1000;
+
+  for (;;) {
+    int opt = getopt_long(argc, argv, "hd:c:r:t:n:", opts, NULL), r;
+    if (opt < 0)
+      break;
+
+    switch (opt) {
+    case 'h':
+      usage(stdout, argv[0]);
+      exit(0);
+    case 'd':
+      opt_domain = optarg;
+      break;
+    case OPT_HTTPS:
+      opt_secure = 1;
+      break;
+    case 'c':
+      opt_concurrency = atoi(optarg);
+      break;
+    case 'r':
+      opt_rate = strtod(optarg, NULL);
+      break;
+    case 't':
+      opt_duration_s = strtod(optarg, NULL);
+      break;
+    case 'n':
+      opt_requests = strtoull(optarg, NULL, 10);
+      break;
+    case OPT_TYPE:
+      opt_type = type_from_name(optarg);
+      if (opt_type < 0) {
+        fprintf(stderr, "error: invalid request type: %s\n", optarg);
+        return -EINVAL;
+      }
+      break;
+    case OPT_BATCH:
+      opt_batch = atoi(optarg);
+      break;
+    case OPT_PACKAGES:
+      npackages = atoi(optarg);
+      break;
+    case OPT_NAMES:
+      r = read_names(optarg);
+      if (r < 0) {
+        fprintf(stderr, "error: failed to read %s: %s\n", optarg, strerror(-r));
+        return r;
+      }
+      break;
+    case OPT_RETRIES:
+      opt_retries = atoi(optarg);
+      break;
+    case OPT_TIMEOUT:
+      opt_timeout_ms = strtol(optarg, NULL, 10);
+      break;
+    case OPT_DECODE:
+      opt_decode = 1;
+      break;
+    case OPT_SEED:
+      load.seed = strtoul(optarg, NULL, 10);
+      break;
+    case OPT_STATS:
+      opt_stats = 1;
+      break;
+    default:
+      return -EINVAL;
+    }
+  }
+
+  if (optind < argc || opt_concurrency < 1 || opt_rate < 0 || opt_duration_s <= 0 ||
+      opt_batch < 1 || npackages < 1)
+    return -EINVAL;
+
+  if (nnames == 0 && make_names(npackages) < 0)
+    return -ENOMEM;
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  uint64_t elapsed_us;
+  aur_t *aur;
+  int r;
+
+  if (parse_options(argc, argv) < 0) {
+    usage(stderr, argv[0]);
+    return 1;
+  }
+
+  r = aur_new(&aur, opt_domain, opt_secure);
+  if (r < 0) {
+    fprintf(stderr, "error: aur_new failed: %s\n", strerror(-r));
+    return 1;
+  }
+
+  aur_set_concurrency(aur, opt_concurrency, opt_concurrency);
+  if (opt_rate > 0)
+    aur_set_rate_limit(aur, opt_rate, 1);
+
+  load.start_us = now_us();
+  load.deadline_us = load.start_us + (uint64_t)(opt_duration_s * 1e6);
+
+  for (int i = 0; i < opt_concurrency && !load.stop; ++i) {
+    r = queue_one(aur);
+    if (r < 0) {
+      fprintf(stderr, "error: failed to queue request: %s\n", strerror(-r));
+      aur_free(aur);
+      return 1;
+    }
+  }
+
+  r = aur_run(aur);
+  elapsed_us = now_us() - load.start_us;
+  if (r < 0)
+    fprintf(stderr, "error: aur_run failed: %s\n", strerror(-r));
+
+  report(aur, elapsed_us);
+
+  aur_free(aur);
+  free(load.e2e_us);
+  for (int i = 0; i < nnames; ++i)
+    free(names[i]);
+  free(names);
+
+  return r < 0 || load.completed == 0;
+}
+
+/* vim: set et ts=2 sw=2: */
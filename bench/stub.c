@@ -0,0 +1,904 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <yajl_gen.h>
+#include <yajl_tree.h>
+
+#include "macro.h"
+
+/* A stand-in for the AUR's /rpc.php, for running libaur against offline:
+ * info, multiinfo, search and msearch are answered from the packages in
+ * recorded answers (such as bench/fixtures), or from made up ones. Answers
+ * can be slowed down, throttled to a bandwidth, or replaced by a 503 or a
+ * 429 some of the time.
+ *
+ * Every connection gets a thread of its own and is kept alive for as long
+ * as the client wants it. */
+
+#define RPC_VERSION 5
+#define MAX_HEADER_LEN 16384
+#define MAX_ARGS 4096
+
+struct package_t {
+  char *name;
+  char *description;
+  char *maintainer;
+
+  /* the package's entry in results, ready to be sent */
+  char *json;
+  size_t json_len;
+};
+
+struct buf_t {
+  char *data;
+  size_t len;
+  size_t cap;
+};
+
+struct query_t {
+  char *type;
+  char *by;
+  char *args[MAX_ARGS];
+  int nargs;
+};
+
+static struct package_t *packages;
+static int npackages;
+static int packages_cap;
+
+static const char *opt_bind = "127.0.0.1";
+static int opt_port = 8080;
+static long opt_latency_ms;
+static long opt_jitter_ms;
+static long opt_bandwidth_kbps;
+static double opt_error_rate;
+static double opt_throttle_rate;
+static int opt_max_results = 5000;
+static unsigned int opt_seed;
+
+static volatile sig_atomic_t quit;
+
+enum {
+  STAT_REQUESTS,
+  STAT_OK,
+  STAT_BAD_REQUEST,
+  STAT_NOT_FOUND,
+  STAT_THROTTLED,
+  STAT_FAILED,
+  STAT_CONNECTIONS,
+  STAT_BYTES,
+  _STAT_MAX,
+};
+
+static const char *stat_names[_STAT_MAX] = {
+  [STAT_REQUESTS] = "requests",
+  [STAT_OK] = "200",
+  [STAT_BAD_REQUEST] = "400",
+  [STAT_NOT_FOUND] = "404",
+  [STAT_THROTTLED] = "429",
+  [STAT_FAILED] = "503",
+  [STAT_CONNECTIONS] = "connections",
+  [STAT_BYTES] = "bytes",
+};
+
+static uint64_t stats[_STAT_MAX];
+
+static void count(int stat, uint64_t n) {
+  __atomic_fetch_add(&stats[stat], n, __ATOMIC_RELAXED);
+}
+
+static int buf_append(struct buf_t *b, const void *data, size_t len) {
+  if (b->len + len + 1 > b->cap) {
+    size_t cap = b->cap ? b->cap * 2 : 4096;
+    char *newalloc;
+
+    while (cap < b->len + len + 1)
+      cap *= 2;
+
+    newalloc = realloc(b->data, cap);
+    if (newalloc == NULL)
+      return -ENOMEM;
+    b->data = newalloc;
+    b->cap = cap;
+  }
+
+  memcpy(b->data + b->len, data, len);
+  b->len += len;
+  b->data[b->len] = '\0';
+
+  return 0;
+}
+
+static int buf_str(struct buf_t *b, const char *s) {
+  return buf_append(b, s, strlen(s));
+}
+
+static int buf_appendf(struct buf_t *b, const char *fmt, ...) {
+  _cleanup_free_ char *s = NULL;
+  va_list ap;
+  int r;
+
+  va_start(ap, fmt);
+  r = vasprintf(&s, fmt, ap);
+  va_end(ap);
+  if (r < 0)
+    return -ENOMEM;
+
+  return buf_append(b, s, r);
+}
+
+/* packages */
+
+static struct package_t *add_package(void) {
+  if (npackages == packages_cap) {
+    int cap = packages_cap ? packages_cap * 2 : 1024;
+    struct package_t *newalloc = realloc(packages, cap * sizeof(struct package_t));
+
+    if (newalloc == NULL)
+      return NULL;
+    packages = newalloc;
+    packages_cap = cap;
+  }
+
+  memset(&packages[npackages], 0, sizeof(struct package_t));
+  return &packages[npackages++];
+}
+
+static void gen_string(yajl_gen g, const char *s) {
+  yajl_gen_string(g, (const unsigned char *)s, strlen(s));
+}
+
+static void gen_value(yajl_gen g, yajl_val v) {
+  switch (v->type) {
+  case yajl_t_string:
+    gen_string(g, v->u.string);
+    break;
+  case yajl_t_number:
+    yajl_gen_number(g, v->u.number.r, strlen(v->u.number.r));
+    break;
+  case yajl_t_object:
+    yajl_gen_map_open(g);
+    for (size_t i = 0; i < v->u.object.len; ++i) {
+      gen_string(g, v->u.object.keys[i]);
+      gen_value(g, v->u.object.values[i]);
+    }
+    yajl_gen_map_close(g);
+    break;
+  case yajl_t_array:
+    yajl_gen_array_open(g);
+    for (size_t i = 0; i < v->u.array.len; ++i)
+      gen_value(g, v->u.array.values[i]);
+    yajl_gen_array_close(g);
+    break;
+  case yajl_t_true:
+    yajl_gen_bool(g, 1);
+    break;
+  case yajl_t_false:
+    yajl_gen_bool(g, 0);
+    break;
+  default:
+    yajl_gen_null(g);
+    break;
+  }
+}
+
+static char *get_string(yajl_val pkg, const char *key) {
+  const char *path[] = { key, NULL };
+  yajl_val v = yajl_tree_get(pkg, path, yajl_t_string);
+
+  return v != NULL ? strdup(v->u.string) : NULL;
+}
+
+static int add_fixture_package(yajl_val pkg) {
+  const unsigned char *buf;
+  struct package_t *p;
+  yajl_gen g;
+  size_t len;
+
+  p = add_package();
+  if (p == NULL)
+    return -ENOMEM;
+
+  p->name = get_string(pkg, "Name");
+  p->description = get_string(pkg, "Description");
+  p->maintainer = get_string(pkg, "Maintainer");
+  if (p->name == NULL) {
+    --npackages;
+    return 0;
+  }
+
+  g = yajl_gen_alloc(NULL);
+  if (g == NULL)
+    return -ENOMEM;
+
+  gen_value(g, pkg);
+  yajl_gen_get_buf(g, &buf, &len);
+  p->json = strndup((const char *)buf, len);
+  p->json_len = len;
+  yajl_gen_free(g);
+
+  return p->json ? 0 : -ENOMEM;
+}
+
+static int load_fixture(const char *path) {
+  const char *results_path[] = { "results", NULL };
+  _cleanup_free_ char *data = NULL;
+  char errbuf[1024];
+  yajl_val root, results;
+  size_t len = 0;
+  FILE *fp;
+  int r = 0;
+
+  fp = fopen(path, "re");
+  if (fp == NULL)
+    return -errno;
+
+  if (getdelim(&data, &len, '\0', fp) < 0) {
+    fclose(fp);
+    return -EIO;
+  }
+  fclose(fp);
+
+  root = yajl_tree_parse(data, errbuf, sizeof(errbuf));
+  if (root == NULL) {
+    fprintf(stderr, "error: %s: %s\n", path, errbuf);
+    return -EINVAL;
+  }
+
+  results = yajl_tree_get(root, results_path, yajl_t_array);
+  if (results == NULL) {
+    yajl_tree_free(root);
+    return -EINVAL;
+  }
+
+  for (size_t i = 0; i < results->u.array.len && r == 0; ++i)
+    r = add_fixture_package(results->u.array.values[i]);
+
+  yajl_tree_free(root);
+
+  return r;
+}
+
+static int add_synthetic_packages(int n) {
+  for (int i = 1; i <= n; ++i) {
+    struct package_t *p = add_package();
+    int r;
+
+    if (p == NULL)
+      return -ENOMEM;
+
+    if (asprintf(&p->name, "pkg%d", i) < 0 ||
+        asprintf(&p->description, "synthetic package number %d", i) < 0 ||
+        asprintf(&p->maintainer, "maint%d", i % 100) < 0)
+      return -ENOMEM;
+
+    r = asprintf(&p->json,
+        "{\"ID\":%d,\"Name\":\"%s\",\"PackageBaseID\":%d,\"PackageBase\":\"%s\","
+        "\"Version\":\"1.%d-1\",\"Description\":\"%s\",\"URL\":\"https://example.org/%s\","
+        "\"NumVotes\":%d,\"Maintainer\":\"%s\","
+        "\"FirstSubmitted\":1400000000,\"LastModified\":%d,"
+        "\"URLPath\":\"/cgit/aur.git/snapshot/%s.tar.gz\","
+        "\"Depends\":[\"glibc\",\"pkg%d>=1.0\"],\"License\":[\"MIT\"]}",
+        i, p->name, i, p->name, i % 50, p->description, p->name, i % 1000,
+        p->maintainer, 1500000000 + i, p->name, i % n + 1);
+    if (r < 0)
+      return -ENOMEM;
+    p->json_len = r;
+  }
+
+  return 0;
+}
+
+static int package_cmp(const void *a, const void *b) {
+  const struct package_t *x = a, *y = b;
+
+  return strcmp(x->name, y->name);
+}
+
+/* sorts the packages by name and drops those seen twice */
+static void index_packages(void) {
+  int n = 0;
+
+  qsort(packages, npackages, sizeof(struct package_t), package_cmp);
+
+  for (int i = 0; i < npackages; ++i) {
+    if (n > 0 && strcmp(packages[n - 1].name, packages[i].name) == 0) {
+      free(packages[i].name);
+      free(packages[i].description);
+      free(packages[i].maintainer);
+      free(packages[i].json);
+      continue;
+    }
+    packages[n++] = packages[i];
+  }
+
+  npackages = n;
+}
+
+static const struct package_t *find_package(const char *name) {
+  struct package_t key = { .name = (char *)name };
+
+  return bsearch(&key, packages, npackages, sizeof(struct package_t), package_cmp);
+}
+
+/* answers */
+
+static int answer_begin(struct buf_t *b, const char *type) {
+  return buf_appendf(b, "{\"version\":%d,\"type\":\"%s\",\"results\":[", RPC_VERSION, type);
+}
+
+static int answer_package(struct buf_t *b, int n, const struct package_t *p) {
+  if (n > 0 && buf_str(b, ",") < 0)
+    return -ENOMEM;
+
+  return buf_append(b, p->json, p->json_len);
+}
+
+static int answer_end(struct buf_t *b, int n) {
+  return buf_appendf(b, "],\"resultcount\":%d}", n);
+}
+
+static int answer_error(struct buf_t *b, const char *error) {
+  b->len = 0;
+
+  return buf_appendf(b, "{\"version\":%d,\"type\":\"error\",\"resultcount\":0,"
+      "\"results\":[],\"error\":\"%s\"}", RPC_VERSION, error);
+}
+
+static int answer_info(struct buf_t *b, const struct query_t *q) {
+  int n = 0;
+
+  if (answer_begin(b, "multiinfo") < 0)
+    return -ENOMEM;
+
+  for (int i = 0; i < q->nargs; ++i) {
+    const struct package_t *p = find_package(q->args[i]);
+
+    if (p != NULL && answer_package(b, n++, p) < 0)
+      return -ENOMEM;
+  }
+
+  return answer_end(b, n);
+}
+
+static int search_matches(const struct package_t *p, const char *by, const char *term) {
+  if (strcmp(by, "maintainer") == 0)
+    return p->maintainer != NULL && strcasecmp(p->maintainer, term) == 0;
+
+  if (strcasestr(p->name, term) != NULL)
+    return 1;
+
+  return strcmp(by, "name") != 0 && p->description != NULL &&
+      strcasestr(p->description, term) != NULL;
+}
+
+static int answer_search(struct buf_t *b, const struct query_t *q, const char *by) {
+  const char *term = q->nargs > 0 ? q->args[0] : "";
+  int n = 0;
+
+  if (strcmp(by, "maintainer") != 0 && strlen(term) < 2)
+    return answer_error(b, "Query arg too small.");
+
+  if (answer_begin(b, "search") < 0)
+    return -ENOMEM;
+
+  for (int i = 0; i < npackages; ++i) {
+    if (!search_matches(&packages[i], by, term))
+      continue;
+
+    if (n == opt_max_results)
+      return answer_error(b, "Too many package results.");
+
+    if (answer_package(b, n++, &packages[i]) < 0)
+      return -ENOMEM;
+  }
+
+  return answer_end(b, n);
+}
+
+static int answer_query(struct buf_t *b, const struct query_t *q) {
+  if (q->type == NULL)
+    return answer_error(b, "No request type/data specified.");
+
+  if (strcmp(q->type, "info") == 0 || strcmp(q->type, "multiinfo") == 0)
+    return answer_info(b, q);
+
+  if (strcmp(q->type, "search") == 0)
+    return answer_search(b, q, q->by ? q->by : "name-desc");
+
+  if (strcmp(q->type, "msearch") == 0)
+    return answer_search(b, q, "maintainer");
+
+  return answer_error(b, "Incorrect request type specified.");
+}
+
+/* requests */
+
+static int hexval(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+/* decodes %XX and + in place */
+static void unescape(char *s) {
+  char *out = s;
+
+  for (; *s; ++s) {
+    if (*s == '+') {
+      *out++ = ' ';
+    } else if (*s == '%' && hexval(s[1]) >= 0 && hexval(s[2]) >= 0) {
+      *out++ = hexval(s[1]) << 4 | hexval(s[2]);
+      s += 2;
+    } else {
+      *out++ = *s;
+    }
+  }
+
+  *out = '\0';
+}
+
+/* splits the query string up in place */
+static void parse_query(char *qs, struct query_t *q) {
+  char *saveptr = NULL;
+
+  for (char *kv = strtok_r(qs, "&", &saveptr); kv; kv = strtok_r(NULL, "&", &saveptr)) {
+    char *value = strchr(kv, '=');
+
+    if (value == NULL)
+      continue;
+    *value++ = '\0';
+
+    unescape(kv);
+    unescape(value);
+
+    if (strcmp(kv, "type") == 0)
+      q->type = value;
+    else if (strcmp(kv, "by") == 0)
+      q->by = value;
+    else if ((strcmp(kv, "arg") == 0 || strcmp(kv, "arg[]") == 0) && q->nargs < MAX_ARGS)
+      q->args[q->nargs++] = value;
+  }
+}
+
+static double random_fraction(unsigned int *seed) {
+  return (double)rand_r(seed) / ((double)RAND_MAX + 1);
+}
+
+static void sleep_ms(long ms) {
+  struct timespec ts = { ms / 1000, (ms % 1000) * 1000000 };
+
+  while (nanosleep(&ts, &ts) < 0 && errno == EINTR && !quit)
+    ;
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -errno;
+    }
+
+    data += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+/* sends in slices every 10ms, as fast as the bandwidth allows */
+static int write_throttled(int fd, const char *data, size_t len) {
+  size_t slice;
+
+  if (opt_bandwidth_kbps <= 0)
+    return write_all(fd, data, len);
+
+  slice = opt_bandwidth_kbps * 1024 / 100;
+  if (slice == 0)
+    slice = 1;
+
+  while (len > 0) {
+    size_t n = MIN(slice, len);
+    int r = write_all(fd, data, n);
+
+    if (r < 0)
+      return r;
+
+    data += n;
+    len -= n;
+    if (len > 0)
+      sleep_ms(10);
+  }
+
+  return 0;
+}
+
+static int send_response(int fd, int status, const char *reason, const char *extra_headers,
+    const struct buf_t *body, int head_only) {
+  char header[512];
+  int len, r;
+
+  len = snprintf(header, sizeof(header),
+      "HTTP/1.1 %d %s\r\n"
+      "Content-Type: application/json\r\n"
+      "Content-Length: %zu\r\n"
+      "%s"
+      "\r\n",
+      status, reason, body->len, extra_headers ? extra_headers : "");
+
+  r = write_all(fd, header, len);
+  if (r < 0 || head_only)
+    return r;
+
+  count(STAT_BYTES, len + body->len);
+
+  return write_throttled(fd, body->data, body->len);
+}
+
+/* reads the next request's head, leaving what follows it in the buffer */
+static int read_request(int fd, struct buf_t *in, size_t *head_len) {
+  for (;;) {
+    char chunk[4096];
+    char *end;
+    ssize_t n;
+
+    if (in->len > 0) {
+      end = strstr(in->data, "\r\n\r\n");
+      if (end != NULL) {
+        *head_len = end - in->data + 4;
+        return 1;
+      }
+    }
+
+    if (in->len > MAX_HEADER_LEN)
+      return -E2BIG;
+
+    n = read(fd, chunk, sizeof(chunk));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return -errno;
+    if (n == 0)
+      return 0;
+
+    if (buf_append(in, chunk, n) < 0)
+      return -ENOMEM;
+  }
+}
+
+static int wants_close(const char *head) {
+  const char *h = strcasestr(head, "\r\nConnection:");
+
+  if (h == NULL)
+    return strstr(head, " HTTP/1.0\r\n") != NULL;
+
+  h += strlen("\r\nConnection:");
+  h += strspn(h, " \t");
+
+  return strncasecmp(h, "close", 5) == 0;
+}
+
+static int handle_request(int fd, char *head, unsigned int *seed) {
+  struct buf_t body = { 0 };
+  struct query_t q = { 0 };
+  char method[16], target[8192];
+  char *path, *qs;
+  int r, head_only;
+
+  count(STAT_REQUESTS, 1);
+
+  if (sscanf(head, "%15s %8191s", method, target) != 2) {
+    count(STAT_BAD_REQUEST, 1);
+    buf_str(&body, "{}");
+    r = send_response(fd, 400, "Bad Request", "Connection: close\r\n", &body, 0);
+    free(body.data);
+    return r < 0 ? r : -EINVAL;
+  }
+
+  head_only = strcmp(method, "HEAD") == 0;
+
+  path = target;
+  qs = strchr(target, '?');
+  if (qs != NULL)
+    *qs++ = '\0';
+
+  if (strcmp(path, "/rpc.php") != 0 && strcmp(path, "/rpc") != 0) {
+    count(STAT_NOT_FOUND, 1);
+    buf_str(&body, "{}");
+    r = send_response(fd, 404, "Not Found", NULL, &body, head_only);
+    goto finish;
+  }
+
+  if (opt_latency_ms > 0 || opt_jitter_ms > 0)
+    sleep_ms(opt_latency_ms + (opt_jitter_ms > 0 ? rand_r(seed) % (opt_jitter_ms + 1) : 0));
+
+  if (opt_throttle_rate > 0 && random_fraction(seed) < opt_throttle_rate) {
+    count(STAT_THROTTLED, 1);
+    buf_str(&body, "{}");
+    r = send_response(fd, 429, "Too Many Requests", "Retry-After: 1\r\n", &body, head_only);
+    goto finish;
+  }
+
+  if (opt_error_rate > 0 && random_fraction(seed) < opt_error_rate) {
+    count(STAT_FAILED, 1);
+    buf_str(&body, "{}");
+    r = send_response(fd, 503, "Service Unavailable", NULL, &body, head_only);
+    goto finish;
+  }
+
+  if (qs != NULL)
+    parse_query(qs, &q);
+
+  r = answer_query(&body, &q);
+  if (r < 0)
+    goto finish;
+
+  count(STAT_OK, 1);
+  r = send_response(fd, 200, "OK", NULL, &body, head_only);
+
+finish:
+  free(body.data);
+  return r;
+}
+
+static void *serve_connection(void *userdata) {
+  int fd = (int)(intptr_t)userdata;
+  unsigned int seed = opt_seed ^ (unsigned int)fd ^ (unsigned int)(uintptr_t)pthread_self();
+  struct buf_t in = { 0 };
+
+  count(STAT_CONNECTIONS, 1);
+
+  while (!quit) {
+    size_t head_len;
+    int close_after;
+
+    if (read_request(fd, &in, &head_len) <= 0)
+      break;
+
+    in.data[head_len - 2] = '\0';
+    close_after = wants_close(in.data);
+
+    if (handle_request(fd, in.data, &seed) < 0 || close_after)
+      break;
+
+    /* GETs have no body, so the next request starts right after */
+    memmove(in.data, in.data + head_len, in.len - head_len + 1);
+    in.len -= head_len;
+  }
+
+  free(in.data);
+  close(fd);
+
+  return NULL;
+}
+
+static int open_socket(void) {
+  union {
+    struct sockaddr sa;
+    struct sockaddr_in in;
+  } addr = { .in.sin_family = AF_INET, .in.sin_port = htons(opt_port) };
+  int fd, one = 1;
+
+  if (inet_pton(AF_INET, opt_bind, &addr.in.sin_addr) != 1)
+    return -EINVAL;
+
+  fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -errno;
+
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  if (bind(fd, &addr.sa, sizeof(addr.in)) < 0 || listen(fd, 1024) < 0) {
+    int r = -errno;
+    close(fd);
+    return r;
+  }
+
+  return fd;
+}
+
+static void serve(int listenfd) {
+  pthread_attr_t attr;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  while (!quit) {
+    pthread_t thread;
+    int fd, one = 1;
+
+    fd = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno != EINTR)
+        fprintf(stderr, "warning: accept failed: %s\n", strerror(errno));
+      continue;
+    }
+
+    /* headers and body go out in separate writes */
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (pthread_create(&thread, &attr, serve_connection, (void *)(intptr_t)fd) != 0)
+      close(fd);
+  }
+
+  pthread_attr_destroy(&attr);
+}
+
+static void print_stats(void) {
+  fprintf(stderr, "aur-stub:");
+  for (int i = 0; i < _STAT_MAX; ++i)
+    fprintf(stderr, " %s=%llu", stat_names[i],
+        (unsigned long long)__atomic_load_n(&stats[i], __ATOMIC_RELAXED));
+  fputc('\n', stderr);
+}
+
+static void handle_signal(int sig) {
+  (void)sig;
+  quit = 1;
+}
+
+static void usage(FILE *stream, const char *argv0) {
+  fprintf(stream, "usage: %s [options]\n\n", argv0);
+  fprintf(stream,
+         "Answers AUR RPC queries from recorded or made up packages.\n\n"
+         "Options:\n"
+         "   -h, --help               show this help\n"
+         "   -b, --bind=ADDR          listen on ADDR (default: 127.0.0.1)\n"
+         "   -p, --port=PORT          listen on PORT (default: 8080)\n"
+         "   -f, --fixture=FILE       serve the packages in FILE, an RPC answer\n"
+         "   -n, --synthetic=N        serve N made up packages, pkg1 to pkgN\n"
+         "       --latency=MS         wait MS milliseconds before answering\n"
+         "       --jitter=MS          and up to MS more\n"
+         "       --bandwidth=KBPS     send at most KBPS KiB per second per connection\n"
+         "       --error-rate=P       answer with a 503 with probability P\n"
+         "       --throttle-rate=P    answer with a 429 with probability P\n"
+         "       --max-results=N      refuse searches matching more than N packages\n"
+         "       --seed=N             seed the random choices with N\n\n"
+         "Counts of requests and answers go to stderr on SIGINT or SIGTERM.\n");
+}
+
+static int parse_options(int argc, char **argv) {
+  enum {
+    OPT_LATENCY = 1000,
+    OPT_JITTER,
+    OPT_BANDWIDTH,
+    OPT_ERROR_RATE,
+    OPT_THROTTLE_RATE,
+    OPT_MAX_RESULTS,
+    OPT_SEED,
+  };
+  static const struct option opts[] = {
+    { "help",          no_argument,       0, 'h' },
+    { "bind",          required_argument, 0, 'b' },
+    { "port",          required_argument, 0, 'p' },
+    { "fixture",       required_argument, 0, 'f' },
+    { "synthetic",     required_argument, 0, 'n' },
+    { "latency",       required_argument, 0, OPT_LATENCY },
+    { "jitter",        required_argument, 0, OPT_JITTER },
+    { "bandwidth",     required_argument, 0, OPT_BANDWIDTH },
+    { "error-rate",    required_argument, 0, OPT_ERROR_RATE },
+    { "throttle-rate", required_argument, 0, OPT_THROTTLE_RATE },
+    { "max-results",   required_argument, 0, OPT_MAX_RESULTS },
+    { "seed",          required_argument, 0, OPT_SEED },
+    { 0, 0, 0, 0 },
+  };
+
+  for (;;) {
+    int opt = getopt_long(argc, argv, "hb:p:f:n:", opts, NULL), r;
+    if (opt < 0)
+      break;
+
+    switch (opt) {
+    case 'h':
+      usage(stdout, argv[0]);
+      exit(0);
+    case 'b':
+      opt_bind = optarg;
+      break;
+    case 'p':
+      opt_port = atoi(optarg);
+      break;
+    case 'f':
+      r = load_fixture(optarg);
+      if (r < 0) {
+        fprintf(stderr, "error: failed to load %s: %s\n", optarg, strerror(-r));
+        exit(1);
+      }
+      break;
+    case 'n':
+      r = add_synthetic_packages(atoi(optarg));
+      if (r < 0) {
+        fprintf(stderr, "error: failed to make up packages: %s\n", strerror(-r));
+        exit(1);
+      }
+      break;
+    case OPT_LATENCY:
+      opt_latency_ms = strtol(optarg, NULL, 10);
+      break;
+    case OPT_JITTER:
+      opt_jitter_ms = strtol(optarg, NULL, 10);
+      break;
+    case OPT_BANDWIDTH:
+      opt_bandwidth_kbps = strtol(optarg, NULL, 10);
+      break;
+    case OPT_ERROR_RATE:
+      opt_error_rate = strtod(optarg, NULL);
+      break;
+    case OPT_THROTTLE_RATE:
+      opt_throttle_rate = strtod(optarg, NULL);
+      break;
+    case OPT_MAX_RESULTS:
+      opt_max_results = atoi(optarg);
+      break;
+    case OPT_SEED:
+      opt_seed = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      return -EINVAL;
+    }
+  }
+
+  if (optind < argc || opt_latency_ms < 0 || opt_jitter_ms < 0 || opt_max_results < 0)
+    return -EINVAL;
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  struct sigaction sa = { .sa_handler = handle_signal };
+  int listenfd;
+
+  if (parse_options(argc, argv) < 0) {
+    usage(stderr, argv[0]);
+    return 1;
+  }
+
+  if (npackages == 0 && add_synthetic_packages(1000) < 0)
+    return 1;
+
+  index_packages();
+
+  /* no SA_RESTART, so that accept gives up on a signal */
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  listenfd = open_socket();
+  if (listenfd < 0) {
+    fprintf(stderr, "error: failed to listen on %s:%d: %s\n", opt_bind, opt_port,
+        strerror(-listenfd));
+    return 1;
+  }
+
+  fprintf(stderr, "aur-stub: serving %d packages on %s:%d\n", npackages, opt_bind, opt_port);
+
+  serve(listenfd);
+
+  close(listenfd);
+  print_stats();
+
+  return 0;
+}
+
+/* vim: set et ts=2 sw=2: */
@@ -0,0 +1,105 @@
+#include <stdint.h>
+
+#include "aur-internal.h"
+
+/* Admission control for transfers: a token bucket caps the request rate and
+ * an AIMD window caps how many transfers are in flight. The window starts
+ * wide open, is halved when the server pushes back (429, 5xx) or latency
+ * exceeds the target, at most once per observed round trip, and grows back
+ * by roughly one slot per window's worth of fast, successful transfers. */
+
+#define DEFAULT_WINDOW_MAX 32
+
+void admission_init(struct admission_t *a) {
+  a->rate = 0;
+  a->burst = 0;
+  a->tokens = 0;
+  a->refilled_us = 0;
+
+  a->window = DEFAULT_WINDOW_MAX;
+  a->window_min = 1;
+  a->window_max = DEFAULT_WINDOW_MAX;
+  a->latency_target_us = 0;
+  a->latency_ewma_us = 0;
+  a->decreased_us = 0;
+}
+
+static void bucket_refill(struct admission_t *a, uint64_t now) {
+  if (a->refilled_us != 0 && now > a->refilled_us) {
+    a->tokens += (now - a->refilled_us) * a->rate / 1e6;
+    if (a->tokens > a->burst)
+      a->tokens = a->burst;
+  }
+
+  a->refilled_us = now;
+}
+
+/* Returns non-zero and consumes a token if another transfer may start now,
+ * given that active transfers are already running. */
+int admission_acquire(struct admission_t *a, uint64_t now, int active) {
+  if (active >= (int)a->window)
+    return 0;
+
+  if (a->rate <= 0)
+    return 1;
+
+  bucket_refill(a, now);
+  if (a->tokens < 1)
+    return 0;
+
+  a->tokens -= 1;
+  return 1;
+}
+
+/* Microseconds until the bucket holds a whole token again, 0 if it already
+ * does or if no rate limit is set. */
+uint64_t admission_next_token_us(struct admission_t *a, uint64_t now) {
+  if (a->rate <= 0)
+    return 0;
+
+  bucket_refill(a, now);
+  if (a->tokens >= 1)
+    return 0;
+
+  return (uint64_t)((1 - a->tokens) * 1e6 / a->rate) + 1;
+}
+
+static int is_backpressure(int http_status, int failed) {
+  return failed || http_status == 429 || http_status >= 500;
+}
+
+void admission_complete(struct admission_t *a, uint64_t now, uint64_t latency_us,
+    int http_status, int failed) {
+  int congested;
+
+  if (a->latency_ewma_us == 0)
+    a->latency_ewma_us = latency_us;
+  else
+    a->latency_ewma_us = (a->latency_ewma_us * 7 + latency_us) / 8;
+
+  congested = is_backpressure(http_status, failed) ||
+    (a->latency_target_us != 0 && latency_us > a->latency_target_us);
+
+  if (!congested) {
+    a->window += 1.0 / a->window;
+    if (a->window > a->window_max)
+      a->window = a->window_max;
+    return;
+  }
+
+  /* transfers started under the old window complete in a burst; only react
+   * to the first of them */
+  if (now - a->decreased_us < a->latency_ewma_us)
+    return;
+
+  a->decreased_us = now;
+  a->window /= 2;
+  if (a->window < a->window_min)
+    a->window = a->window_min;
+
+  /* a 429 means the rate is too high as well, not just the concurrency */
+  if (http_status == 429)
+    a->tokens = 0;
+}
+
+/* vim: set et ts=2 sw=2: */
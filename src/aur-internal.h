@@ -2,19 +2,155 @@
 #define _AUR_INTERNAL_H
 
 #include <stdlib.h>
+#include <time.h>
 
 #include <curl/curl.h>
 
 #include "aur.h"
 #include "macro.h"
 
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+struct histogram_t {
+  uint64_t counts[HISTOGRAM_BUCKETS];
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+};
+
+#define MAX_DNS_ENTRIES 8
+
+struct dns_entry_t {
+  /* host:port:address, as CURLOPT_RESOLVE takes it */
+  char *entry;
+  time_t expires;
+};
+
+struct request_list_t {
+  aur_request_t *head;
+  aur_request_t *tail;
+  int size;
+};
+
+struct admission_t {
+  /* token bucket, disabled while rate is 0 */
+  double rate;
+  double burst;
+  double tokens;
+  uint64_t refilled_us;
+
+  /* AIMD concurrency window */
+  double window;
+  int window_min;
+  int window_max;
+  uint64_t latency_target_us;
+  uint64_t latency_ewma_us;
+  uint64_t decreased_us;
+};
+
+#define MAX_ENDPOINTS 8
+
+struct endpoint_t {
+  char *domainname;
+
+  uint64_t latency_ewma_us;
+  double error_ewma;
+  uint64_t used_us;
+
+  uint64_t transfers;
+  uint64_t failures;
+};
+
+/* memory held by the bodies of transfers in flight */
+struct body_budget_t {
+  size_t limit;
+  size_t used;
+};
+
+struct body_t {
+  char *data;
+  size_t size;
+  size_t capacity;
+
+  /* data is an anonymous or, after spilling, a file mapping */
+  int mapped;
+  int spilled;
+  int fd;
+  int finished;
+
+  /* negative errno value if a spilled body couldn't be mapped back in */
+  int error;
+
+  CURL *curl;
+  struct body_budget_t *budget;
+  size_t charged;
+};
+
+struct aur_response_t {
+  int refcount;
+  struct body_t body;
+
+  /* header lines of the final response, each NUL terminated */
+  char *headers;
+  size_t headers_len;
+  size_t headers_cap;
+};
+
 struct aur_t {
   const char *proto;
-  char *domainname;
   int version;
 
-  int active_requests;
+  /* the domain passed to aur_new comes first, mirrors follow */
+  struct endpoint_t endpoints[MAX_ENDPOINTS];
+  int n_endpoints;
+
   CURLM *curlm;
+
+  /* DNS results and TLS sessions, shared between transfers and persisted
+   * by aur_save_state */
+  CURLSH *share;
+  struct curl_slist *resolve;
+  struct dns_entry_t dns[MAX_DNS_ENTRIES];
+  int n_dns;
+
+  /* queued requests wait in pending, one list per priority class, until
+   * admission lets them onto curlm */
+  struct request_list_t pending[_PRIORITY_MAX];
+  int priority_limit[_PRIORITY_MAX];
+  struct request_list_t active;
+  struct request_list_t delayed;
+  /* libaur's own transfers, such as aur_prewarm's, go straight onto curlm
+   * without taking an admission slot */
+  struct request_list_t internal;
+  struct admission_t admission;
+  struct body_budget_t budget;
+
+  /* hedge transfers in flight, on top of active */
+  int hedges;
+  unsigned int seed;
+
+  /* REQUEST_INFO requests held back to be merged into one multiinfo once
+   * the window closes */
+  long coalesce_window_ms;
+  struct request_list_t coalescing;
+  uint64_t coalesce_deadline_us;
+  size_t coalesce_arglen;
+
+  /* requests answered by cowd, and what it has sent back so far */
+  int daemon_fd;
+  uint64_t remote_seq;
+  struct request_list_t remote;
+  char *remote_in;
+  size_t remote_in_len;
+  size_t remote_in_cap;
+
+  long run_timeout_ms;
+  uint64_t run_deadline_us;
+  int aborted;
+
+  struct histogram_t metrics[_METRIC_MAX];
 };
 
 struct arglist_t {
@@ -30,22 +166,146 @@ struct strbuf_t {
 };
 
 struct aur_request_t {
+  aur_request_t *prev;
+  aur_request_t *next;
+  struct request_list_t *list;
+
   int request_type;
+  int priority;
   struct arglist_t args;
   char *url;
+  struct curl_slist *headers;
 
   CURL *curl;
-  struct strbuf_t body;
+  aur_response_t *response;
   aur_request_done_fn done_fn;
 
   int refcount;
+  int result;
+
+  long timeout_ms;
+  uint64_t deadline_us;
+
+  int max_retries;
+  long retry_base_ms;
+  int attempts;
+  uint64_t started_us;
+  uint64_t not_before_us;
+
+  /* the endpoint url points at, and those the request stays away from
+   * because they failed it already */
+  int endpoint;
+  uint32_t endpoints_avoid;
+
+  /* a duplicate transfer racing the primary one */
+  long hedge_after_ms;
+  int hedged;
+  CURL *hedge_curl;
+  aur_response_t *hedge_response;
+  int hedge_endpoint;
+
+  struct request_timing_t timing;
+
+  /* a coalesced multiinfo lists the info requests it answers in merged,
+   * each of which points back at it */
+  struct request_list_t merged;
+  aur_request_t *merged_into;
+  int http_status;
+
+  /* set on libaur's own requests, which admission and the metrics leave
+   * out */
+  int internal;
+
+  /* non-zero while the request waits for an answer from cowd */
+  uint64_t remote_id;
+
+  /* set while the request belongs to an aur_pool_t */
+  struct pool_worker_t *worker;
+  aur_request_done_fn pool_done_fn;
+  aur_request_t *pool_next;
+  int pool_responselen;
+
+  /* runs once the request's timing has been accounted for, after which
+   * the aur_t no longer touches it */
+  void (*completed_fn)(aur_t *aur, aur_request_t *request);
 
   int debug;
   void *userdata;
 };
 
+struct field_descriptor_t {
+  size_t offset;
+  size_t width;
+};
+
+/* indexed by PACKAGE_FIELD_* */
+extern const struct field_descriptor_t package_fields[];
+
+#define FIELD_IS_STRING(f) ((f) >= PACKAGE_FIELD_NAME && (f) <= PACKAGE_FIELD_VERSION)
+#define FIELD_IS_INTEGER(f) ((f) >= PACKAGE_FIELD_CATEGORY_ID && (f) <= PACKAGE_FIELD_MODIFIED)
+#define FIELD_IS_LIST(f) ((f) >= PACKAGE_FIELD_LICENSES && (f) <= PACKAGE_FIELD_REPLACES)
+
+#define N_STRING_FIELDS (PACKAGE_FIELD_VERSION - PACKAGE_FIELD_NAME + 1)
+#define N_INTEGER_FIELDS (PACKAGE_FIELD_MODIFIED - PACKAGE_FIELD_CATEGORY_ID + 1)
+#define N_LIST_FIELDS (PACKAGE_FIELD_REPLACES - PACKAGE_FIELD_LICENSES + 1)
+
+void package_reset_internal(struct package_t *package);
+char *rpc_error_internal(const char *json);
+
 int request_build_internal(aur_request_t *request, const char *protocol, const char *domain, int rpc_version);
+int request_build_url_internal(const aur_request_t *request, const char *protocol, const char *domain,
+    int rpc_version, char **url);
 size_t request_write_handler_internal(void *ptr, size_t nmemb, size_t size, void *userdata);
+void request_reset_body_internal(aur_request_t *request);
+void request_drop_hedge_internal(aur_request_t *request);
+void request_collect_timing_internal(aur_request_t *request);
+int request_set_body_internal(aur_request_t *request, const void *data, size_t len);
+void request_share_response_internal(aur_request_t *request, aur_request_t *from);
+curl_off_t request_response_size_internal(aur_request_t *request);
+
+void body_budget_init(struct body_budget_t *budget);
+void body_init(struct body_t *body, CURL *curl, struct body_budget_t *budget);
+void body_reset(struct body_t *body);
+int body_append(struct body_t *body, const void *data, size_t len);
+char *body_finish(struct body_t *body);
+int response_new_internal(aur_response_t **ret, CURL *curl, struct body_budget_t *budget);
+size_t response_header_handler_internal(char *ptr, size_t size, size_t nmemb, void *userdata);
+void response_reset_headers_internal(aur_response_t *response);
+
+void request_list_append(struct request_list_t *list, aur_request_t *request);
+void request_list_remove(aur_request_t *request);
+
+void complete_request_internal(aur_t *aur, aur_request_t *request, curl_off_t content_len);
+void abort_all_requests_internal(aur_t *aur, int error);
+int has_requests_internal(aur_t *aur);
+int run_once_internal(aur_t *aur, int wait_idle);
+
+void state_record_transfer_internal(aur_t *aur, CURL *curl);
+void state_free_internal(aur_t *aur);
+
+int remote_queue_internal(aur_t *aur, aur_request_t *request);
+void remote_dispatch_internal(aur_t *aur);
+void remote_disconnect_internal(aur_t *aur);
+
+int coalesce_add_internal(aur_t *aur, aur_request_t *request, uint64_t now);
+int coalesce_flush_internal(aur_t *aur);
+
+size_t version_key_bound_internal(size_t len);
+uint8_t *version_key_encode_internal(uint8_t *k, const char *version, size_t len);
+int version_key_cmp_internal(const uint8_t *a, const uint8_t *b);
+
+int endpoint_pick_internal(aur_t *aur, uint32_t exclude, uint64_t now);
+void endpoint_complete_internal(aur_t *aur, int endpoint, uint64_t latency_us, int failed);
+void endpoint_free_internal(aur_t *aur);
+
+void admission_init(struct admission_t *a);
+int admission_acquire(struct admission_t *a, uint64_t now, int active);
+uint64_t admission_next_token_us(struct admission_t *a, uint64_t now);
+void admission_complete(struct admission_t *a, uint64_t now, uint64_t latency_us, int http_status, int failed);
+
+void histogram_record(struct histogram_t *h, uint64_t v);
+uint64_t histogram_percentile(const struct histogram_t *h, double percentile);
+void metrics_record_request(aur_t *aur, const struct request_timing_t *timing);
 
 #endif  /* _AUR_INTERNAL_H */
 
@@ -1,9 +1,13 @@
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "aur-internal.h"
 
+#define MAX_RETRY_DELAY_US (30 * 1000000ULL)
+
 int aur_new(aur_t **ret, const char *domainname, int secure) {
   aur_t *aur;
 
@@ -14,8 +18,7 @@ int aur_new(aur_t **ret, const char *domainname, int secure) {
   aur->version = 3;
   aur->proto = secure ? "https" : "http";
 
-  aur->domainname = strdup(domainname);
-  if (aur->domainname == NULL)
+  if (aur_add_endpoint(aur, domainname) < 0)
     return -ENOMEM;
 
   if (curl_global_init(CURL_GLOBAL_ALL) != CURLE_OK)
@@ -25,6 +28,18 @@ int aur_new(aur_t **ret, const char *domainname, int secure) {
   if (aur->curlm == NULL)
     return -ENOMEM;
 
+  aur->share = curl_share_init();
+  if (aur->share == NULL)
+    return -ENOMEM;
+
+  curl_share_setopt(aur->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(aur->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+  aur->daemon_fd = -1;
+  admission_init(&aur->admission);
+  body_budget_init(&aur->budget);
+  aur->seed = time(NULL) ^ (uintptr_t)aur;
+
   *ret = aur;
 
   return 0;
@@ -34,35 +49,502 @@ void aur_free(aur_t *aur) {
   if (aur == NULL)
     return;
 
+  if (aur->daemon_fd >= 0)
+    close(aur->daemon_fd);
+  free(aur->remote_in);
+
   curl_multi_cleanup(aur->curlm);
+  curl_share_cleanup(aur->share);
+  state_free_internal(aur);
   curl_global_cleanup();
 
-  free(aur->domainname);
+  endpoint_free_internal(aur);
   free(aur);
 }
 
+static uint64_t now_usec(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int aur_set_rate_limit(aur_t *aur, double requests_per_second, int burst) {
+  if (requests_per_second < 0 || burst < 0)
+    return -EINVAL;
+
+  aur->admission.rate = requests_per_second;
+  aur->admission.burst = burst > 0 ? burst : 1;
+  aur->admission.tokens = aur->admission.burst;
+  aur->admission.refilled_us = 0;
+
+  return 0;
+}
+
+/* Sets the concurrency window: at most initial transfers to begin with,
+ * never more than max. By default both are 32, so the window only narrows
+ * once the server pushes back. */
+int aur_set_concurrency(aur_t *aur, int initial, int max) {
+  if (initial < 1 || max < initial)
+    return -EINVAL;
+
+  aur->admission.window = initial;
+  aur->admission.window_max = max;
+
+  return 0;
+}
+
+int aur_set_latency_target(aur_t *aur, long target_ms) {
+  if (target_ms < 0)
+    return -EINVAL;
+
+  aur->admission.latency_target_us = (uint64_t)target_ms * 1000;
+
+  return 0;
+}
+
+/* Holds single-name info requests for up to window_ms after the first of
+ * them is queued and sends them as one multiinfo, 0 to disable. */
+int aur_set_coalesce_window(aur_t *aur, long window_ms) {
+  if (window_ms < 0)
+    return -EINVAL;
+
+  aur->coalesce_window_ms = window_ms;
+
+  return 0;
+}
+
 int aur_queue_request(aur_t *aur, aur_request_t *request) {
+  uint64_t now = now_usec();
   int r;
 
-  r = request_build_internal(request, aur->proto, aur->domainname, aur->version);
+  if (request->timeout_ms > 0)
+    request->deadline_us = now + (uint64_t)request->timeout_ms * 1000;
+
+  r = remote_queue_internal(aur, request);
+  if (r != 0)
+    return r < 0 ? r : 0;
+
+  if (aur->coalesce_window_ms > 0 && request->request_type == REQUEST_INFO &&
+      request->args.size == 1 && request->headers == NULL)
+    return coalesce_add_internal(aur, request, now);
+
+  /* admission may send it elsewhere */
+  r = request_build_internal(request, aur->proto, aur->endpoints[0].domainname, aur->version);
+  if (r < 0)
+    return r;
+
+  request->endpoint = 0;
+  request->endpoints_avoid = 0;
+
+  /* whoever holds on to the previous response keeps it */
+  aur_response_unref(request->response);
+  request->response = NULL;
+
+  r = response_new_internal(&request->response, request->curl, &aur->budget);
   if (r < 0)
     return r;
 
   curl_easy_setopt(request->curl, CURLOPT_URL, request->url);
   curl_easy_setopt(request->curl, CURLOPT_PRIVATE, request);
   curl_easy_setopt(request->curl, CURLOPT_ENCODING, "deflate,gzip");
-  curl_easy_setopt(request->curl, CURLOPT_WRITEDATA, request);
+  curl_easy_setopt(request->curl, CURLOPT_WRITEDATA, &request->response->body);
   curl_easy_setopt(request->curl, CURLOPT_WRITEFUNCTION, request_write_handler_internal);
+  curl_easy_setopt(request->curl, CURLOPT_HEADERDATA, request->response);
+  curl_easy_setopt(request->curl, CURLOPT_HEADERFUNCTION, response_header_handler_internal);
+  curl_easy_setopt(request->curl, CURLOPT_HTTPHEADER, request->headers);
   curl_easy_setopt(request->curl, CURLOPT_VERBOSE, (long)request->debug);
+  curl_easy_setopt(request->curl, CURLOPT_SHARE, aur->share);
+  if (aur->resolve != NULL)
+    curl_easy_setopt(request->curl, CURLOPT_RESOLVE, aur->resolve);
 
-  curl_multi_add_handle(aur->curlm, request->curl);
-  ++aur->active_requests;
+  /* wait for a connection that is still being set up, e.g. by
+   * aur_prewarm, in case it turns out to be multiplexed */
+  curl_easy_setopt(request->curl, CURLOPT_PIPEWAIT, 1L);
+
+  /* the reference is held for as long as the request is on one of our lists */
+  request_list_append(&aur->pending[request->priority], aur_request_ref(request));
+
+  return 0;
+}
+
+int aur_set_priority_limit(aur_t *aur, int priority, int max) {
+  if (priority < 0 || priority >= _PRIORITY_MAX || max < 0)
+    return -EINVAL;
+
+  aur->priority_limit[priority] = max;
 
   return 0;
 }
 
-static int dispatch_finished_requests(aur_t *aur) {
-  int msgs_left, abort = 0;
+static int pending_size(aur_t *aur) {
+  int n = 0;
+
+  for (int p = 0; p < _PRIORITY_MAX; ++p)
+    n += aur->pending[p].size;
+
+  return n;
+}
+
+static int class_may_start(aur_t *aur, int priority, const int *class_active) {
+  int limit = aur->priority_limit[priority];
+
+  if (limit > 0 && class_active[priority] >= limit)
+    return 0;
+
+  /* bulk work leaves a slot of the window free so that interactive and
+   * normal requests arriving later don't queue behind it */
+  if (priority == PRIORITY_BULK && aur->admission.window >= 2 &&
+      aur->active.size + aur->hedges + 1 > (int)aur->admission.window - 1)
+    return 0;
+
+  return 1;
+}
+
+/* points the request at the best endpoint it hasn't failed on yet */
+static void route_request(aur_t *aur, aur_request_t *r, uint64_t now) {
+  int e = endpoint_pick_internal(aur, r->endpoints_avoid, now);
+
+  if (e < 0 || e == r->endpoint)
+    return;
+
+  if (request_build_internal(r, aur->proto, aur->endpoints[e].domainname, aur->version) < 0)
+    return;
+
+  r->endpoint = e;
+  curl_easy_setopt(r->curl, CURLOPT_URL, r->url);
+}
+
+static void admit_pending_requests(aur_t *aur) {
+  int class_active[_PRIORITY_MAX] = { 0 };
+  uint64_t now = now_usec();
+
+  /* requests whose retry backoff has expired go back in line */
+  for (aur_request_t *r = aur->delayed.head, *next; r; r = next) {
+    next = r->next;
+
+    if (r->not_before_us <= now) {
+      request_list_remove(r);
+      request_list_append(&aur->pending[r->priority], r);
+    }
+  }
+
+  for (aur_request_t *r = aur->active.head; r; r = r->next)
+    ++class_active[r->priority];
+
+  for (int p = 0; p < _PRIORITY_MAX; ++p) {
+    while (aur->pending[p].head && class_may_start(aur, p, class_active)) {
+      aur_request_t *r = aur->pending[p].head;
+
+      if (!admission_acquire(&aur->admission, now, aur->active.size + aur->hedges))
+        return;
+
+      request_list_remove(r);
+      request_list_append(&aur->active, r);
+      ++class_active[p];
+
+      r->started_us = now;
+      r->hedged = 0;
+      route_request(aur, r, now);
+      curl_multi_add_handle(aur->curlm, r->curl);
+    }
+  }
+}
+
+static void hedge_slow_requests(aur_t *aur) {
+  uint64_t now = now_usec();
+
+  for (aur_request_t *r = aur->active.head; r; r = r->next) {
+    char *url;
+    int e;
+
+    if (r->hedge_after_ms <= 0 || r->hedged ||
+        now < r->started_us + (uint64_t)r->hedge_after_ms * 1000)
+      continue;
+
+    if (!admission_acquire(&aur->admission, now, aur->active.size + aur->hedges))
+      break;
+
+    r->hedged = 1;
+
+    r->hedge_curl = curl_easy_duphandle(r->curl);
+    if (r->hedge_curl == NULL)
+      continue;
+
+    if (response_new_internal(&r->hedge_response, r->hedge_curl, &aur->budget) < 0) {
+      curl_easy_cleanup(r->hedge_curl);
+      r->hedge_curl = NULL;
+      continue;
+    }
+
+    curl_easy_setopt(r->hedge_curl, CURLOPT_WRITEDATA, &r->hedge_response->body);
+    curl_easy_setopt(r->hedge_curl, CURLOPT_HEADERDATA, r->hedge_response);
+
+    /* the hedge is worth more on another endpoint, if there is one */
+    r->hedge_endpoint = r->endpoint;
+    e = endpoint_pick_internal(aur, r->endpoints_avoid | 1u << r->endpoint, now);
+    if (e >= 0 && e != r->endpoint &&
+        request_build_url_internal(r, aur->proto, aur->endpoints[e].domainname, aur->version, &url) == 0) {
+      curl_easy_setopt(r->hedge_curl, CURLOPT_URL, url);
+      r->hedge_endpoint = e;
+      free(url);
+    }
+
+    curl_multi_add_handle(aur->curlm, r->hedge_curl);
+    ++aur->hedges;
+  }
+}
+
+static void cancel_hedge(aur_t *aur, aur_request_t *r) {
+  curl_multi_remove_handle(aur->curlm, r->hedge_curl);
+  request_drop_hedge_internal(r);
+  --aur->hedges;
+}
+
+static int transfer_failed(CURLcode result, long http_status) {
+  return result != CURLE_OK || http_status == 429 || http_status >= 500;
+}
+
+static int curl_result_to_errno(CURLcode result) {
+  switch (result) {
+  case CURLE_OK:
+    return 0;
+  case CURLE_OUT_OF_MEMORY:
+    return -ENOMEM;
+  case CURLE_OPERATION_TIMEDOUT:
+    return -ETIMEDOUT;
+  case CURLE_COULDNT_RESOLVE_HOST:
+  case CURLE_COULDNT_CONNECT:
+    return -EHOSTUNREACH;
+  default:
+    return -EIO;
+  }
+}
+
+/* equal jitter: at least half of the exponential delay, at most all of it */
+static uint64_t retry_delay_us(aur_t *aur, aur_request_t *r) {
+  uint64_t cap = (uint64_t)r->retry_base_ms * 1000;
+  int shift = r->attempts < 20 ? r->attempts : 20;
+
+  cap <<= shift;
+  if (cap > MAX_RETRY_DELAY_US || cap == 0)
+    cap = cap ? MAX_RETRY_DELAY_US : 1000;
+
+  return cap / 2 + rand_r(&aur->seed) % (cap / 2 + 1);
+}
+
+static void schedule_retry(aur_t *aur, aur_request_t *r) {
+  request_list_remove(r);
+  request_reset_body_internal(r);
+
+  r->not_before_us = now_usec() + retry_delay_us(aur, r);
+  ++r->attempts;
+
+  request_list_append(&aur->delayed, r);
+}
+
+void complete_request_internal(aur_t *aur, aur_request_t *r, curl_off_t content_len) {
+  uint64_t start;
+
+  request_list_remove(r);
+
+  /* a spilled body that can't be mapped back in is lost */
+  if (r->response != NULL) {
+    body_finish(&r->response->body);
+    if (r->result == 0 && r->response->body.error < 0)
+      r->result = r->response->body.error;
+  }
+
+  /* done_fn is where responses get decoded, so that's what we time */
+  start = now_usec();
+  if (r->done_fn && r->done_fn(aur, r, aur_request_get_response(r), content_len) != 0) {
+    printf("user signaled abort\n");
+    aur->aborted = 1;
+  }
+  r->timing.decode_us = now_usec() - start;
+
+  /* coalesced requests share the transfer that answered them, which has
+   * been accounted for already */
+  if (r->result == 0 && r->merged_into == NULL && r->remote_id == 0 && !r->internal)
+    metrics_record_request(aur, &r->timing);
+
+  /* a coalesced member is on its own again before completed_fn hands it
+   * over, to another thread for all we know */
+  r->merged_into = NULL;
+
+  if (r->completed_fn)
+    r->completed_fn(aur, r);
+
+  aur_request_unref(r);
+}
+
+/* completes a request that hasn't finished on its own */
+static void abort_request(aur_t *aur, aur_request_t *r, int error) {
+  if (r->list == &aur->active || r->list == &aur->internal) {
+    curl_multi_remove_handle(aur->curlm, r->curl);
+    if (r->hedge_curl != NULL)
+      cancel_hedge(aur, r);
+  }
+
+  r->result = error;
+  complete_request_internal(aur, r, -1);
+}
+
+/* completes one of the requests a coalesced multiinfo answers ahead of the
+ * others, and gives up on the transfer once nobody is waiting for it */
+static void abort_merged_request(aur_t *aur, aur_request_t *r, int error) {
+  aur_request_t *m = aur_request_ref(r->merged_into);
+
+  r->merged_into = NULL;
+  r->result = error;
+  complete_request_internal(aur, r, -1);
+
+  if (m->merged.size == 0 && m->list != NULL)
+    abort_request(aur, m, error);
+
+  aur_request_unref(m);
+}
+
+int aur_cancel(aur_t *aur, aur_request_t *request) {
+  if (request->merged_into != NULL && request->merged_into->list != NULL) {
+    abort_merged_request(aur, request, -ECANCELED);
+    return 0;
+  }
+
+  if (request->list == NULL ||
+      (request->list != &aur->delayed && request->list != &aur->active &&
+       request->list != &aur->coalescing && request->list != &aur->remote &&
+       (request->list < &aur->pending[0] || request->list >= &aur->pending[_PRIORITY_MAX])))
+    return -ENOENT;
+
+  abort_request(aur, request, -ECANCELED);
+
+  return 0;
+}
+
+static aur_request_t *find_expired(struct request_list_t *list, uint64_t now) {
+  for (aur_request_t *r = list->head; r; r = r->next)
+    if (r->deadline_us != 0 && r->deadline_us <= now)
+      return r;
+
+  return NULL;
+}
+
+static aur_request_t *find_expired_member(struct request_list_t *list, uint64_t now) {
+  for (aur_request_t *r = list->head; r; r = r->next) {
+    aur_request_t *member = find_expired(&r->merged, now);
+    if (member != NULL)
+      return member;
+  }
+
+  return NULL;
+}
+
+/* done_fn may cancel other requests, so the lists are rescanned from the
+ * start after every completion */
+static void expire_requests(aur_t *aur) {
+  struct request_list_t *lists[] = {
+    &aur->remote, &aur->coalescing, &aur->pending[PRIORITY_INTERACTIVE],
+    &aur->pending[PRIORITY_NORMAL], &aur->pending[PRIORITY_BULK], &aur->delayed, &aur->active,
+    &aur->internal,
+  };
+  uint64_t now = now_usec();
+
+  for (size_t i = 0; i < ARRAYSIZE(lists); ++i) {
+    aur_request_t *r;
+
+    while ((r = find_expired(lists[i], now)) != NULL)
+      abort_request(aur, r, -ETIMEDOUT);
+
+    while ((r = find_expired_member(lists[i], now)) != NULL)
+      abort_merged_request(aur, r, -ETIMEDOUT);
+  }
+}
+
+void abort_all_requests_internal(aur_t *aur, int error) {
+  struct request_list_t *lists[] = {
+    &aur->remote, &aur->coalescing, &aur->pending[PRIORITY_INTERACTIVE],
+    &aur->pending[PRIORITY_NORMAL], &aur->pending[PRIORITY_BULK], &aur->delayed, &aur->active,
+    &aur->internal,
+  };
+
+  for (size_t i = 0; i < ARRAYSIZE(lists); ++i)
+    while (lists[i]->head)
+      abort_request(aur, lists[i]->head, error);
+}
+
+static void handle_finished_transfer(aur_t *aur, CURL *curl, CURLcode result) {
+  aur_request_t *r;
+  curl_off_t content_len, total_us = 0, starttransfer_us = 0;
+  long http_status = 0;
+  int failed, endpoint;
+  char *private;
+
+  curl_easy_getinfo(curl, CURLINFO_PRIVATE, &private);
+  r = (aur_request_t *)private;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_status);
+  curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total_us);
+  curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &starttransfer_us);
+  curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &content_len);
+
+  curl_multi_remove_handle(aur->curlm, curl);
+
+  failed = transfer_failed(result, http_status);
+  if (!r->internal)
+    admission_complete(&aur->admission, now_usec(), total_us, http_status, result != CURLE_OK);
+
+  endpoint = curl == r->curl ? r->endpoint : r->hedge_endpoint;
+  endpoint_complete_internal(aur, endpoint, result == CURLE_OK ? starttransfer_us : 0, failed);
+  if (failed)
+    r->endpoints_avoid |= 1u << endpoint;
+
+  if (r->hedge_curl != NULL) {
+    if (failed) {
+      /* the other transfer is still running, let it carry on alone */
+      if (curl == r->curl) {
+        SWAP(r->curl, r->hedge_curl);
+        SWAP(r->response, r->hedge_response);
+        SWAP(r->endpoint, r->hedge_endpoint);
+      }
+
+      cancel_hedge(aur, r);
+      return;
+    }
+
+    /* first response wins, the other transfer is cancelled */
+    if (curl == r->hedge_curl) {
+      SWAP(r->curl, r->hedge_curl);
+      SWAP(r->response, r->hedge_response);
+      SWAP(r->endpoint, r->hedge_endpoint);
+    }
+
+    cancel_hedge(aur, r);
+  }
+
+  if (failed && r->attempts < r->max_retries &&
+      (r->deadline_us == 0 || now_usec() < r->deadline_us)) {
+    schedule_retry(aur, r);
+    return;
+  }
+
+  if (result != CURLE_OK)
+    fprintf(stderr, "error: request failed: %s\n", curl_easy_strerror(result));
+
+  r->result = curl_result_to_errno(result);
+  /* curl is happy with whatever status the server answers with, but being
+   * throttled or a server error out of retries is a failure all the same */
+  if (r->result == 0 && failed)
+    r->result = http_status == 429 ? -EAGAIN : -EIO;
+  request_collect_timing_internal(r);
+  if (result == CURLE_OK)
+    state_record_transfer_internal(aur, r->curl);
+
+  complete_request_internal(aur, r, content_len);
+}
+
+static void dispatch_finished_requests(aur_t *aur) {
+  int msgs_left;
 
   do {
     CURLMsg *msg;
@@ -72,55 +554,230 @@ static int dispatch_finished_requests(aur_t *aur) {
       break;
 
     /* curl doesn't define any other msg than CURLMSG_DONE, but to be safe... */
-    if (msg->msg == CURLMSG_DONE) {
-      aur_request_t *r;
-      double content_len;
+    if (msg->msg == CURLMSG_DONE)
+      handle_finished_transfer(aur, msg->easy_handle, msg->data.result);
+  } while (msgs_left);
+}
+
+/* time until something other than socket activity needs our attention */
+static uint64_t list_next_deadline_us(struct request_list_t *list, uint64_t now, uint64_t timeout) {
+  for (aur_request_t *r = list->head; r; r = r->next) {
+    uint64_t t;
 
-      --aur->active_requests;
+    if (r->deadline_us == 0)
+      continue;
 
-      if (msg->data.result != CURLE_OK)
-        fprintf(stderr, "error: request failed: %s\n", curl_easy_strerror(msg->data.result));
+    t = r->deadline_us > now ? r->deadline_us - now : 0;
+    if (t < timeout)
+      timeout = t;
+  }
 
-      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (const char **)&r);
-      curl_easy_getinfo(msg->easy_handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &content_len);
+  return timeout;
+}
 
-      r = aur_request_ref(r);
+static uint64_t merged_next_deadline_us(struct request_list_t *list, uint64_t now, uint64_t timeout) {
+  for (aur_request_t *r = list->head; r; r = r->next)
+    timeout = list_next_deadline_us(&r->merged, now, timeout);
 
-      if (r->done_fn && r->done_fn(aur, r, aur_request_get_response(r), content_len) != 0) {
-        printf("user signaled abort\n");
-        abort = 1;
-      }
+  return timeout;
+}
 
-      curl_multi_remove_handle(aur->curlm, msg->easy_handle);
+static uint64_t next_timer_us(aur_t *aur, uint64_t now) {
+  uint64_t timeout = 1000000;
+
+  if (aur->run_deadline_us != 0) {
+    uint64_t t = aur->run_deadline_us > now ? aur->run_deadline_us - now : 0;
+    if (t < timeout)
+      timeout = t;
+  }
+
+  if (aur->coalescing.size > 0) {
+    uint64_t t = aur->coalesce_deadline_us > now ? aur->coalesce_deadline_us - now : 0;
+    if (t < timeout)
+      timeout = t;
+  }
+
+  timeout = list_next_deadline_us(&aur->remote, now, timeout);
+  timeout = list_next_deadline_us(&aur->coalescing, now, timeout);
+  for (int p = 0; p < _PRIORITY_MAX; ++p) {
+    timeout = list_next_deadline_us(&aur->pending[p], now, timeout);
+    timeout = merged_next_deadline_us(&aur->pending[p], now, timeout);
+  }
+  timeout = list_next_deadline_us(&aur->delayed, now, timeout);
+  timeout = merged_next_deadline_us(&aur->delayed, now, timeout);
+  timeout = list_next_deadline_us(&aur->active, now, timeout);
+  timeout = merged_next_deadline_us(&aur->active, now, timeout);
+
+  if (pending_size(aur) > 0 && aur->active.size + aur->hedges < (int)aur->admission.window) {
+    uint64_t t = admission_next_token_us(&aur->admission, now);
+    if (t < timeout)
+      timeout = t;
+  }
+
+  for (aur_request_t *r = aur->delayed.head; r; r = r->next) {
+    uint64_t t = r->not_before_us > now ? r->not_before_us - now : 0;
+    if (t < timeout)
+      timeout = t;
+  }
+
+  for (aur_request_t *r = aur->active.head; r; r = r->next) {
+    uint64_t at, t;
+
+    if (r->hedge_after_ms <= 0 || r->hedged)
+      continue;
+
+    at = r->started_us + (uint64_t)r->hedge_after_ms * 1000;
+    t = at > now ? at - now : 0;
+    if (t < timeout)
+      timeout = t;
+  }
+
+  return timeout;
+}
 
-      r = aur_request_unref(r);
-    }
-  } while (msgs_left);
+/* curl_multi_poll also waits when there are no transfers, and returns early
+ * when curl_multi_wakeup is called from another thread */
+static int wait_for_activity(aur_t *aur) {
+  uint64_t timeout_us = next_timer_us(aur, now_usec());
+  struct curl_waitfd remote = { .fd = aur->daemon_fd, .events = CURL_WAIT_POLLIN };
+  int r, n;
+
+  r = curl_multi_poll(aur->curlm, &remote, aur->remote.size > 0 ? 1 : 0,
+      (timeout_us + 999) / 1000, &n);
+  if (r != CURLM_OK)
+    return -r;
+
+  return 0;
+}
+
+/* Bounds every subsequent aur_run to timeout_ms, 0 for no bound. Requests
+ * still outstanding when it expires complete with -ETIMEDOUT. */
+int aur_set_run_timeout(aur_t *aur, long timeout_ms) {
+  if (timeout_ms < 0)
+    return -EINVAL;
+
+  aur->run_timeout_ms = timeout_ms;
+
+  return 0;
+}
+
+/* Starts resolving the host and connecting to it, ahead of the requests
+ * that are about to be queued. The connection is left in the connection
+ * cache for them to reuse. The HEAD request doing it goes straight onto
+ * curlm, so it neither waits for admission nor holds a slot of the window
+ * that the real requests need. */
+static int prewarm_endpoint(aur_t *aur, int endpoint) {
+  aur_request_t *request;
+  int r;
+
+  r = aur_request_new(&request, REQUEST_DOWNLOAD, NULL);
+  if (r < 0)
+    return r;
+
+  r = aur_request_append_arg(request, "/");
+  if (r < 0)
+    goto out;
+
+  aur_request_set_priority(request, PRIORITY_INTERACTIVE);
+
+  r = aur_queue_request(aur, request);
+  if (r < 0)
+    goto out;
 
-  return abort;
+  /* cowd has taken it, and connects on its own */
+  if (request->list != &aur->pending[PRIORITY_INTERACTIVE])
+    goto out;
+
+  curl_easy_setopt(request->curl, CURLOPT_NOBODY, 1L);
+  request->endpoints_avoid = ~(1u << endpoint);
+  request->internal = 1;
+
+  request_list_remove(request);
+  request_list_append(&aur->internal, request);
+  request->started_us = now_usec();
+  route_request(aur, request, request->started_us);
+  curl_multi_add_handle(aur->curlm, request->curl);
+
+out:
+  aur_request_unref(request);
+  return r;
+}
+
+int aur_prewarm(aur_t *aur) {
+  int r, active;
+
+  /* every endpoint, so that they all start out on an equal footing */
+  for (int i = 0; i < aur->n_endpoints; ++i) {
+    r = prewarm_endpoint(aur, i);
+    if (r < 0)
+      return r;
+  }
+
+  /* get the lookup and handshake going without waiting for aur_run */
+  r = curl_multi_perform(aur->curlm, &active);
+
+  return r == CURLM_OK ? 0 : -r;
+}
+
+int has_requests_internal(aur_t *aur) {
+  return aur->active.size > 0 || pending_size(aur) > 0 || aur->delayed.size > 0 ||
+    aur->internal.size > 0 || aur->coalescing.size > 0 || aur->remote.size > 0;
+}
+
+/* One turn of the event loop, also driven by the workers of aur_pool_t.
+ * Finished transfers are handled before waiting, as curl_multi_poll would
+ * otherwise sit out its timeout after the last of them. With nothing left
+ * to do it only waits if wait_idle is set. */
+int run_once_internal(aur_t *aur, int wait_idle) {
+  int r, active;
+
+  if (aur->coalescing.size > 0 && now_usec() >= aur->coalesce_deadline_us) {
+    r = coalesce_flush_internal(aur);
+    if (r < 0)
+      return r;
+  }
+
+  admit_pending_requests(aur);
+  hedge_slow_requests(aur);
+
+  r = curl_multi_perform(aur->curlm, &active);
+  if (r != CURLM_OK)
+    return -r;
+
+  dispatch_finished_requests(aur);
+  if (aur->remote.size > 0)
+    remote_dispatch_internal(aur);
+  expire_requests(aur);
+
+  if (!wait_idle && !has_requests_internal(aur))
+    return 0;
+
+  return wait_for_activity(aur);
 }
 
 int aur_run(aur_t *aur) {
-  int active;
+  aur->aborted = 0;
+  aur->run_deadline_us = 0;
+  if (aur->run_timeout_ms > 0)
+    aur->run_deadline_us = now_usec() + (uint64_t)aur->run_timeout_ms * 1000;
 
   do {
-    int r, n;
+    int r;
 
-    r = curl_multi_perform(aur->curlm, &active);
-    if (r != CURLE_OK)
-      return -r;
+    r = run_once_internal(aur, 0);
+    if (r < 0)
+      return r;
 
-    r = curl_multi_wait(aur->curlm, NULL, 0, 1000, &n);
-    if (r != CURLE_OK)
-      return -r;
+    if (aur->run_deadline_us != 0 && now_usec() >= aur->run_deadline_us) {
+      abort_all_requests_internal(aur, -ETIMEDOUT);
+      return -ETIMEDOUT;
+    }
 
-    r = dispatch_finished_requests(aur);
-    if (r != 0)
-      return r;
-  } while (aur->active_requests > 0);
+    if (aur->aborted)
+      return 1;
+  } while (has_requests_internal(aur));
 
   return 0;
 }
 
 /* vim: set et ts=2 sw=2: */
-
@@ -2,19 +2,98 @@
 #define _AUR_H
 
 #include <sys/types.h>
+#include <stdint.h>
 #include <stdio.h>
 
 /* basic types */
 typedef struct aur_t aur_t;
 typedef struct aur_request_t aur_request_t;
+typedef struct aur_response_t aur_response_t;
 
 
 /* aur API */
 int aur_new(aur_t **ret, const char *domainname, int secure);
 void aur_free(aur_t *aur);
+int aur_add_endpoint(aur_t *aur, const char *domainname);
 
 int aur_queue_request(aur_t *aur, aur_request_t *request);
+int aur_cancel(aur_t *aur, aur_request_t *request);
 int aur_run(aur_t *aur);
+int aur_set_run_timeout(aur_t *aur, long timeout_ms);
+
+int aur_set_rate_limit(aur_t *aur, double requests_per_second, int burst);
+int aur_set_concurrency(aur_t *aur, int initial, int max);
+int aur_set_latency_target(aur_t *aur, long target_ms);
+int aur_set_priority_limit(aur_t *aur, int priority, int max);
+int aur_set_coalesce_window(aur_t *aur, long window_ms);
+int aur_set_memory_budget(aur_t *aur, size_t bytes);
+
+int aur_prewarm(aur_t *aur);
+int aur_load_state(aur_t *aur, const char *path);
+int aur_save_state(aur_t *aur, const char *path);
+
+char *aur_daemon_socket_path(void);
+int aur_connect_daemon(aur_t *aur, const char *path);
+
+
+/* thread pool API */
+typedef struct aur_pool_t aur_pool_t;
+
+enum {
+  POOL_COMPLETE_ON_WORKER,
+  POOL_COMPLETE_ON_DISPATCH,
+  _POOL_COMPLETE_MAX,
+};
+
+int aur_pool_new(aur_pool_t **ret, const char *domainname, int secure, int nworkers, int complete_on);
+void aur_pool_free(aur_pool_t *pool);
+
+int aur_pool_get_worker_count(aur_pool_t *pool);
+aur_t *aur_pool_get_worker(aur_pool_t *pool, int i);
+int aur_pool_start(aur_pool_t *pool);
+
+int aur_pool_submit(aur_pool_t *pool, aur_request_t *request);
+int aur_pool_get_fd(aur_pool_t *pool);
+int aur_pool_dispatch(aur_pool_t *pool);
+int aur_pool_wait(aur_pool_t *pool);
+
+
+/* metrics API */
+enum {
+  METRIC_NAMELOOKUP,
+  METRIC_CONNECT,
+  METRIC_APPCONNECT,
+  METRIC_STARTTRANSFER,
+  METRIC_TOTAL,
+  METRIC_DECODE,
+  METRIC_BYTES,
+  _METRIC_MAX,
+};
+
+/* times are in microseconds since the start of the transfer */
+struct request_timing_t {
+  uint64_t namelookup_us;
+  uint64_t connect_us;
+  uint64_t appconnect_us;
+  uint64_t starttransfer_us;
+  uint64_t total_us;
+  uint64_t decode_us;
+  uint64_t bytes;
+};
+
+struct metric_summary_t {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+  uint64_t p50;
+  uint64_t p95;
+  uint64_t p99;
+};
+
+int aur_get_metric(aur_t *aur, int metric, struct metric_summary_t *summary);
+int aur_get_metric_percentile(aur_t *aur, int metric, double percentile, uint64_t *value);
+void aur_dump_stats(aur_t *aur, FILE *stream);
 
 
 /* request API */
@@ -26,6 +105,16 @@ enum {
   REQUEST_DOWNLOAD,
 };
 
+enum {
+  PRIORITY_INTERACTIVE,
+  PRIORITY_NORMAL,
+  PRIORITY_BULK,
+  _PRIORITY_MAX,
+};
+
+/* the AUR answers much longer request lines with 414 */
+#define AUR_MAX_QUERY_LEN 4000
+
 typedef int (*aur_request_done_fn)(aur_t *aur, aur_request_t *request, const void *response, int responselen);
 
 int aur_request_new(aur_request_t **ret, int aur_request_type, aur_request_done_fn done_fn);
@@ -34,6 +123,8 @@ aur_request_t *aur_request_unref(aur_request_t *request);
 aur_request_t *aur_request_ref(aur_request_t *request);
 
 int aur_request_append_arg(aur_request_t *request, const char *arg);
+size_t aur_request_arg_length(const char *arg);
+int aur_request_add_header(aur_request_t *request, const char *header);
 
 void aur_request_set_userdata(aur_request_t *request, void *userdata);
 void *aur_request_get_userdata(aur_request_t *request);
@@ -41,14 +132,33 @@ void *aur_request_get_userdata(aur_request_t *request);
 void aur_request_set_debug(aur_request_t *request, int debug);
 int aur_request_get_debug(aur_request_t *request);
 
+int aur_request_set_priority(aur_request_t *request, int priority);
+int aur_request_get_priority(aur_request_t *request);
+
+void aur_request_set_timeout(aur_request_t *request, long timeout_ms);
+void aur_request_set_retry(aur_request_t *request, int max_retries, long base_delay_ms);
+void aur_request_set_hedge(aur_request_t *request, long after_ms);
+int aur_request_get_result(aur_request_t *request);
+
 char *aur_request_get_response(aur_request_t *request);
+aur_response_t *aur_request_ref_response(aur_request_t *request);
+const char *aur_request_get_header(aur_request_t *request, const char *name);
 int aur_request_get_type(aur_request_t *request);
 
 const char *aur_request_get_url(aur_request_t *request);
 int aur_request_get_http_status(aur_request_t *r);
+void aur_request_get_timing(aur_request_t *request, struct request_timing_t *timing);
 
 char *const *aur_request_get_args(aur_request_t *request, int *argc);
 
+/* response API */
+aur_response_t *aur_response_ref(aur_response_t *response);
+aur_response_t *aur_response_unref(aur_response_t *response);
+
+const char *aur_response_get_data(aur_response_t *response);
+size_t aur_response_get_size(aur_response_t *response);
+const char *aur_response_get_header(aur_response_t *response, const char *name);
+
 /* package API */
 struct package_t {
 	char *name;
@@ -82,6 +192,180 @@ int aur_packages_from_json(const char *json, struct package_t **packages, int *c
 void aur_package_list_free(struct package_t *packages);
 int aur_packages_format(FILE *stream, const char *format, const struct package_t **packages, void *userdata);
 
+int aur_vercmp(const char *a, const char *b);
+int aur_vercmp_batch(const char *const *a, const char *const *b, int n, int *results);
+int aur_packages_sort_by_version(struct package_t *packages, int count, int descending);
+
+/* multi-term search API */
+typedef void (*aur_search_done_fn)(aur_t *aur, struct package_t *packages, int count, int error, void *userdata);
+
+int aur_search_all(aur_t *aur, char *const *terms, int nterms, aur_search_done_fn done_fn, void *userdata);
+
+/* package fields */
+enum {
+  PACKAGE_FIELD_NAME,
+  PACKAGE_FIELD_DESCRIPTION,
+  PACKAGE_FIELD_MAINTAINER,
+  PACKAGE_FIELD_PKGBASE,
+  PACKAGE_FIELD_UPSTREAM_URL,
+  PACKAGE_FIELD_AUR_URLPATH,
+  PACKAGE_FIELD_VERSION,
+
+  PACKAGE_FIELD_CATEGORY_ID,
+  PACKAGE_FIELD_PACKAGE_ID,
+  PACKAGE_FIELD_PKGBASEID,
+  PACKAGE_FIELD_OUT_OF_DATE,
+  PACKAGE_FIELD_VOTES,
+  PACKAGE_FIELD_SUBMITTED,
+  PACKAGE_FIELD_MODIFIED,
+
+  PACKAGE_FIELD_LICENSES,
+  PACKAGE_FIELD_CONFLICTS,
+  PACKAGE_FIELD_DEPENDS,
+  PACKAGE_FIELD_GROUPS,
+  PACKAGE_FIELD_MAKEDEPENDS,
+  PACKAGE_FIELD_OPTDEPENDS,
+  PACKAGE_FIELD_CHECKDEPENDS,
+  PACKAGE_FIELD_PROVIDES,
+  PACKAGE_FIELD_REPLACES,
+};
+
+/* column store API */
+typedef struct aur_package_table_t aur_package_table_t;
+
+enum {
+  FILTER_EQ,
+  FILTER_NE,
+  FILTER_LT,
+  FILTER_LE,
+  FILTER_GT,
+  FILTER_GE,
+};
+
+int aur_package_table_new(aur_package_table_t **ret, const struct package_t *packages, int count);
+void aur_package_table_free(aur_package_table_t *table);
+
+int aur_package_table_get_count(const aur_package_table_t *table);
+int64_t aur_package_table_get_integer(const aur_package_table_t *table, int field, int row);
+const char *aur_package_table_get_string(const aur_package_table_t *table, int field, int row);
+
+int aur_package_table_filter(const aur_package_table_t *table, int field, int op, int64_t value, uint8_t *mask);
+int aur_package_table_select(const aur_package_table_t *table, const uint8_t *mask, uint32_t *rows);
+int aur_package_table_sort(const aur_package_table_t *table, int field, int descending, uint32_t *rows, int nrows);
+
+/* binary package list API */
+typedef struct aur_package_blob_t aur_package_blob_t;
+
+int aur_packages_serialize(const struct package_t *packages, int count, void **ret, size_t *retlen);
+int aur_packages_write(int fd, const struct package_t *packages, int count);
+
+int aur_package_blob_open(aur_package_blob_t **ret, const void *data, size_t len);
+int aur_package_blob_mmap(aur_package_blob_t **ret, const char *path);
+void aur_package_blob_free(aur_package_blob_t *blob);
+
+int aur_package_blob_get_count(const aur_package_blob_t *blob);
+int aur_package_blob_find(const aur_package_blob_t *blob, const char *name);
+const char *aur_package_blob_get_string(const aur_package_blob_t *blob, int index, int field);
+int64_t aur_package_blob_get_integer(const aur_package_blob_t *blob, int index, int field);
+int aur_package_blob_get_list_size(const aur_package_blob_t *blob, int index, int field);
+const char *aur_package_blob_get_list_item(const aur_package_blob_t *blob, int index, int field, int n);
+int aur_package_blob_to_packages(const aur_package_blob_t *blob, struct package_t **packages, int *count);
+
+/* shared package cache API */
+typedef struct aur_package_cache_t aur_package_cache_t;
+
+int aur_package_cache_open(aur_package_cache_t **ret, const char *path, int nslots);
+void aur_package_cache_free(aur_package_cache_t *cache);
+
+int aur_package_cache_get(aur_package_cache_t *cache, const char *name, long max_age_s, struct package_t **packages);
+int aur_package_cache_put(aur_package_cache_t *cache, const struct package_t *packages, int count);
+
+/* .SRCINFO API */
+typedef struct aur_srcinfo_t aur_srcinfo_t;
+
+int aur_srcinfo_parse(aur_srcinfo_t **ret, const char *data, size_t len);
+int aur_srcinfo_read(aur_srcinfo_t **ret, const char *dir);
+int aur_srcinfo_read_many(aur_srcinfo_t **srcinfos, const char *const *dirs, int count, int nthreads);
+void aur_srcinfo_free(aur_srcinfo_t *srcinfo);
+
+const struct package_t *aur_srcinfo_get_packages(const aur_srcinfo_t *srcinfo, int *count);
+int aur_srcinfo_get_list_size(const aur_srcinfo_t *srcinfo, int index, const char *key);
+const char *aur_srcinfo_get_list_item(const aur_srcinfo_t *srcinfo, int index, const char *key, int n);
+
+/* dependency API */
+typedef struct aur_dep_table_t aur_dep_table_t;
+
+enum {
+  DEP_ANY,
+  DEP_EQ,
+  DEP_LT,
+  DEP_LE,
+  DEP_GT,
+  DEP_GE,
+};
+
+/* the version is a key in the table the dependency was parsed by */
+struct dependency_t {
+  int name;
+  int op;
+  uint32_t version;
+};
+
+int aur_dep_table_new(aur_dep_table_t **ret);
+void aur_dep_table_free(aur_dep_table_t *table);
+
+int aur_dep_table_intern(aur_dep_table_t *table, const char *name);
+int aur_dep_table_lookup(const aur_dep_table_t *table, const char *name);
+const char *aur_dep_table_get_name(const aur_dep_table_t *table, int id);
+int aur_dep_table_get_count(const aur_dep_table_t *table);
+
+int aur_dep_table_parse(aur_dep_table_t *table, const char *depstring, struct dependency_t *dep);
+int aur_dep_table_parse_list(aur_dep_table_t *table, char *const *list, struct dependency_t **deps, int *count);
+int aur_dep_table_package(aur_dep_table_t *table, const struct package_t *package, struct dependency_t *dep);
+int aur_dep_table_satisfies(const aur_dep_table_t *table, const struct dependency_t *dep,
+    const struct dependency_t *provider);
+
+/* local package database API */
+struct local_package_t {
+  char *name;
+  char *version;
+  int foreign;
+};
+
+int aur_localdb_read(const char *dbpath, struct local_package_t **packages, int *count);
+void aur_local_package_list_free(struct local_package_t *packages);
+
+/* change feed API */
+typedef struct aur_watch_t aur_watch_t;
+
+enum {
+  WATCH_ADDED,
+  WATCH_UPDATED,
+  WATCH_REMOVED,
+  WATCH_FAILED,
+};
+
+/* name is NULL for WATCH_FAILED, which has error set instead */
+struct watch_event_t {
+  int type;
+  const char *name;
+  const char *old_version;
+  const char *new_version;
+  time_t modified_s;
+  int error;
+};
+
+typedef void (*aur_watch_event_fn)(aur_watch_t *watch, const struct watch_event_t *event, void *userdata);
+
+int aur_watch_new(aur_watch_t **ret, aur_t *aur, aur_watch_event_fn event_fn, void *userdata);
+void aur_watch_free(aur_watch_t *watch);
+
+int aur_watch_add(aur_watch_t *watch, const char *name);
+int aur_watch_poll(aur_watch_t *watch);
+
+int aur_watch_load(aur_watch_t *watch, const char *path);
+int aur_watch_save(aur_watch_t *watch, const char *path);
+
 #endif  /* _AUR_H */
 
 /* vim: set et ts=2 sw=2: */
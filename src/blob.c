@@ -0,0 +1,590 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "aur-internal.h"
+#include "macro.h"
+
+/* A serialized package list is one contiguous, pointer free image:
+ *
+ *   header | records[count] | name index[count] | lists | strings
+ *
+ * Every reference is an offset relative to the start of its own section, so
+ * the image can be mapped at any address. Strings are deduplicated and NUL
+ * terminated, which lets readers hand out pointers straight into the image.
+ * Lists are stored as a length followed by that many string offsets. */
+
+#define BLOB_MAGIC "LIBAURPK"
+#define BLOB_VERSION 1
+#define BLOB_BYTEORDER 0x01020304u
+
+#define BLOB_NULL UINT32_MAX
+
+struct blob_header_t {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteorder;
+  uint32_t count;
+  uint32_t record_size;
+  uint64_t index_offset;
+  uint64_t lists_offset;
+  uint64_t lists_count;
+  uint64_t strings_offset;
+  uint64_t strings_size;
+  uint64_t total_size;
+};
+
+struct blob_record_t {
+  uint32_t strings[N_STRING_FIELDS];
+  uint32_t lists[N_LIST_FIELDS];
+  int32_t integers[N_INTEGER_FIELDS - 2];
+  uint32_t padding;
+  int64_t submitted_s;
+  int64_t modified_s;
+};
+
+struct aur_package_blob_t {
+  const uint8_t *base;
+  size_t size;
+  int mapped;
+
+  const struct blob_header_t *header;
+  const struct blob_record_t *records;
+  const uint32_t *index;
+  const uint32_t *lists;
+  const char *strings;
+};
+
+struct string_table_t {
+  const char **keys;
+  uint32_t *offsets;
+  size_t capacity;
+
+  char *data;
+  size_t size;
+};
+
+static void *package_field(const struct package_t *package, int field) {
+  return (uint8_t *)package + package_fields[field].offset;
+}
+
+static uint64_t string_hash(const char *s) {
+  uint64_t h = 14695981039346656037ULL;
+
+  for (; *s; ++s) {
+    h ^= (unsigned char)*s;
+    h *= 1099511628211ULL;
+  }
+
+  return h;
+}
+
+static int string_table_init(struct string_table_t *st, size_t nstrings) {
+  size_t capacity = 16;
+
+  while (capacity < nstrings * 2)
+    capacity <<= 1;
+
+  st->keys = calloc(capacity, sizeof(char *));
+  st->offsets = calloc(capacity, sizeof(uint32_t));
+  if (st->keys == NULL || st->offsets == NULL)
+    return -ENOMEM;
+
+  st->capacity = capacity;
+  st->data = NULL;
+  st->size = 0;
+
+  return 0;
+}
+
+static void string_table_reset(struct string_table_t *st) {
+  free(st->keys);
+  free(st->offsets);
+  memset(st, 0, sizeof(*st));
+}
+
+/* First pass: assign every distinct string an offset. The second pass (with
+ * st->data set) copies the bytes into place. */
+static uint32_t string_table_add(struct string_table_t *st, const char *s) {
+  size_t i;
+
+  if (s == NULL)
+    return BLOB_NULL;
+
+  for (i = string_hash(s) & (st->capacity - 1); st->keys[i]; i = (i + 1) & (st->capacity - 1))
+    if (strcmp(st->keys[i], s) == 0)
+      return st->offsets[i];
+
+  st->keys[i] = s;
+  st->offsets[i] = st->size;
+  st->size += strlen(s) + 1;
+
+  return st->offsets[i];
+}
+
+static size_t count_strings(const struct package_t *packages, int count, size_t *nlists) {
+  size_t n = 0;
+
+  *nlists = 0;
+  for (int i = 0; i < count; ++i) {
+    for (int f = PACKAGE_FIELD_NAME; f <= PACKAGE_FIELD_VERSION; ++f)
+      ++n;
+
+    for (int f = PACKAGE_FIELD_LICENSES; f <= PACKAGE_FIELD_REPLACES; ++f) {
+      char **l = *(char ***)package_field(&packages[i], f);
+
+      if (l == NULL)
+        continue;
+
+      for (; *l; ++l) {
+        ++n;
+        ++*nlists;
+      }
+      ++*nlists;
+    }
+  }
+
+  return n;
+}
+
+static int index_name_cmp(const void *a, const void *b, void *arg) {
+  const struct package_t *packages = arg;
+  const char *x = packages[*(const uint32_t *)a].name;
+  const char *y = packages[*(const uint32_t *)b].name;
+
+  return strcmp(x ? x : "", y ? y : "");
+}
+
+static size_t align8(size_t n) {
+  return (n + 7) & ~(size_t)7;
+}
+
+int aur_packages_serialize(const struct package_t *packages, int count, void **ret, size_t *retlen) {
+  struct string_table_t st;
+  struct blob_header_t *h;
+  struct blob_record_t *records;
+  uint32_t *index, *lists;
+  size_t nstrings, nlists, l = 0;
+  size_t index_offset, lists_offset, strings_offset;
+  uint8_t *image;
+  int r;
+
+  if (count < 0)
+    return -EINVAL;
+
+  nstrings = count_strings(packages, count, &nlists);
+
+  r = string_table_init(&st, nstrings);
+  if (r < 0) {
+    string_table_reset(&st);
+    return r;
+  }
+
+  for (int i = 0; i < count; ++i) {
+    for (int f = PACKAGE_FIELD_NAME; f <= PACKAGE_FIELD_VERSION; ++f)
+      string_table_add(&st, *(char **)package_field(&packages[i], f));
+
+    for (int f = PACKAGE_FIELD_LICENSES; f <= PACKAGE_FIELD_REPLACES; ++f) {
+      char **v = *(char ***)package_field(&packages[i], f);
+
+      for (; v && *v; ++v)
+        string_table_add(&st, *v);
+    }
+  }
+
+  if (st.size >= BLOB_NULL || nlists >= BLOB_NULL) {
+    string_table_reset(&st);
+    return -E2BIG;
+  }
+
+  index_offset = align8(sizeof(*h) + count * sizeof(struct blob_record_t));
+  lists_offset = align8(index_offset + count * sizeof(uint32_t));
+  strings_offset = lists_offset + nlists * sizeof(uint32_t);
+
+  image = calloc(1, strings_offset + st.size);
+  if (image == NULL) {
+    string_table_reset(&st);
+    return -ENOMEM;
+  }
+
+  h = (struct blob_header_t *)image;
+  memcpy(h->magic, BLOB_MAGIC, sizeof(h->magic));
+  h->version = BLOB_VERSION;
+  h->byteorder = BLOB_BYTEORDER;
+  h->count = count;
+  h->record_size = sizeof(struct blob_record_t);
+  h->index_offset = index_offset;
+  h->lists_offset = lists_offset;
+  h->lists_count = nlists;
+  h->strings_offset = strings_offset;
+  h->strings_size = st.size;
+  h->total_size = strings_offset + st.size;
+
+  records = (struct blob_record_t *)(image + sizeof(*h));
+  index = (uint32_t *)(image + h->index_offset);
+  lists = (uint32_t *)(image + h->lists_offset);
+  st.data = (char *)image + h->strings_offset;
+
+  for (size_t i = 0; i < st.capacity; ++i)
+    if (st.keys[i])
+      strcpy(st.data + st.offsets[i], st.keys[i]);
+
+  for (int i = 0; i < count; ++i) {
+    struct blob_record_t *rec = &records[i];
+    const struct package_t *p = &packages[i];
+
+    for (int f = PACKAGE_FIELD_NAME; f <= PACKAGE_FIELD_VERSION; ++f)
+      rec->strings[f - PACKAGE_FIELD_NAME] = string_table_add(&st, *(char **)package_field(p, f));
+
+    rec->integers[PACKAGE_FIELD_CATEGORY_ID - PACKAGE_FIELD_CATEGORY_ID] = p->category_id;
+    rec->integers[PACKAGE_FIELD_PACKAGE_ID - PACKAGE_FIELD_CATEGORY_ID] = p->package_id;
+    rec->integers[PACKAGE_FIELD_PKGBASEID - PACKAGE_FIELD_CATEGORY_ID] = p->pkgbaseid;
+    rec->integers[PACKAGE_FIELD_OUT_OF_DATE - PACKAGE_FIELD_CATEGORY_ID] = p->out_of_date;
+    rec->integers[PACKAGE_FIELD_VOTES - PACKAGE_FIELD_CATEGORY_ID] = p->votes;
+    rec->submitted_s = p->submitted_s;
+    rec->modified_s = p->modified_s;
+
+    for (int f = PACKAGE_FIELD_LICENSES; f <= PACKAGE_FIELD_REPLACES; ++f) {
+      char **v = *(char ***)package_field(p, f);
+      size_t start = l;
+
+      if (v == NULL) {
+        rec->lists[f - PACKAGE_FIELD_LICENSES] = BLOB_NULL;
+        continue;
+      }
+
+      lists[l++] = 0;
+      for (; *v; ++v) {
+        lists[l++] = string_table_add(&st, *v);
+        ++lists[start];
+      }
+
+      rec->lists[f - PACKAGE_FIELD_LICENSES] = start;
+    }
+
+    index[i] = i;
+  }
+
+  qsort_r(index, count, sizeof(uint32_t), index_name_cmp, (void *)packages);
+
+  string_table_reset(&st);
+
+  *ret = image;
+  *retlen = h->total_size;
+
+  return 0;
+}
+
+int aur_packages_write(int fd, const struct package_t *packages, int count) {
+  _cleanup_free_ void *image = NULL;
+  size_t len, written = 0;
+  int r;
+
+  r = aur_packages_serialize(packages, count, &image, &len);
+  if (r < 0)
+    return r;
+
+  while (written < len) {
+    ssize_t n = write(fd, (uint8_t *)image + written, len - written);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -errno;
+    }
+
+    written += n;
+  }
+
+  return 0;
+}
+
+static int blob_validate(struct aur_package_blob_t *b) {
+  const struct blob_header_t *h = (const struct blob_header_t *)b->base;
+
+  if (b->size < sizeof(*h) || memcmp(h->magic, BLOB_MAGIC, sizeof(h->magic)) != 0)
+    return -EBADMSG;
+
+  if (h->byteorder != BLOB_BYTEORDER || h->version != BLOB_VERSION ||
+      h->record_size != sizeof(struct blob_record_t))
+    return -EPROTONOSUPPORT;
+
+  /* the header comes from the file, so its sections are checked to be in
+   * order and in bounds without adding up fields that could wrap around */
+  if (h->total_size > b->size ||
+      h->index_offset < sizeof(*h) + (uint64_t)h->count * sizeof(struct blob_record_t) ||
+      h->index_offset > h->lists_offset ||
+      h->count > (h->lists_offset - h->index_offset) / sizeof(uint32_t) ||
+      h->lists_offset > h->strings_offset ||
+      h->lists_count > (h->strings_offset - h->lists_offset) / sizeof(uint32_t) ||
+      h->strings_offset > h->total_size ||
+      h->strings_size > h->total_size - h->strings_offset ||
+      (h->index_offset | h->lists_offset) % sizeof(uint32_t) != 0)
+    return -EBADMSG;
+
+  /* makes any in-bounds string offset safe to hand out as a C string */
+  if (h->strings_size > 0 && b->base[h->strings_offset + h->strings_size - 1] != '\0')
+    return -EBADMSG;
+
+  b->header = h;
+  b->records = (const struct blob_record_t *)(b->base + sizeof(*h));
+  b->index = (const uint32_t *)(b->base + h->index_offset);
+  b->lists = (const uint32_t *)(b->base + h->lists_offset);
+  b->strings = (const char *)b->base + h->strings_offset;
+
+  return 0;
+}
+
+/* Wraps a serialized image without copying it. data must stay valid, and
+ * suitably aligned, until the blob is freed. */
+int aur_package_blob_open(aur_package_blob_t **ret, const void *data, size_t len) {
+  aur_package_blob_t *b;
+  int r;
+
+  if ((uintptr_t)data % sizeof(uint64_t) != 0)
+    return -EINVAL;
+
+  b = calloc(1, sizeof(*b));
+  if (b == NULL)
+    return -ENOMEM;
+
+  b->base = data;
+  b->size = len;
+
+  r = blob_validate(b);
+  if (r < 0) {
+    free(b);
+    return r;
+  }
+
+  *ret = b;
+  return 0;
+}
+
+int aur_package_blob_mmap(aur_package_blob_t **ret, const char *path) {
+  struct stat st;
+  void *map;
+  int fd, r;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -errno;
+
+  if (fstat(fd, &st) < 0) {
+    r = -errno;
+    close(fd);
+    return r;
+  }
+
+  if (st.st_size == 0) {
+    close(fd);
+    return -EBADMSG;
+  }
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return -errno;
+
+  r = aur_package_blob_open(ret, map, st.st_size);
+  if (r < 0) {
+    munmap(map, st.st_size);
+    return r;
+  }
+
+  (*ret)->mapped = 1;
+  return 0;
+}
+
+void aur_package_blob_free(aur_package_blob_t *blob) {
+  if (blob == NULL)
+    return;
+
+  if (blob->mapped)
+    munmap((void *)blob->base, blob->size);
+
+  free(blob);
+}
+
+int aur_package_blob_get_count(const aur_package_blob_t *blob) {
+  return blob->header->count;
+}
+
+static const char *blob_string(const aur_package_blob_t *blob, uint32_t offset) {
+  if (offset >= blob->header->strings_size)
+    return NULL;
+
+  return blob->strings + offset;
+}
+
+static const uint32_t *blob_list(const aur_package_blob_t *blob, int index, int field) {
+  uint32_t offset;
+
+  if (!FIELD_IS_LIST(field) || index < 0 || (uint32_t)index >= blob->header->count)
+    return NULL;
+
+  offset = blob->records[index].lists[field - PACKAGE_FIELD_LICENSES];
+  if (offset >= blob->header->lists_count ||
+      blob->lists[offset] > blob->header->lists_count - offset - 1)
+    return NULL;
+
+  return &blob->lists[offset];
+}
+
+const char *aur_package_blob_get_string(const aur_package_blob_t *blob, int index, int field) {
+  if (!FIELD_IS_STRING(field) || index < 0 || (uint32_t)index >= blob->header->count)
+    return NULL;
+
+  return blob_string(blob, blob->records[index].strings[field - PACKAGE_FIELD_NAME]);
+}
+
+int64_t aur_package_blob_get_integer(const aur_package_blob_t *blob, int index, int field) {
+  const struct blob_record_t *rec;
+
+  if (!FIELD_IS_INTEGER(field) || index < 0 || (uint32_t)index >= blob->header->count)
+    return 0;
+
+  rec = &blob->records[index];
+  switch (field) {
+  case PACKAGE_FIELD_SUBMITTED:
+    return rec->submitted_s;
+  case PACKAGE_FIELD_MODIFIED:
+    return rec->modified_s;
+  default:
+    return rec->integers[field - PACKAGE_FIELD_CATEGORY_ID];
+  }
+}
+
+/* Returns the number of entries in a list field, or -1 if the list is
+ * absent altogether. */
+int aur_package_blob_get_list_size(const aur_package_blob_t *blob, int index, int field) {
+  const uint32_t *l = blob_list(blob, index, field);
+
+  return l ? (int)l[0] : -1;
+}
+
+const char *aur_package_blob_get_list_item(const aur_package_blob_t *blob, int index, int field, int n) {
+  const uint32_t *l = blob_list(blob, index, field);
+
+  if (l == NULL || n < 0 || (uint32_t)n >= l[0])
+    return NULL;
+
+  return blob_string(blob, l[1 + n]);
+}
+
+int aur_package_blob_find(const aur_package_blob_t *blob, const char *name) {
+  size_t lo = 0, hi = blob->header->count;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    uint32_t i = blob->index[mid];
+    const char *n;
+    int c;
+
+    if (i >= blob->header->count)
+      return -EBADMSG;
+
+    n = aur_package_blob_get_string(blob, i, PACKAGE_FIELD_NAME);
+    c = strcmp(name, n ? n : "");
+    if (c == 0)
+      return i;
+    else if (c < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+
+  return -ENOENT;
+}
+
+static int copy_string(const char *s, char **out) {
+  if (s == NULL)
+    return 0;
+
+  *out = strdup(s);
+  return *out ? 0 : -ENOMEM;
+}
+
+static int blob_copy_package(const aur_package_blob_t *blob, int index, struct package_t *p) {
+  int r;
+
+  for (int f = PACKAGE_FIELD_NAME; f <= PACKAGE_FIELD_VERSION; ++f) {
+    r = copy_string(aur_package_blob_get_string(blob, index, f), package_field(p, f));
+    if (r < 0)
+      return r;
+  }
+
+  p->category_id = aur_package_blob_get_integer(blob, index, PACKAGE_FIELD_CATEGORY_ID);
+  p->package_id = aur_package_blob_get_integer(blob, index, PACKAGE_FIELD_PACKAGE_ID);
+  p->pkgbaseid = aur_package_blob_get_integer(blob, index, PACKAGE_FIELD_PKGBASEID);
+  p->out_of_date = aur_package_blob_get_integer(blob, index, PACKAGE_FIELD_OUT_OF_DATE);
+  p->votes = aur_package_blob_get_integer(blob, index, PACKAGE_FIELD_VOTES);
+  p->submitted_s = aur_package_blob_get_integer(blob, index, PACKAGE_FIELD_SUBMITTED);
+  p->modified_s = aur_package_blob_get_integer(blob, index, PACKAGE_FIELD_MODIFIED);
+
+  for (int f = PACKAGE_FIELD_LICENSES; f <= PACKAGE_FIELD_REPLACES; ++f) {
+    int n = aur_package_blob_get_list_size(blob, index, f);
+    char **v;
+
+    if (n < 0)
+      continue;
+
+    v = calloc(n + 1, sizeof(char *));
+    if (v == NULL)
+      return -ENOMEM;
+    *(char ***)package_field(p, f) = v;
+
+    for (int i = 0; i < n; ++i) {
+      const char *s = aur_package_blob_get_list_item(blob, index, f, i);
+
+      /* a hole would cut the list short */
+      if (s == NULL)
+        return -EBADMSG;
+
+      r = copy_string(s, &v[i]);
+      if (r < 0)
+        return r;
+    }
+  }
+
+  return 0;
+}
+
+/* Materializes the blob into a regular package list, to be freed with
+ * aur_package_list_free. */
+int aur_package_blob_to_packages(const aur_package_blob_t *blob, struct package_t **packages, int *count) {
+  struct package_t *p;
+  int n;
+
+  if (blob->header->count >= INT_MAX)
+    return -EOVERFLOW;
+  n = blob->header->count;
+
+  p = calloc(n + 1, sizeof(struct package_t));
+  if (p == NULL)
+    return -ENOMEM;
+
+  for (int i = 0; i < n; ++i) {
+    int r = blob_copy_package(blob, i, &p[i]);
+    if (r < 0) {
+      /* a package without a name would end aur_package_list_free early */
+      for (int j = 0; j <= i; ++j)
+        package_reset_internal(&p[j]);
+      free(p);
+      return r;
+    }
+  }
+
+  *packages = p;
+  *count = n;
+
+  return 0;
+}
+
+/* vim: set et ts=2 sw=2: */
@@ -0,0 +1,333 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aur-internal.h"
+#include "macro.h"
+
+/* A package cache shared by every process that maps the same file:
+ *
+ *   header | slots[nslots]
+ *
+ * Each slot holds one package, serialized with aur_packages_serialize so it
+ * means the same thing at whatever address the file is mapped. A package
+ * lives in one of SLOT_WAYS slots following the one its name hashes to.
+ *
+ * Writers take an exclusive flock on the file among themselves, and bump
+ * the slot's sequence number to odd before touching it and back to even
+ * afterwards. Readers never lock: they copy a slot out, and start over if
+ * its sequence number was odd or changed while they were copying. */
+
+#define CACHE_MAGIC "LIBAURSC"
+#define CACHE_VERSION 1
+#define CACHE_BYTEORDER 0x01020304u
+
+#define DEFAULT_SLOTS 4096
+#define SLOT_SIZE 4096
+#define SLOT_WAYS 4
+#define READ_RETRIES 16
+
+struct cache_header_t {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteorder;
+  uint32_t nslots;
+  uint32_t slot_size;
+};
+
+struct cache_slot_t {
+  uint32_t seq;
+  uint32_t len;
+  uint64_t hash;
+  int64_t stored_s;
+  uint8_t data[SLOT_SIZE - 24];
+};
+
+struct aur_package_cache_t {
+  int fd;
+  int writable;
+
+  uint8_t *base;
+  size_t size;
+
+  uint32_t nslots;
+  struct cache_slot_t *slots;
+};
+
+static uint64_t name_hash(const char *s) {
+  uint64_t h = 14695981039346656037ULL;
+
+  for (; *s; ++s) {
+    h ^= (unsigned char)*s;
+    h *= 1099511628211ULL;
+  }
+
+  /* zero marks an empty slot */
+  return h ? h : 1;
+}
+
+static int cache_init_file(int fd, uint32_t nslots) {
+  struct cache_header_t h = {
+    .magic = CACHE_MAGIC,
+    .version = CACHE_VERSION,
+    .byteorder = CACHE_BYTEORDER,
+    .nslots = nslots,
+    .slot_size = SLOT_SIZE,
+  };
+
+  /* slots start out zeroed, which is empty */
+  if (ftruncate(fd, SLOT_SIZE + (off_t)nslots * SLOT_SIZE) < 0)
+    return -errno;
+
+  if (pwrite(fd, &h, sizeof(h), 0) != sizeof(h))
+    return -EIO;
+
+  return 0;
+}
+
+/* Opens the cache at path, creating it with room for nslots packages (or a
+ * default number if nslots is 0) if it doesn't exist yet. A cache that
+ * can't be written to is still usable for lookups. */
+int aur_package_cache_open(aur_package_cache_t **ret, const char *path, int nslots) {
+  _cleanup_free_ aur_package_cache_t *c = NULL;
+  const struct cache_header_t *h;
+  struct stat st;
+  int r;
+
+  if (nslots < 0)
+    return -EINVAL;
+
+  c = calloc(1, sizeof(*c));
+  if (c == NULL)
+    return -ENOMEM;
+
+  c->writable = 1;
+  c->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (c->fd < 0 && (errno == EACCES || errno == EROFS)) {
+    c->writable = 0;
+    c->fd = open(path, O_RDONLY | O_CLOEXEC);
+  }
+  if (c->fd < 0)
+    return -errno;
+
+  /* whoever gets here first lays the file out */
+  if (c->writable) {
+    flock(c->fd, LOCK_EX);
+
+    if (fstat(c->fd, &st) < 0)
+      r = -errno;
+    else if (st.st_size == 0)
+      r = cache_init_file(c->fd, nslots ? nslots : DEFAULT_SLOTS);
+    else
+      r = 0;
+
+    flock(c->fd, LOCK_UN);
+    if (r < 0)
+      goto fail;
+  }
+
+  if (fstat(c->fd, &st) < 0) {
+    r = -errno;
+    goto fail;
+  }
+
+  if ((size_t)st.st_size < SLOT_SIZE) {
+    r = -EBADMSG;
+    goto fail;
+  }
+
+  c->size = st.st_size;
+  c->base = mmap(NULL, c->size, PROT_READ | (c->writable ? PROT_WRITE : 0), MAP_SHARED, c->fd, 0);
+  if (c->base == MAP_FAILED) {
+    r = -errno;
+    goto fail;
+  }
+
+  h = (const struct cache_header_t *)c->base;
+  if (memcmp(h->magic, CACHE_MAGIC, sizeof(h->magic)) != 0 ||
+      h->byteorder != CACHE_BYTEORDER || h->version != CACHE_VERSION ||
+      h->slot_size != SLOT_SIZE || h->nslots == 0 ||
+      c->size < SLOT_SIZE + (uint64_t)h->nslots * SLOT_SIZE) {
+    munmap(c->base, c->size);
+    r = -EPROTONOSUPPORT;
+    goto fail;
+  }
+
+  c->nslots = h->nslots;
+  c->slots = (struct cache_slot_t *)(c->base + SLOT_SIZE);
+
+  *ret = c;
+  c = NULL;
+
+  return 0;
+
+fail:
+  close(c->fd);
+  return r;
+}
+
+void aur_package_cache_free(aur_package_cache_t *cache) {
+  if (cache == NULL)
+    return;
+
+  munmap(cache->base, cache->size);
+  close(cache->fd);
+  free(cache);
+}
+
+/* Copies a slot out if it holds a package by this hash. Returns the length
+ * of the image, 0 if the slot holds something else, or -EAGAIN if a writer
+ * got in the way too often. */
+static int slot_read(const struct cache_slot_t *slot, uint64_t hash, void *buf, int64_t *stored_s) {
+  for (int i = 0; i < READ_RETRIES; ++i) {
+    uint32_t seq, len;
+    uint64_t h;
+
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1)
+      continue;
+
+    h = slot->hash;
+    len = slot->len;
+    *stored_s = slot->stored_s;
+    if (h == hash && len <= sizeof(slot->data))
+      memcpy(buf, slot->data, len);
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+      continue;
+
+    if (h != hash || len > sizeof(slot->data))
+      return 0;
+
+    return len;
+  }
+
+  return -EAGAIN;
+}
+
+/* Looks up a package by name, ignoring entries stored more than max_age_s
+ * seconds ago. On a hit, *packages is a list of one package, to be freed
+ * with aur_package_list_free. */
+int aur_package_cache_get(aur_package_cache_t *cache, const char *name, long max_age_s,
+    struct package_t **packages) {
+  _cleanup_free_ void *buf = NULL;
+  uint64_t hash = name_hash(name);
+  time_t now = time(NULL);
+
+  buf = malloc(sizeof(cache->slots[0].data));
+  if (buf == NULL)
+    return -ENOMEM;
+
+  for (uint32_t w = 0; w < SLOT_WAYS; ++w) {
+    const struct cache_slot_t *slot = &cache->slots[(hash + w) % cache->nslots];
+    aur_package_blob_t *blob;
+    int64_t stored_s;
+    int len, count, r;
+
+    len = slot_read(slot, hash, buf, &stored_s);
+    if (len <= 0)
+      continue;
+
+    if (stored_s + max_age_s < now)
+      return -ENOENT;
+
+    if (aur_package_blob_open(&blob, buf, len) < 0)
+      continue;
+
+    if (aur_package_blob_get_count(blob) != 1 || aur_package_blob_find(blob, name) != 0) {
+      aur_package_blob_free(blob);
+      continue;
+    }
+
+    r = aur_package_blob_to_packages(blob, packages, &count);
+    aur_package_blob_free(blob);
+
+    return r;
+  }
+
+  return -ENOENT;
+}
+
+static void slot_write(struct cache_slot_t *slot, uint64_t hash, const void *image, size_t len, time_t now) {
+  /* a writer that died halfway leaves the count odd */
+  uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) | 1;
+
+  __atomic_store_n(&slot->seq, seq, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  slot->hash = hash;
+  slot->len = len;
+  slot->stored_s = now;
+  memcpy(slot->data, image, len);
+
+  __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+static int cache_put_one(aur_package_cache_t *cache, const struct package_t *package, time_t now) {
+  _cleanup_free_ void *image = NULL;
+  struct cache_slot_t *victim = NULL;
+  uint64_t hash;
+  size_t len;
+  int r;
+
+  if (package->name == NULL)
+    return -EINVAL;
+
+  r = aur_packages_serialize(package, 1, &image, &len);
+  if (r < 0)
+    return r;
+
+  if (len > sizeof(cache->slots[0].data))
+    return -E2BIG;
+
+  /* the package's own slot if it has one, else the stalest */
+  hash = name_hash(package->name);
+  for (uint32_t w = 0; w < SLOT_WAYS; ++w) {
+    struct cache_slot_t *slot = &cache->slots[(hash + w) % cache->nslots];
+
+    if (slot->hash == hash) {
+      victim = slot;
+      break;
+    }
+
+    if (victim == NULL || slot->stored_s < victim->stored_s)
+      victim = slot;
+  }
+
+  slot_write(victim, hash, image, len, now);
+
+  return 0;
+}
+
+/* Stores packages, replacing earlier entries by the same name. Packages too
+ * large for a slot are skipped. */
+int aur_package_cache_put(aur_package_cache_t *cache, const struct package_t *packages, int count) {
+  time_t now = time(NULL);
+  int r = 0;
+
+  if (!cache->writable)
+    return -EROFS;
+
+  if (flock(cache->fd, LOCK_EX) < 0)
+    return -errno;
+
+  for (int i = 0; i < count; ++i) {
+    int q = cache_put_one(cache, &packages[i], now);
+    if (q < 0 && q != -E2BIG && r == 0)
+      r = q;
+  }
+
+  flock(cache->fd, LOCK_UN);
+
+  return r;
+}
+
+/* vim: set et ts=2 sw=2: */
@@ -0,0 +1,243 @@
+#include <errno.h>
+#include <string.h>
+
+#include <yajl_gen.h>
+#include <yajl_tree.h>
+
+#include "aur-internal.h"
+
+/* Single-name info requests queued within the coalescing window go out as
+ * one multiinfo. Its response is split back up so that every info request
+ * completes with a response of its own, holding only its own package. */
+
+int coalesce_add_internal(aur_t *aur, aur_request_t *request, uint64_t now) {
+  size_t len = aur_request_arg_length(request->args.argv[0]);
+
+  if (aur->coalescing.size > 0 && aur->coalesce_arglen + len > AUR_MAX_QUERY_LEN) {
+    int r = coalesce_flush_internal(aur);
+    if (r < 0)
+      return r;
+  }
+
+  if (aur->coalescing.size == 0) {
+    aur->coalesce_deadline_us = now + (uint64_t)aur->coalesce_window_ms * 1000;
+    aur->coalesce_arglen = 0;
+  }
+
+  aur->coalesce_arglen += len;
+  request_list_append(&aur->coalescing, aur_request_ref(request));
+
+  return 0;
+}
+
+static void gen_string(yajl_gen g, const char *s) {
+  yajl_gen_string(g, (const unsigned char *)s, strlen(s));
+}
+
+static void gen_value(yajl_gen g, yajl_val v) {
+  switch (v->type) {
+  case yajl_t_string:
+    gen_string(g, v->u.string);
+    break;
+  case yajl_t_number:
+    yajl_gen_number(g, v->u.number.r, strlen(v->u.number.r));
+    break;
+  case yajl_t_object:
+    yajl_gen_map_open(g);
+    for (size_t i = 0; i < v->u.object.len; ++i) {
+      gen_string(g, v->u.object.keys[i]);
+      gen_value(g, v->u.object.values[i]);
+    }
+    yajl_gen_map_close(g);
+    break;
+  case yajl_t_array:
+    yajl_gen_array_open(g);
+    for (size_t i = 0; i < v->u.array.len; ++i)
+      gen_value(g, v->u.array.values[i]);
+    yajl_gen_array_close(g);
+    break;
+  case yajl_t_true:
+    yajl_gen_bool(g, 1);
+    break;
+  case yajl_t_false:
+    yajl_gen_bool(g, 0);
+    break;
+  default:
+    yajl_gen_null(g);
+    break;
+  }
+}
+
+static int result_matches(yajl_val pkg, const char *name) {
+  const char *path[] = { "Name", NULL };
+  const char *s;
+
+  s = YAJL_GET_STRING(yajl_tree_get(pkg, path, yajl_t_string));
+
+  return s != NULL && strcmp(s, name) == 0;
+}
+
+/* builds the response an info request for the member's name would have
+ * gotten */
+static int answer_member(yajl_val root, yajl_val results, aur_request_t *member) {
+  const char *version_path[] = { "version", NULL };
+  const char *name = member->args.argv[0];
+  const unsigned char *buf;
+  yajl_val version;
+  yajl_gen g;
+  size_t len;
+  int count = 0, r;
+
+  g = yajl_gen_alloc(NULL);
+  if (g == NULL)
+    return -ENOMEM;
+
+  for (size_t i = 0; i < results->u.array.len; ++i)
+    count += result_matches(results->u.array.values[i], name);
+
+  yajl_gen_map_open(g);
+
+  version = yajl_tree_get(root, version_path, yajl_t_number);
+  if (version != NULL) {
+    gen_string(g, "version");
+    gen_value(g, version);
+  }
+
+  gen_string(g, "type");
+  gen_string(g, "info");
+  gen_string(g, "resultcount");
+  yajl_gen_integer(g, count);
+
+  gen_string(g, "results");
+  yajl_gen_array_open(g);
+  for (size_t i = 0; i < results->u.array.len; ++i)
+    if (result_matches(results->u.array.values[i], name))
+      gen_value(g, results->u.array.values[i]);
+  yajl_gen_array_close(g);
+
+  yajl_gen_map_close(g);
+
+  yajl_gen_get_buf(g, &buf, &len);
+  r = request_set_body_internal(member, buf, len);
+
+  yajl_gen_free(g);
+
+  return r;
+}
+
+static int coalesced_done(aur_t *aur, aur_request_t *request, const void *response, int responselen) {
+  const char *results_path[] = { "results", NULL }, *type_path[] = { "type", NULL };
+  yajl_val root = NULL, results = NULL;
+
+  (void)responselen;
+
+  if (request->result == 0 && response != NULL) {
+    const char *type;
+
+    root = yajl_tree_parse(response, NULL, 0);
+    type = YAJL_GET_STRING(yajl_tree_get(root, type_path, yajl_t_string));
+
+    /* an error answer comes with an empty results array of its own */
+    if (type == NULL || strcmp(type, "error") != 0)
+      results = yajl_tree_get(root, results_path, yajl_t_array);
+  }
+
+  while (request->merged.head) {
+    aur_request_t *member = aur_request_ref(request->merged.head);
+    int r = 0;
+
+    member->result = request->result;
+    member->http_status = aur_request_get_http_status(request);
+    member->timing = request->timing;
+
+    /* error responses and anything we can't parse are passed on as is */
+    if (results != NULL)
+      r = answer_member(root, results, member);
+    else
+      request_share_response_internal(member, request);
+    if (r < 0)
+      member->result = r;
+
+    complete_request_internal(aur, member, request_response_size_internal(member));
+    aur_request_unref(member);
+  }
+
+  yajl_tree_free(root);
+
+  return 0;
+}
+
+static int has_arg(aur_request_t *request, const char *arg) {
+  for (size_t i = 0; i < request->args.size; ++i)
+    if (strcmp(request->args.argv[i], arg) == 0)
+      return 1;
+
+  return 0;
+}
+
+/* Queues a multiinfo for everything held in the window. It runs with the
+ * most urgent priority, the most generous retry policy and the latest
+ * deadline of the requests it answers; earlier deadlines are enforced on
+ * the members themselves. */
+int coalesce_flush_internal(aur_t *aur) {
+  aur_request_t *m;
+  uint64_t deadline = 0;
+  int r, bounded = 1;
+
+  if (aur->coalescing.size == 0)
+    return 0;
+
+  r = aur_request_new(&m, REQUEST_MULTIINFO, coalesced_done);
+  if (r < 0)
+    return r;
+
+  m->priority = _PRIORITY_MAX - 1;
+
+  for (aur_request_t *q = aur->coalescing.head; q; q = q->next) {
+    if (!has_arg(m, q->args.argv[0])) {
+      r = aur_request_append_arg(m, q->args.argv[0]);
+      if (r < 0) {
+        aur_request_unref(m);
+        return r;
+      }
+    }
+
+    if (q->priority < m->priority)
+      m->priority = q->priority;
+    if (q->max_retries > m->max_retries)
+      m->max_retries = q->max_retries;
+    if (q->retry_base_ms > m->retry_base_ms)
+      m->retry_base_ms = q->retry_base_ms;
+    if (q->hedge_after_ms > 0 && (m->hedge_after_ms == 0 || q->hedge_after_ms < m->hedge_after_ms))
+      m->hedge_after_ms = q->hedge_after_ms;
+    m->debug |= q->debug;
+
+    if (q->deadline_us == 0)
+      bounded = 0;
+    else if (q->deadline_us > deadline)
+      deadline = q->deadline_us;
+  }
+
+  r = aur_queue_request(aur, m);
+  if (r < 0) {
+    aur_request_unref(m);
+    return r;
+  }
+
+  m->deadline_us = bounded ? deadline : 0;
+
+  /* the references held by the coalescing list move along */
+  while (aur->coalescing.head) {
+    aur_request_t *q = aur->coalescing.head;
+
+    request_list_remove(q);
+    q->merged_into = m;
+    request_list_append(&m->merged, q);
+  }
+
+  aur_request_unref(m);
+
+  return 0;
+}
+
+/* vim: set et ts=2 sw=2: */
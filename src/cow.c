@@ -1,13 +1,50 @@
 #include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <git2.h>
 
 #include "aur.h"
 #include "macro.h"
 
+static int opt_stats = 0;
+static int opt_state = 1;
+static int opt_daemon = 1;
+static const char *opt_cache = NULL;
+static const char *opt_mirrors[8];
+static int opt_n_mirrors = 0;
+static const char *opt_root = "/";
+static const char *opt_dbpath = NULL;
+static int opt_all = 0;
+static int opt_interval = 0;
+static int opt_output = 0;
+static int opt_progress = -1;
+
+enum {
+  OUTPUT_HUMAN,
+  OUTPUT_NDJSON,
+  OUTPUT_TSV,
+};
+
+/* how long a cached package is trusted */
+#define CACHE_MAX_AGE_S 300
+
+static aur_package_cache_t *pkgcache;
+
+/* requests that got no usable answer, which makes for a failed exit */
+static int nfailed;
+
+static struct local_package_t *localpkgs;
+static int n_localpkgs;
+static char **newer_versions;
+
 static void dump_string(const char *k, const char *v) {
   if (v == NULL)
     return;
@@ -68,27 +105,350 @@ static void dump_package_search(struct package_t *p) {
   printf("aur/%s %s (%d)\n    %s\n", p->name, p->version, p->votes, p->description);
 }
 
+/* Machine readable output is put together in one large buffer, which goes
+ * out in as few writes as possible. */
+#define OUTPUT_BUFSIZE (256 * 1024)
+
+static char outbuf[OUTPUT_BUFSIZE];
+static size_t outlen;
+
+static void out_write(const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(STDOUT_FILENO, data, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+
+    data += n;
+    len -= n;
+  }
+}
+
+static void out_flush(void) {
+  out_write(outbuf, outlen);
+  outlen = 0;
+}
+
+static void out_mem(const char *data, size_t len) {
+  if (outlen + len > sizeof(outbuf)) {
+    out_flush();
+
+    if (len > sizeof(outbuf)) {
+      out_write(data, len);
+      return;
+    }
+  }
+
+  memcpy(&outbuf[outlen], data, len);
+  outlen += len;
+}
+
+static void out_str(const char *s) {
+  out_mem(s, strlen(s));
+}
+
+static void out_int(long long v) {
+  char buf[24];
+
+  out_mem(buf, snprintf(buf, sizeof(buf), "%lld", v));
+}
+
+/* copies runs of characters that need no escaping in one go */
+static void out_escaped(const char *s, const char *special, int json) {
+  while (*s) {
+    size_t n = strcspn(s, special);
+    unsigned char c;
+
+    out_mem(s, n);
+    s += n;
+    if (*s == '\0')
+      break;
+
+    c = *s++;
+    switch (c) {
+    case '\t':
+      out_mem("\\t", 2);
+      break;
+    case '\n':
+      out_mem("\\n", 2);
+      break;
+    case '\r':
+      out_mem("\\r", 2);
+      break;
+    case '\\':
+      out_mem("\\\\", 2);
+      break;
+    case '"':
+      out_mem("\\\"", 2);
+      break;
+    default:
+      if (json) {
+        char buf[8];
+        out_mem(buf, snprintf(buf, sizeof(buf), "\\u%04x", c));
+      } else {
+        out_mem(" ", 1);
+      }
+    }
+  }
+}
+
+static const char json_special[] = "\"\\"
+    "\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f"
+    "\x10\x11\x12\x13\x14\x15\x16\x17\x18\x19\x1a\x1b\x1c\x1d\x1e\x1f";
+
+static void out_json_value(const char *v) {
+  if (v == NULL) {
+    out_mem("null", 4);
+    return;
+  }
+
+  out_mem("\"", 1);
+  out_escaped(v, json_special, 1);
+  out_mem("\"", 1);
+}
+
+static void out_json_string(const char *k, const char *v) {
+  out_mem(",\"", 2);
+  out_str(k);
+  out_mem("\":", 2);
+  out_json_value(v);
+}
+
+static void out_json_int(const char *k, long long v) {
+  out_mem(",\"", 2);
+  out_str(k);
+  out_mem("\":", 2);
+  out_int(v);
+}
+
+static void out_json_stringlist(const char *k, char **l) {
+  if (l == NULL)
+    return;
+
+  out_mem(",\"", 2);
+  out_str(k);
+  out_mem("\":[", 3);
+  for (char **s = l; *s; ++s) {
+    if (s != l)
+      out_mem(",", 1);
+    out_json_value(*s);
+  }
+  out_mem("]", 1);
+}
+
+/* keys as the AUR's RPC interface names them */
+static void ndjson_package(const struct package_t *p) {
+  out_mem("{\"Name\":", 8);
+  out_json_value(p->name);
+  out_json_string("Version", p->version);
+  out_json_string("Description", p->description);
+  out_json_string("URL", p->upstream_url);
+  out_json_string("PackageBase", p->pkgbase);
+  out_json_string("Maintainer", p->maintainer);
+  out_json_string("URLPath", p->aur_urlpath);
+  out_json_int("ID", p->package_id);
+  out_json_int("PackageBaseID", p->pkgbaseid);
+  out_json_int("NumVotes", p->votes);
+  if (p->out_of_date)
+    out_json_int("OutOfDate", p->out_of_date);
+  else
+    out_json_string("OutOfDate", NULL);
+  out_json_int("FirstSubmitted", p->submitted_s);
+  out_json_int("LastModified", p->modified_s);
+  out_json_stringlist("Depends", p->depends);
+  out_json_stringlist("MakeDepends", p->makedepends);
+  out_json_stringlist("OptDepends", p->optdepends);
+  out_json_stringlist("CheckDepends", p->checkdepends);
+  out_json_stringlist("Provides", p->provides);
+  out_json_stringlist("Conflicts", p->conflicts);
+  out_json_stringlist("Replaces", p->replaces);
+  out_json_stringlist("Groups", p->groups);
+  out_json_stringlist("License", p->licenses);
+  out_mem("}\n", 2);
+}
+
+static const char tsv_special[] = "\t\n\r\\";
+
+static void out_tsv_string(const char *v) {
+  out_mem("\t", 1);
+  if (v != NULL)
+    out_escaped(v, tsv_special, 0);
+}
+
+static void out_tsv_int(long long v) {
+  out_mem("\t", 1);
+  out_int(v);
+}
+
+/* list items go space separated, as they never contain blanks, apart from
+ * optdepends' reasons, which is why those are left out */
+static void out_tsv_stringlist(char **l) {
+  out_mem("\t", 1);
+  if (l == NULL)
+    return;
+
+  for (char **s = l; *s; ++s) {
+    if (s != l)
+      out_mem(" ", 1);
+    out_escaped(*s, tsv_special, 0);
+  }
+}
+
+static const char tsv_header[] =
+    "name\tversion\tdescription\turl\tpkgbase\tmaintainer\tvotes\tout_of_date\t"
+    "submitted\tmodified\tdepends\tmakedepends\tprovides\tconflicts\tlicense\n";
+
+static void tsv_package(const struct package_t *p) {
+  if (p->name != NULL)
+    out_escaped(p->name, tsv_special, 0);
+  out_tsv_string(p->version);
+  out_tsv_string(p->description);
+  out_tsv_string(p->upstream_url);
+  out_tsv_string(p->pkgbase);
+  out_tsv_string(p->maintainer);
+  out_tsv_int(p->votes);
+  out_tsv_int(p->out_of_date);
+  out_tsv_int(p->submitted_s);
+  out_tsv_int(p->modified_s);
+  out_tsv_stringlist(p->depends);
+  out_tsv_stringlist(p->makedepends);
+  out_tsv_stringlist(p->provides);
+  out_tsv_stringlist(p->conflicts);
+  out_tsv_stringlist(p->licenses);
+  out_mem("\n", 1);
+}
+
+/* search results come with fewer fields, the rest are left empty */
+static void print_package(struct package_t *p, int search) {
+  switch (opt_output) {
+  case OUTPUT_NDJSON:
+    ndjson_package(p);
+    break;
+  case OUTPUT_TSV:
+    tsv_package(p);
+    break;
+  default:
+    if (search)
+      dump_package_search(p);
+    else
+      dump_package(p);
+  }
+}
+
+static void dump_srcinfo_list(const aur_srcinfo_t *srcinfo, int i, const char *k, const char *key) {
+  int n = aur_srcinfo_get_list_size(srcinfo, i, key);
+
+  if (n <= 0)
+    return;
+
+  printf("%-15s:", k);
+  for (int v = 0; v < n; ++v)
+    printf(" %s", aur_srcinfo_get_list_item(srcinfo, i, key, v));
+  fputc('\n', stdout);
+}
+
+static void dump_srcinfo(const aur_srcinfo_t *srcinfo) {
+  const struct package_t *pkgs;
+  int count;
+
+  pkgs = aur_srcinfo_get_packages(srcinfo, &count);
+  for (int i = 0; i < count; ++i) {
+    const struct package_t *p = &pkgs[i];
+    int narch = aur_srcinfo_get_list_size(srcinfo, i, "arch");
+
+    dump_string("Name", p->name);
+    dump_string("Package Base", p->pkgbase);
+    dump_string("Version", p->version);
+    dump_string("URL", p->upstream_url);
+    dump_srcinfo_list(srcinfo, i, "Architecture", "arch");
+    dump_stringlist("Depends", p->depends);
+    dump_stringlist("OptDepends", p->optdepends);
+    dump_stringlist("Makedepends", p->makedepends);
+    dump_stringlist("Checkdepends", p->checkdepends);
+
+    /* arch specific depends only exist for the architectures listed */
+    for (int a = 0; a < narch; ++a) {
+      const char *arch = aur_srcinfo_get_list_item(srcinfo, i, "arch", a);
+      char key[64], label[64];
+
+      snprintf(key, sizeof(key), "depends_%s", arch);
+      snprintf(label, sizeof(label), "Depends (%s)", arch);
+      dump_srcinfo_list(srcinfo, i, label, key);
+    }
+
+    dump_stringlist("Provides", p->provides);
+    dump_stringlist("Conflicts With", p->conflicts);
+    dump_stringlist("Replaces", p->replaces);
+    dump_stringlist("Licenses", p->licenses);
+    dump_srcinfo_list(srcinfo, i, "Sources", "source");
+    dump_string("Description", p->description);
+    fputc('\n', stdout);
+  }
+}
+
+/* Shows the packages built by the checkouts in dirs, read on all CPUs at
+ * once. Nothing goes over the network. */
+static int show_srcinfo(int count, char **dirs) {
+  _cleanup_free_ aur_srcinfo_t **srcinfos = NULL;
+  int r, ret = 0;
+
+  srcinfos = calloc(count, sizeof(aur_srcinfo_t *));
+  if (srcinfos == NULL)
+    return -ENOMEM;
+
+  r = aur_srcinfo_read_many(srcinfos, (const char *const *)dirs, count, 0);
+  if (r < 0)
+    return r;
+
+  for (int i = 0; i < count; ++i) {
+    if (srcinfos[i] == NULL) {
+      fprintf(stderr, "error: failed to read %s/.SRCINFO\n", dirs[i]);
+      ret = -ENOENT;
+      continue;
+    }
+
+    dump_srcinfo(srcinfos[i]);
+    aur_srcinfo_free(srcinfos[i]);
+  }
+
+  return ret;
+}
+
 static int done_cb_json(aur_t *aur, aur_request_t *req, const void *response, int responselen) {
   struct package_t *pkgs;
   int r, c;
-  void (*dumpfn)(struct package_t*);
 
   (void)aur; (void)responselen;
 
-  if (aur_request_get_type(req) == REQUEST_SEARCH)
-    dumpfn = dump_package_search;
-  else
-    dumpfn = dump_package;
+  if (aur_request_get_result(req) < 0) {
+    fprintf(stderr, "error: request failed: %s\n", strerror(-aur_request_get_result(req)));
+    ++nfailed;
+    aur_request_unref(req);
+    return 0;
+  }
 
   r = aur_packages_from_json(response, &pkgs, &c);
-  if (r < 0)
+  if (r < 0) {
     fprintf(stderr, "failed to decode json\n");
+    ++nfailed;
+    aur_request_unref(req);
+    return 0;
+  }
 
   if (c == 0)
     fprintf(stderr, "error: no results\n");
 
+  /* each answer goes out as soon as it's decoded */
   for (int i = 0; i < c; ++i)
-    dumpfn(&pkgs[i]);
+    print_package(&pkgs[i], aur_request_get_type(req) == REQUEST_SEARCH);
+  out_flush();
+
+  /* search results lack most fields, so only info answers are kept */
+  if (pkgcache != NULL && aur_request_get_type(req) != REQUEST_SEARCH &&
+      aur_request_get_type(req) != REQUEST_MSEARCH)
+    aur_package_cache_put(pkgcache, pkgs, c);
 
   aur_package_list_free(pkgs);
 
@@ -97,62 +457,347 @@ static int done_cb_json(aur_t *aur, aur_request_t *req, const void *response, in
   return 0;
 }
 
-static int ready_for_download(aur_t *aur, aur_request_t *req, const void *response, int responselen) {
+static int local_package_cmp(const void *a, const void *b) {
+  const struct local_package_t *p = b;
+
+  return strcmp(a, p->name);
+}
+
+static int done_cb_outdated(aur_t *aur, aur_request_t *req, const void *response, int responselen) {
   struct package_t *pkgs;
   int r, c;
 
-  (void)responselen;
+  (void)aur; (void)responselen;
 
-  aur_request_unref(req);
+  if (aur_request_get_result(req) < 0) {
+    fprintf(stderr, "error: request failed: %s\n", strerror(-aur_request_get_result(req)));
+    ++nfailed;
+    aur_request_unref(req);
+    return 0;
+  }
 
   r = aur_packages_from_json(response, &pkgs, &c);
+  aur_request_unref(req);
   if (r < 0) {
+    ++nfailed;
     fprintf(stderr, "failed to decode json\n");
-    return 1;
+    return 0;
   }
 
-  if (c == 0) {
-    fprintf(stderr, "no results found\n");
+  for (int i = 0; i < c; ++i) {
+    struct local_package_t *l;
+
+    l = bsearch(pkgs[i].name, localpkgs, n_localpkgs, sizeof(*localpkgs), local_package_cmp);
+    if (l == NULL || aur_vercmp(l->version, pkgs[i].version) >= 0)
+      continue;
+
+    newer_versions[l - localpkgs] = strdup(pkgs[i].version);
+  }
+
+  aur_package_list_free(pkgs);
+
+  return 0;
+}
+
+static void print_search_results(aur_t *aur, struct package_t *pkgs, int count, int error, void *userdata) {
+  (void)aur; (void)userdata;
+
+  if (error == -E2BIG) {
+    fprintf(stderr, "error: too many results, try longer search terms\n");
+    ++nfailed;
+    return;
+  }
+
+  if (error < 0) {
+    fprintf(stderr, "error: search failed: %s\n", strerror(-error));
+    ++nfailed;
+    return;
+  }
+
+  if (count == 0)
+    fprintf(stderr, "error: no results\n");
+
+  for (int i = 0; i < count; ++i)
+    print_package(&pkgs[i], 1);
+  out_flush();
+
+  aur_package_list_free(pkgs);
+}
+
+/* What a clone went through, as libgit2's progress callbacks tell it. The
+ * fetch is taken to be transferring until every object has arrived, and
+ * indexing from then until the checkout starts. */
+struct clone_stats_t {
+  const char *pkgbase;
+
+  uint64_t start_us;
+  uint64_t received_us;
+  uint64_t checkout_us;
+  uint64_t end_us;
+  uint64_t drawn_us;
+
+  unsigned int objects;
+  unsigned int total_objects;
+  unsigned int deltas;
+  unsigned int total_deltas;
+  size_t bytes;
+  size_t checkout_steps;
+  size_t total_checkout_steps;
+};
+
+static struct {
+  int clones;
+  int failed;
+  uint64_t objects;
+  uint64_t bytes;
+  uint64_t transfer_us;
+  uint64_t index_us;
+  uint64_t checkout_us;
+  uint64_t total_us;
+} clone_totals;
+
+/* redrawn at most this often, on stderr when it's a terminal */
+#define PROGRESS_INTERVAL_US 100000
+
+static const char clone_tsv_header[] =
+    "pkgbase\tname\tobjects\tbytes\ttransfer_ms\tindex_ms\tcheckout_ms\ttotal_ms\t"
+    "bytes_per_second\terror\n";
+
+static uint64_t now_us(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static double kib_per_second(size_t bytes, uint64_t us) {
+  return us > 0 ? bytes / 1024.0 / (us / 1e6) : 0;
+}
+
+static void draw_progress(struct clone_stats_t *s, uint64_t now) {
+  if (opt_progress <= 0 || now - s->drawn_us < PROGRESS_INTERVAL_US)
+    return;
+
+  s->drawn_us = now;
+
+  if (s->checkout_us != 0)
+    fprintf(stderr, "\r\033[K==> %s: checking out %zu/%zu", s->pkgbase,
+        s->checkout_steps, s->total_checkout_steps);
+  else if (s->received_us != 0)
+    fprintf(stderr, "\r\033[K==> %s: resolving deltas %u/%u", s->pkgbase,
+        s->deltas, s->total_deltas);
+  else
+    fprintf(stderr, "\r\033[K==> %s: receiving objects %u/%u, %.1f KiB, %.1f KiB/s",
+        s->pkgbase, s->objects, s->total_objects, s->bytes / 1024.0,
+        kib_per_second(s->bytes, now - s->start_us));
+}
+
+static int clone_transfer_progress(const git_transfer_progress *progress, void *payload) {
+  struct clone_stats_t *s = payload;
+  uint64_t now = now_us();
+
+  s->objects = progress->received_objects;
+  s->total_objects = progress->total_objects;
+  s->deltas = progress->indexed_deltas;
+  s->total_deltas = progress->total_deltas;
+  s->bytes = progress->received_bytes;
+
+  if (s->received_us == 0 && s->objects == s->total_objects)
+    s->received_us = now;
+
+  draw_progress(s, now);
+
+  return 0;
+}
+
+static void clone_checkout_progress(const char *path, size_t completed, size_t total, void *payload) {
+  struct clone_stats_t *s = payload;
+  uint64_t now = now_us();
+
+  (void)path;
+
+  if (s->checkout_us == 0)
+    s->checkout_us = now;
+
+  s->checkout_steps = completed;
+  s->total_checkout_steps = total;
+
+  draw_progress(s, now);
+}
+
+static void report_clone(const struct package_t *p, const struct clone_stats_t *s, const char *error) {
+  uint64_t fetched_us, received_us, transfer_us, index_us, checkout_us, total_us;
+
+  /* phases the callbacks never saw take no time */
+  fetched_us = s->checkout_us ? s->checkout_us : s->end_us;
+  received_us = s->received_us ? MIN(s->received_us, fetched_us) : fetched_us;
+  transfer_us = received_us - s->start_us;
+  index_us = fetched_us - received_us;
+  checkout_us = s->end_us - fetched_us;
+  total_us = s->end_us - s->start_us;
+
+  ++clone_totals.clones;
+  clone_totals.failed += error != NULL;
+  clone_totals.objects += s->objects;
+  clone_totals.bytes += s->bytes;
+  clone_totals.transfer_us += transfer_us;
+  clone_totals.index_us += index_us;
+  clone_totals.checkout_us += checkout_us;
+  clone_totals.total_us += total_us;
+
+  if (opt_progress > 0)
+    fputs("\r\033[K", stderr);
+
+  switch (opt_output) {
+  case OUTPUT_NDJSON:
+    out_mem("{\"clone\":", 9);
+    out_json_value(p->pkgbase);
+    out_json_string("name", p->name);
+    out_json_int("objects", s->objects);
+    out_json_int("bytes", s->bytes);
+    out_json_int("transfer_ms", transfer_us / 1000);
+    out_json_int("index_ms", index_us / 1000);
+    out_json_int("checkout_ms", checkout_us / 1000);
+    out_json_int("total_ms", total_us / 1000);
+    out_json_int("bytes_per_second", transfer_us ? s->bytes * 1000000 / transfer_us : 0);
+    out_json_string("error", error);
+    out_mem("}\n", 2);
+    out_flush();
+    break;
+  case OUTPUT_TSV:
+    out_escaped(p->pkgbase, tsv_special, 0);
+    out_tsv_string(p->name);
+    out_tsv_int(s->objects);
+    out_tsv_int(s->bytes);
+    out_tsv_int(transfer_us / 1000);
+    out_tsv_int(index_us / 1000);
+    out_tsv_int(checkout_us / 1000);
+    out_tsv_int(total_us / 1000);
+    out_tsv_int(transfer_us ? s->bytes * 1000000 / transfer_us : 0);
+    out_tsv_string(error);
+    out_mem("\n", 1);
+    out_flush();
+    break;
+  default:
+    if (error != NULL)
+      return;
+
+    if (strcmp(p->name, p->pkgbase) == 0)
+      printf("==> Package '%s' cloned", p->name);
+    else
+      printf("==> Package '%s' cloned as '%s'", p->name, p->pkgbase);
+    printf(" (%u objects, %.1f KiB in %.2fs)\n", s->objects, s->bytes / 1024.0, total_us / 1e6);
+  }
+}
+
+static void dump_clone_totals(FILE *stream) {
+  if (clone_totals.clones == 0)
+    return;
+
+  fprintf(stream, "%d clones, %d failed: %" PRIu64 " objects, %.1f KiB, %.1f KiB/s\n",
+      clone_totals.clones, clone_totals.failed, clone_totals.objects,
+      clone_totals.bytes / 1024.0, kib_per_second(clone_totals.bytes, clone_totals.transfer_us));
+  fprintf(stream, "  transfer %.3fs, index %.3fs, checkout %.3fs, total %.3fs\n\n",
+      clone_totals.transfer_us / 1e6, clone_totals.index_us / 1e6,
+      clone_totals.checkout_us / 1e6, clone_totals.total_us / 1e6);
+}
+
+/* pkgbase names a directory here and goes into the clone URL, so it has to
+ * look like the package names the AUR allows, whoever answered */
+static int valid_pkgbase(const char *pkgbase) {
+  static const char allowed[] =
+      "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789@._+-";
+
+  if (pkgbase == NULL || *pkgbase == '\0' || *pkgbase == '-' || *pkgbase == '.')
     return 0;
+
+  return pkgbase[strspn(pkgbase, allowed)] == '\0';
+}
+
+static void clone_package(const struct package_t *p) {
+  git_clone_options opts = GIT_CLONE_OPTIONS_INIT;
+  struct clone_stats_t stats = { .pkgbase = p->pkgbase };
+  git_repository *repo = NULL;
+  _cleanup_free_ char *url = NULL;
+  const git_error *err;
+  char error[256];
+  int r;
+
+  if (p->name == NULL || !valid_pkgbase(p->pkgbase)) {
+    fprintf(stderr, "error: refusing to clone invalid package base '%s'\n",
+        p->pkgbase ? p->pkgbase : "");
+    return;
   }
 
-  for (int i = 0; i < c; ++i) {
-    int error;
+  if (git_repository_open(&repo, p->pkgbase) == GIT_OK) {
+    /* machine readable output only has clones in it */
+    FILE *stream = opt_output == OUTPUT_HUMAN ? stdout : stderr;
 
-    char * url;
-    asprintf(&url, "https://" AUR_DOMAIN "/%s.git", pkgs[i].pkgbase);
+    if (strcmp(p->name, p->pkgbase) == 0)
+      fprintf(stream, "==> Package '%s' already downloaded\n", p->name);
+    else
+      fprintf(stream, "==> Package '%s' already downloaded as '%s'\n", p->name, p->pkgbase);
+    git_repository_free(repo);
+    return;
+  }
 
-    git_repository * repo = NULL;
-    error = git_repository_open(&repo, pkgs[i].pkgbase);
-    if (error == GIT_OK) {
-      if (strcmp(pkgs[i].name, pkgs[i].pkgbase) == 0) {
-        printf("==> Package '%s' already downloaded\n", pkgs[i].name);
-      } else {
-        printf("==> Package '%s' already downloaded as '%s'\n", pkgs[i].name, pkgs[i].pkgbase);
-      }
-      git_repository_free(repo);
-      continue;
-    }
+  if (asprintf(&url, "https://" AUR_DOMAIN "/%s.git", p->pkgbase) < 0)
+    return;
 
-    error = git_clone(&repo, url, pkgs[i].pkgbase, NULL);
-    if (error != 0) {
-      const git_error *err = giterr_last();
-      if (err) {
-        printf("ERROR %d: %s\n", err->klass, err->message);
-      } else {
-        printf("ERROR %d: no detailed info\n", error);
-      }
-      git_repository_free(repo);
-      continue;
-    }
+  opts.fetch_opts.callbacks.transfer_progress = clone_transfer_progress;
+  opts.fetch_opts.callbacks.payload = &stats;
+  opts.checkout_opts.progress_cb = clone_checkout_progress;
+  opts.checkout_opts.progress_payload = &stats;
 
-    if (strcmp(pkgs[i].name, pkgs[i].pkgbase) == 0) {
-      printf("==> Package '%s' cloned\n", pkgs[i].name);
-    } else {
-      printf("==> Package '%s' cloned as '%s'\n", pkgs[i].name, pkgs[i].pkgbase);
-    }
+  stats.start_us = now_us();
+  r = git_clone(&repo, url, p->pkgbase, &opts);
+  stats.end_us = now_us();
+
+  if (r == 0) {
+    report_clone(p, &stats, NULL);
+    git_repository_free(repo);
+    return;
+  }
+
+  err = giterr_last();
+  if (err)
+    snprintf(error, sizeof(error), "%d: %s", err->klass, err->message);
+  else
+    snprintf(error, sizeof(error), "%d: no detailed info", r);
+
+  report_clone(p, &stats, error);
+  fprintf(opt_output == OUTPUT_HUMAN ? stdout : stderr, "ERROR %s\n", error);
+}
+
+static int ready_for_download(aur_t *aur, aur_request_t *req, const void *response, int responselen) {
+  struct package_t *pkgs;
+  int r, c;
+
+  (void)aur; (void)responselen;
+
+  r = aur_request_get_result(req);
+  aur_request_unref(req);
+  if (r < 0) {
+    fprintf(stderr, "error: request failed: %s\n", strerror(-r));
+    ++nfailed;
+    return 0;
+  }
+
+  r = aur_packages_from_json(response, &pkgs, &c);
+  if (r < 0) {
+    fprintf(stderr, "failed to decode json\n");
+    ++nfailed;
+    return 1;
+  }
+
+  if (c == 0) {
+    fprintf(stderr, "no results found\n");
+    return 0;
   }
 
+  for (int i = 0; i < c; ++i)
+    clone_package(&pkgs[i]);
+
   aur_package_list_free(pkgs);
 
   return 0;
@@ -211,10 +856,9 @@ static int build_rpc_request_multiarg(int argc, char **argv, int method, aur_req
 
   done_cb = get_callback_for_method(method);
 
-  r = malloc(1 * sizeof(aur_request_t*));
+  r = malloc(argc * sizeof(aur_request_t*));
   if (r == NULL)
     return -ENOMEM;
-
   if (aur_request_new(&r[0], method, done_cb) < 0)
     return -ENOMEM;
 
@@ -233,11 +877,10 @@ static int build_rpc_request_singlearg(int argc, char **argv, int method, aur_re
 
   done_cb = get_callback_for_method(method);
 
-  r = malloc(1 * sizeof(aur_request_t*));
+  r = malloc(argc * sizeof(aur_request_t*));
   if (r == NULL)
     return -ENOMEM;
 
-
   for (int i = 0; i < argc; ++i) {
     if (aur_request_new(&r[i], method, done_cb) < 0)
       return -ENOMEM;
@@ -265,10 +908,98 @@ static int build_requests(int argc, char **argv, int method, aur_request_t ***_r
     return build_rpc_requests(argc, argv, method, _r, rc);
 }
 
+/* One multiinfo request per batch of installed packages, as many to a
+ * batch as fit in a request line. */
+static int build_outdated_requests(aur_request_t ***_r, int *rc) {
+  aur_request_t **r;
+  size_t len = 0;
+  int n = 0;
+
+  r = malloc((n_localpkgs + 1) * sizeof(aur_request_t*));
+  if (r == NULL)
+    return -ENOMEM;
+
+  for (int i = 0; i < n_localpkgs; ++i) {
+    size_t arglen;
+
+    if (!opt_all && !localpkgs[i].foreign)
+      continue;
+
+    arglen = aur_request_arg_length(localpkgs[i].name);
+    if (n == 0 || len + arglen > AUR_MAX_QUERY_LEN) {
+      if (aur_request_new(&r[n], REQUEST_MULTIINFO, done_cb_outdated) < 0)
+        return -ENOMEM;
+      ++n;
+      len = 0;
+    }
+
+    if (aur_request_append_arg(r[n - 1], localpkgs[i].name) < 0)
+      return -ENOMEM;
+    len += arglen;
+  }
+
+  *rc = n;
+  *_r = r;
+  return 0;
+}
+
+static void print_outdated(void) {
+  for (int i = 0; i < n_localpkgs; ++i)
+    if (newer_versions[i] != NULL)
+      printf("%s %s -> %s\n", localpkgs[i].name, localpkgs[i].version, newer_versions[i]);
+}
+
+static int read_localdb(void) {
+  _cleanup_free_ char *path = NULL;
+  const char *dbpath = opt_dbpath;
+  int r;
+
+  if (dbpath == NULL) {
+    if (asprintf(&path, "%s/var/lib/pacman", opt_root) < 0)
+      return -ENOMEM;
+    dbpath = path;
+  }
+
+  r = aur_localdb_read(dbpath, &localpkgs, &n_localpkgs);
+  if (r < 0) {
+    fprintf(stderr, "error: failed to read package database %s: %s\n", dbpath, strerror(-r));
+    return r;
+  }
+
+  newer_versions = calloc(n_localpkgs, sizeof(char *));
+  if (newer_versions == NULL)
+    return -ENOMEM;
+
+  return 0;
+}
+
+/* Prints the packages the cache knows about, and drops them from argv.
+ * Returns the number of arguments left. */
+static int answer_from_cache(int argc, char **argv) {
+  int n = 0;
+
+  for (int i = 0; i < argc; ++i) {
+    struct package_t *pkgs;
+
+    if (aur_package_cache_get(pkgcache, argv[i], CACHE_MAX_AGE_S, &pkgs) < 0) {
+      argv[n++] = argv[i];
+      continue;
+    }
+
+    print_package(&pkgs[0], 0);
+    aur_package_list_free(pkgs);
+  }
+  out_flush();
+
+  return n;
+}
+
 static int queue_requests(aur_t *aur, aur_request_t **reqs, int rc) {
   for (int i = 0; i < rc; ++i) {
     int r;
 
+    aur_request_set_retry(reqs[i], 3, 250);
+
     r = aur_queue_request(aur, reqs[i]);
     if (r < 0) {
       fprintf(stderr, "error: aur_queue_request failed: %s\n", strerror(-r));
@@ -279,37 +1010,282 @@ static int queue_requests(aur_t *aur, aur_request_t **reqs, int rc) {
   return 0;
 }
 
+/* $XDG_CACHE_HOME/cow/name, creating the directory as needed */
+static char *cache_path(const char *name) {
+  const char *cache = getenv("XDG_CACHE_HOME");
+  char *dir, *path;
+
+  if (cache != NULL && *cache != '\0') {
+    if (asprintf(&dir, "%s/cow", cache) < 0)
+      return NULL;
+  } else {
+    const char *home = getenv("HOME");
+
+    if (home == NULL || asprintf(&dir, "%s/.cache/cow", home) < 0)
+      return NULL;
+  }
+
+  if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+    free(dir);
+    return NULL;
+  }
+
+  if (asprintf(&path, "%s/%s", dir, name) < 0)
+    path = NULL;
+
+  free(dir);
+  return path;
+}
+
+static void print_watch_event(aur_watch_t *watch, const struct watch_event_t *event, void *userdata) {
+  (void)watch; (void)userdata;
+
+  switch (event->type) {
+  case WATCH_ADDED:
+    printf("added %s %s\n", event->name, event->new_version);
+    break;
+  case WATCH_UPDATED:
+    printf("updated %s %s -> %s\n", event->name, event->old_version, event->new_version);
+    break;
+  case WATCH_REMOVED:
+    printf("removed %s %s\n", event->name, event->old_version);
+    break;
+  case WATCH_FAILED:
+    fprintf(stderr, "error: request failed: %s\n", strerror(-event->error));
+    break;
+  }
+}
+
+/* names from argv, or one per line on stdin for "-" */
+static int add_watch_names(aur_watch_t *watch, int argc, char **argv) {
+  for (int i = 0; i < argc; ++i) {
+    int r;
+
+    if (strcmp(argv[i], "-") == 0) {
+      _cleanup_free_ char *line = NULL;
+      size_t linelen = 0;
+
+      while (getline(&line, &linelen, stdin) > 0) {
+        line[strcspn(line, "\n")] = '\0';
+        if (*line == '\0')
+          continue;
+
+        r = aur_watch_add(watch, line);
+        if (r < 0)
+          fprintf(stderr, "warning: not watching %s: %s\n", line, strerror(-r));
+      }
+      continue;
+    }
+
+    r = aur_watch_add(watch, argv[i]);
+    if (r < 0)
+      fprintf(stderr, "warning: not watching %s: %s\n", argv[i], strerror(-r));
+  }
+
+  return 0;
+}
+
+/* Polls until killed, or once with an interval of 0. What was seen is saved
+ * after every round, so that the next run only reports what changed. */
+static int run_watch(aur_t *aur, int argc, char **argv, const char *statefile) {
+  _cleanup_free_ char *watchfile = NULL;
+  aur_watch_t *watch;
+  int r;
+
+  r = aur_watch_new(&watch, aur, print_watch_event, NULL);
+  if (r < 0)
+    return r;
+
+  add_watch_names(watch, argc, argv);
+
+  watchfile = cache_path("watch");
+  if (watchfile != NULL)
+    aur_watch_load(watch, watchfile);
+
+  for (;;) {
+    r = aur_watch_poll(watch);
+    if (r < 0)
+      break;
+
+    r = aur_run(aur);
+    if (r < 0)
+      break;
+
+    if (watchfile != NULL)
+      aur_watch_save(watch, watchfile);
+    if (statefile != NULL)
+      aur_save_state(aur, statefile);
+    fflush(stdout);
+
+    if (opt_interval == 0)
+      break;
+
+    sleep(opt_interval);
+  }
+
+  aur_watch_free(watch);
+
+  return r;
+}
+
 static void usage(FILE *stream, const char *argv0) {
-  fprintf(stream, "usage: %s action packages...\n\n", argv0);
+  fprintf(stream, "usage: %s [options] action packages...\n\n", argv0);
   fprintf(stream,
+         "Options:\n"
+         "   -h, --help            show this help\n"
+         "       --stats           print transfer statistics on exit\n"
+         "       --no-state        don't reuse or save DNS and TLS session state\n"
+         "       --no-daemon       don't ask a running cowd\n"
+         "       --cache=PATH      share package info with other processes through PATH\n"
+         "       --mirror=DOMAIN   also use DOMAIN, whichever answers faster (repeatable)\n"
+         "       --root=PATH       outdated: look for pacman's database under PATH\n"
+         "       --dbpath=PATH     outdated: read pacman's database at PATH\n"
+         "       --all             outdated: check every installed package, not only\n"
+         "                         those installed from a local file\n"
+         "       --interval=SECS   watch: poll every SECS seconds, instead of once\n"
+         "       --output=FORMAT   print packages as human (the default), ndjson or tsv,\n"
+         "                         one line each, for info, multiinfo and searches, and\n"
+         "                         what each clone transferred and took for download\n"
+         "       --no-progress     download: don't show clone progress on a terminal\n\n"
          "Actions:\n"
          "   info                  show package info\n"
          "   multiinfo             show package info\n"
-         "   search                show package search results\n"
+         "   search                show packages matching all of the search terms\n"
          "   msearch               show maintainer search results\n"
-         "   download              download packages\n");
+         "   download              download packages\n"
+         "   outdated              list installed packages with newer versions in the AUR\n"
+         "   srcinfo               show the packages built by checkouts, from their .SRCINFO\n"
+         "   watch                 report packages added to, updated in or removed from the\n"
+         "                         AUR since the last run, names read from stdin for -\n");
+}
+
+static int parse_options(int argc, char **argv) {
+  enum {
+    OPT_STATS = 1000,
+    OPT_NO_STATE,
+    OPT_NO_DAEMON,
+    OPT_CACHE,
+    OPT_MIRROR,
+    OPT_ROOT,
+    OPT_DBPATH,
+    OPT_ALL,
+    OPT_INTERVAL,
+    OPT_OUTPUT,
+    OPT_NO_PROGRESS,
+  };
+  static const struct option opts[] = {
+    { "help",   no_argument, 0, 'h' },
+    { "stats",  no_argument, 0, OPT_STATS },
+    { "no-state", no_argument, 0, OPT_NO_STATE },
+    { "no-daemon", no_argument, 0, OPT_NO_DAEMON },
+    { "cache", required_argument, 0, OPT_CACHE },
+    { "mirror", required_argument, 0, OPT_MIRROR },
+    { "root", required_argument, 0, OPT_ROOT },
+    { "dbpath", required_argument, 0, OPT_DBPATH },
+    { "all", no_argument, 0, OPT_ALL },
+    { "interval", required_argument, 0, OPT_INTERVAL },
+    { "output", required_argument, 0, OPT_OUTPUT },
+    { "no-progress", no_argument, 0, OPT_NO_PROGRESS },
+    { 0, 0, 0, 0 },
+  };
+
+  for (;;) {
+    int opt = getopt_long(argc, argv, "+h", opts, NULL);
+    if (opt < 0)
+      break;
+
+    switch (opt) {
+    case 'h':
+      usage(stdout, argv[0]);
+      exit(0);
+    case OPT_STATS:
+      opt_stats = 1;
+      break;
+    case OPT_NO_STATE:
+      opt_state = 0;
+      break;
+    case OPT_NO_DAEMON:
+      opt_daemon = 0;
+      break;
+    case OPT_CACHE:
+      opt_cache = optarg;
+      break;
+    case OPT_MIRROR:
+      if (opt_n_mirrors == ARRAYSIZE(opt_mirrors))
+        return -EINVAL;
+      opt_mirrors[opt_n_mirrors++] = optarg;
+      break;
+    case OPT_ROOT:
+      opt_root = optarg;
+      break;
+    case OPT_DBPATH:
+      opt_dbpath = optarg;
+      break;
+    case OPT_ALL:
+      opt_all = 1;
+      break;
+    case OPT_INTERVAL:
+      opt_interval = atoi(optarg);
+      if (opt_interval < 0)
+        return -EINVAL;
+      break;
+    case OPT_OUTPUT:
+      if (strcmp(optarg, "human") == 0)
+        opt_output = OUTPUT_HUMAN;
+      else if (strcmp(optarg, "ndjson") == 0)
+        opt_output = OUTPUT_NDJSON;
+      else if (strcmp(optarg, "tsv") == 0)
+        opt_output = OUTPUT_TSV;
+      else
+        return -EINVAL;
+      break;
+    case OPT_NO_PROGRESS:
+      opt_progress = 0;
+      break;
+    default:
+      return -EINVAL;
+    }
+  }
+
+  return optind;
 }
 
 int main(int argc, char **argv) {
   _cleanup_free_ aur_request_t **reqs = NULL;
+  _cleanup_free_ char *statefile = NULL;
   aur_t *aur;
-  int rc, r, t;
+  int rc, r, t, optidx, connected = 0, outdated, watch;
   git_libgit2_init();
 
-  if (argc < 3 || strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
-    usage(stdout, argv[0]);
-    return 0;
+  optidx = parse_options(argc, argv);
+  if (optidx < 0 || argc - optidx < 1) {
+    usage(stderr, argv[0]);
+    return 1;
   }
 
-  if (argc < 3) {
+  argc -= optidx - 1;
+  argv += optidx - 1;
+
+  outdated = strcmp(argv[1], "outdated") == 0;
+  if (!outdated && argc < 3) {
     usage(stderr, argv[0]);
     return 1;
   }
 
-  t = string_to_aur_request_type(argv[1]);
-  if (t < 0) {
-    fprintf(stderr, "error: unknown request type: %s\n", argv[1]);
-    return 1;
+  if (strcmp(argv[1], "srcinfo") == 0)
+    return show_srcinfo(argc - 2, argv + 2) < 0;
+
+  watch = strcmp(argv[1], "watch") == 0;
+  if (outdated || watch) {
+    t = REQUEST_MULTIINFO;
+    if (outdated && read_localdb() < 0)
+      return 1;
+  } else {
+    t = string_to_aur_request_type(argv[1]);
+    if (t < 0) {
+      fprintf(stderr, "error: unknown request type: %s\n", argv[1]);
+      return 1;
+    }
   }
 
   r = aur_new(&aur, AUR_DOMAIN, 1);
@@ -318,16 +1294,77 @@ int main(int argc, char **argv) {
     return 1;
   }
 
-  r = build_requests(argc - 2, argv + 2, t, &reqs, &rc);
-  if (r < 0) {
-    fprintf(stderr, "error: build_requests failed: %s\n", strerror(-r));
-    return 1;
+  for (int i = 0; i < opt_n_mirrors; ++i) {
+    r = aur_add_endpoint(aur, opt_mirrors[i]);
+    if (r < 0) {
+      fprintf(stderr, "error: failed to add mirror %s: %s\n", opt_mirrors[i], strerror(-r));
+      return 1;
+    }
   }
 
-  r = queue_requests(aur, reqs, rc);
-  if (r < 0) {
-    fprintf(stderr, "error: queue_requests failed: %s\n", strerror(-r));
-    return 1;
+  /* info for several packages then costs a single round trip */
+  aur_set_coalesce_window(aur, 1);
+
+  if (opt_state) {
+    statefile = cache_path("state");
+    if (statefile != NULL)
+      aur_load_state(aur, statefile);
+  }
+
+  if (opt_output == OUTPUT_TSV && !outdated && !watch)
+    out_str(t == REQUEST_DOWNLOAD ? clone_tsv_header : tsv_header);
+
+  if (t == REQUEST_DOWNLOAD && opt_progress < 0)
+    opt_progress = isatty(STDERR_FILENO);
+
+  if (opt_cache != NULL && !outdated && !watch && (t == REQUEST_INFO || t == REQUEST_MULTIINFO)) {
+    r = aur_package_cache_open(&pkgcache, opt_cache, 0);
+    if (r < 0)
+      fprintf(stderr, "warning: failed to open cache %s: %s\n", opt_cache, strerror(-r));
+    else
+      argc = 2 + answer_from_cache(argc - 2, argv + 2);
+  }
+
+  if (!outdated && argc == 2)
+    goto finish;
+
+  /* a running cowd answers queries from its cache, downloads still go
+   * over the network. watch would learn nothing from a cached answer. */
+  if (opt_daemon && !watch && aur_connect_daemon(aur, NULL) == 0)
+    connected = 1;
+
+  if (!connected || t == REQUEST_DOWNLOAD)
+    aur_prewarm(aur);
+
+  if (watch) {
+    r = run_watch(aur, argc - 2, argv + 2, statefile);
+    if (r < 0)
+      fprintf(stderr, "error: watch failed: %s\n", strerror(-r));
+    goto finish;
+  }
+
+  /* several search terms narrow the search down rather than adding up */
+  if (t == REQUEST_SEARCH && argc > 3) {
+    r = aur_search_all(aur, argv + 2, argc - 2, print_search_results, NULL);
+    if (r < 0) {
+      fprintf(stderr, "error: aur_search_all failed: %s\n", strerror(-r));
+      return 1;
+    }
+  } else {
+    if (outdated)
+      r = build_outdated_requests(&reqs, &rc);
+    else
+      r = build_requests(argc - 2, argv + 2, t, &reqs, &rc);
+    if (r < 0) {
+      fprintf(stderr, "error: build_requests failed: %s\n", strerror(-r));
+      return 1;
+    }
+
+    r = queue_requests(aur, reqs, rc);
+    if (r < 0) {
+      fprintf(stderr, "error: queue_requests failed: %s\n", strerror(-r));
+      return 1;
+    }
   }
 
   r = aur_run(aur);
@@ -336,11 +1373,31 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  if (statefile != NULL)
+    aur_save_state(aur, statefile);
+
+  if (outdated)
+    print_outdated();
+
+finish:
+  out_flush();
+  aur_package_cache_free(pkgcache);
+
+  for (int i = 0; i < n_localpkgs; ++i)
+    free(newer_versions[i]);
+  free(newer_versions);
+  aur_local_package_list_free(localpkgs);
+
+  if (opt_stats) {
+    dump_clone_totals(stderr);
+    aur_dump_stats(aur, stderr);
+  }
+
   aur_free(aur);
 
   git_libgit2_shutdown();
 
-  return 0;
+  return nfailed > 0;
 }
 
 /* vim: set et ts=2 sw=2: */
@@ -0,0 +1,667 @@
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aur.h"
+#include "macro.h"
+
+/* cowd keeps warm connections to the AUR and a cache of recent responses,
+ * and answers queries from cow (or anything else using
+ * aur_connect_daemon) over a Unix socket. Identical queries arriving while
+ * one is in flight share its answer.
+ *
+ * The cache holds the responses as the AUR sent them rather than
+ * aur_packages_serialize blobs of the decoded packages. Clients decode
+ * answers in their own done_fn, the same way as ones that came over HTTP,
+ * and a blob would have to be turned back into JSON for them; it would
+ * also lose what an answer says besides its packages, such as an RPC
+ * error. */
+
+#define DEFAULT_TTL_S 60
+#define CACHE_BUCKETS 4096
+#define MAX_CACHE_ENTRIES 16384
+
+struct client_t {
+  struct client_t *next;
+  int fd;
+  int closed;
+  int refcount;
+
+  char *in;
+  size_t in_len;
+  size_t in_cap;
+
+  char *out;
+  size_t out_len;
+  size_t out_cap;
+};
+
+struct waiter_t {
+  struct waiter_t *next;
+  struct client_t *client;
+  unsigned long long id;
+};
+
+struct entry_t {
+  struct entry_t *next;
+  char *key;
+  unsigned int hash;
+
+  /* 0 while the query is in flight */
+  uint64_t expires_us;
+  struct waiter_t *waiters;
+
+  int result;
+  int http_status;
+  aur_response_t *response;
+};
+
+static struct entry_t *cache[CACHE_BUCKETS];
+static int cache_size;
+static struct client_t *clients;
+static aur_pool_t *pool;
+
+static long opt_ttl = DEFAULT_TTL_S;
+static int opt_workers = 1;
+static char *opt_socket;
+static const char *opt_mirrors[8];
+static int opt_n_mirrors;
+
+static volatile sig_atomic_t stopping;
+
+static uint64_t now_usec(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static unsigned int hash_key(const char *key) {
+  unsigned int h = 2166136261u;
+
+  for (; *key; ++key)
+    h = (h ^ (unsigned char)*key) * 16777619u;
+
+  return h;
+}
+
+static void client_unref(struct client_t *c) {
+  if (--c->refcount > 0)
+    return;
+
+  free(c->in);
+  free(c->out);
+  free(c);
+}
+
+static void client_close(struct client_t *c) {
+  if (c->closed)
+    return;
+
+  close(c->fd);
+  c->closed = 1;
+}
+
+static int client_append(struct client_t *c, const void *data, size_t len) {
+  if (c->out_cap - c->out_len < len) {
+    size_t newcap = c->out_cap ? c->out_cap : 4096;
+    char *newalloc;
+
+    while (newcap - c->out_len < len)
+      newcap *= 2;
+
+    newalloc = realloc(c->out, newcap);
+    if (newalloc == NULL)
+      return -ENOMEM;
+
+    c->out = newalloc;
+    c->out_cap = newcap;
+  }
+
+  memcpy(&c->out[c->out_len], data, len);
+  c->out_len += len;
+
+  return 0;
+}
+
+static void client_reply(struct client_t *c, unsigned long long id, int result, int http_status,
+    aur_response_t *response) {
+  const char *body = "";
+  size_t len = 0;
+  char header[128];
+  int n;
+
+  if (c->closed)
+    return;
+
+  if (response != NULL) {
+    body = aur_response_get_data(response);
+    len = aur_response_get_size(response);
+  }
+
+  n = snprintf(header, sizeof(header), "%llu %d %d %zu\n", id, result, http_status, len);
+  if (client_append(c, header, n) < 0 || client_append(c, body, len) < 0)
+    client_close(c);
+}
+
+static void entry_free(struct entry_t *e) {
+  free(e->key);
+  aur_response_unref(e->response);
+  free(e);
+}
+
+static void cache_unlink(struct entry_t *e) {
+  struct entry_t **p = &cache[e->hash % CACHE_BUCKETS];
+
+  while (*p != e)
+    p = &(*p)->next;
+
+  *p = e->next;
+  --cache_size;
+}
+
+static struct entry_t *cache_find(const char *key, unsigned int hash) {
+  for (struct entry_t *e = cache[hash % CACHE_BUCKETS]; e; e = e->next)
+    if (e->hash == hash && strcmp(e->key, key) == 0)
+      return e;
+
+  return NULL;
+}
+
+static void cache_expire(uint64_t now) {
+  for (int i = 0; i < CACHE_BUCKETS; ++i) {
+    struct entry_t **p = &cache[i];
+
+    while (*p) {
+      struct entry_t *e = *p;
+
+      if (e->expires_us != 0 && e->expires_us <= now) {
+        *p = e->next;
+        --cache_size;
+        entry_free(e);
+      } else {
+        p = &e->next;
+      }
+    }
+  }
+}
+
+static int method_to_request_type(const char *method) {
+  if (strcmp(method, "info") == 0)
+    return REQUEST_INFO;
+  if (strcmp(method, "multiinfo") == 0)
+    return REQUEST_MULTIINFO;
+  if (strcmp(method, "search") == 0)
+    return REQUEST_SEARCH;
+  if (strcmp(method, "msearch") == 0)
+    return REQUEST_MSEARCH;
+
+  return -EINVAL;
+}
+
+static int query_done(aur_t *aur, aur_request_t *req, const void *response, int responselen) {
+  struct entry_t *e = aur_request_get_userdata(req);
+  struct waiter_t *w;
+
+  (void)aur; (void)response; (void)responselen;
+
+  /* the cache keeps the response itself rather than a copy of it */
+  e->result = aur_request_get_result(req);
+  e->http_status = aur_request_get_http_status(req);
+  e->response = aur_request_ref_response(req);
+
+  while ((w = e->waiters) != NULL) {
+    e->waiters = w->next;
+
+    client_reply(w->client, w->id, e->result, e->http_status, e->response);
+    client_unref(w->client);
+    free(w);
+  }
+
+  /* only successful answers are worth keeping */
+  if (e->result == 0 && e->http_status == 200) {
+    e->expires_us = now_usec() + (uint64_t)opt_ttl * 1000000;
+  } else {
+    cache_unlink(e);
+    entry_free(e);
+  }
+
+  aur_request_unref(req);
+
+  return 0;
+}
+
+static int submit_query(struct entry_t *e) {
+  _cleanup_free_ char *key = strdup(e->key);
+  char *method, *arg, *saveptr;
+  aur_request_t *req;
+  int type, r;
+
+  if (key == NULL)
+    return -ENOMEM;
+
+  method = strtok_r(key, "\t", &saveptr);
+  if (method == NULL)
+    return -EINVAL;
+
+  type = method_to_request_type(method);
+  if (type < 0)
+    return type;
+
+  r = aur_request_new(&req, type, query_done);
+  if (r < 0)
+    return r;
+
+  while ((arg = strtok_r(NULL, "\t", &saveptr)) != NULL) {
+    r = aur_request_append_arg(req, arg);
+    if (r < 0) {
+      aur_request_free(req);
+      return r;
+    }
+  }
+
+  aur_request_set_userdata(req, e);
+  aur_request_set_retry(req, 3, 250);
+
+  r = aur_pool_submit(pool, req);
+  if (r < 0)
+    aur_request_free(req);
+
+  return r;
+}
+
+static void handle_query(struct client_t *c, char *line) {
+  unsigned long long id;
+  struct entry_t *e;
+  struct waiter_t *w;
+  unsigned int hash;
+  char *key;
+  int r;
+
+  id = strtoull(line, &key, 10);
+  if (*key != '\t') {
+    client_close(c);
+    return;
+  }
+  ++key;
+
+  hash = hash_key(key);
+  e = cache_find(key, hash);
+
+  if (e != NULL && e->expires_us != 0 && e->expires_us <= now_usec()) {
+    cache_unlink(e);
+    entry_free(e);
+    e = NULL;
+  }
+
+  if (e != NULL && e->expires_us != 0) {
+    client_reply(c, id, e->result, e->http_status, e->response);
+    return;
+  }
+
+  w = calloc(1, sizeof(*w));
+  if (w == NULL) {
+    client_reply(c, id, -ENOMEM, 0, NULL);
+    return;
+  }
+
+  if (e == NULL) {
+    if (cache_size >= MAX_CACHE_ENTRIES)
+      cache_expire(now_usec());
+
+    e = calloc(1, sizeof(*e));
+    if (e == NULL || (e->key = strdup(key)) == NULL) {
+      free(e);
+      free(w);
+      client_reply(c, id, -ENOMEM, 0, NULL);
+      return;
+    }
+
+    e->hash = hash;
+    e->next = cache[hash % CACHE_BUCKETS];
+    cache[hash % CACHE_BUCKETS] = e;
+    ++cache_size;
+
+    r = submit_query(e);
+    if (r < 0) {
+      cache_unlink(e);
+      entry_free(e);
+      free(w);
+      client_reply(c, id, r, 0, NULL);
+      return;
+    }
+  }
+
+  w->client = c;
+  w->id = id;
+  w->next = e->waiters;
+  e->waiters = w;
+  ++c->refcount;
+}
+
+static void client_read(struct client_t *c) {
+  ssize_t n;
+  char *line, *eol;
+
+  if (c->in_cap - c->in_len < 1024) {
+    size_t newcap = c->in_cap ? c->in_cap * 2 : 4096;
+    char *newalloc = realloc(c->in, newcap);
+
+    if (newalloc == NULL) {
+      client_close(c);
+      return;
+    }
+
+    c->in = newalloc;
+    c->in_cap = newcap;
+  }
+
+  n = recv(c->fd, &c->in[c->in_len], c->in_cap - c->in_len, MSG_DONTWAIT);
+  if (n < 0 && (errno == EAGAIN || errno == EINTR))
+    return;
+  if (n <= 0) {
+    client_close(c);
+    return;
+  }
+
+  c->in_len += n;
+
+  line = c->in;
+  while (!c->closed && (eol = memchr(line, '\n', c->in_len - (line - c->in))) != NULL) {
+    *eol = '\0';
+    handle_query(c, line);
+    line = eol + 1;
+  }
+
+  if (c->closed)
+    return;
+
+  c->in_len -= line - c->in;
+  memmove(c->in, line, c->in_len);
+}
+
+static void client_write(struct client_t *c) {
+  ssize_t n;
+
+  n = send(c->fd, c->out, c->out_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+  if (n < 0) {
+    if (errno != EAGAIN && errno != EINTR)
+      client_close(c);
+    return;
+  }
+
+  c->out_len -= n;
+  memmove(c->out, &c->out[n], c->out_len);
+}
+
+static void accept_client(int listenfd) {
+  struct client_t *c;
+  int fd;
+
+  fd = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+  if (fd < 0)
+    return;
+
+  c = calloc(1, sizeof(*c));
+  if (c == NULL) {
+    close(fd);
+    return;
+  }
+
+  c->fd = fd;
+  c->refcount = 1;
+  c->next = clients;
+  clients = c;
+}
+
+static int open_socket(const char *path) {
+  union {
+    struct sockaddr sa;
+    struct sockaddr_un un;
+  } addr = { .un.sun_family = AF_UNIX };
+  mode_t mask;
+  int fd, r;
+
+  if (strlen(path) >= sizeof(addr.un.sun_path))
+    return -ENAMETOOLONG;
+  strcpy(addr.un.sun_path, path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (fd < 0)
+    return -errno;
+
+  /* a socket nobody listens on is left over from a daemon that died */
+  if (connect(fd, &addr.sa, sizeof(addr.un)) == 0) {
+    close(fd);
+    return -EADDRINUSE;
+  }
+  unlink(path);
+
+  /* only the socket is meant to be ours alone */
+  mask = umask(0077);
+  r = bind(fd, &addr.sa, sizeof(addr.un));
+  umask(mask);
+
+  if (r < 0 || listen(fd, 128) < 0) {
+    r = -errno;
+    close(fd);
+    return r;
+  }
+
+  return fd;
+}
+
+static int serve(int listenfd) {
+  _cleanup_free_ struct pollfd *pfds = NULL;
+  size_t npfds = 0;
+
+  while (!stopping) {
+    struct client_t **p;
+    size_t n = 2;
+
+    for (struct client_t *c = clients; c; c = c->next)
+      ++n;
+
+    if (n > npfds) {
+      struct pollfd *newalloc = realloc(pfds, n * sizeof(*pfds));
+      if (newalloc == NULL)
+        return -ENOMEM;
+
+      pfds = newalloc;
+      npfds = n;
+    }
+
+    pfds[0] = (struct pollfd){ .fd = listenfd, .events = POLLIN };
+    pfds[1] = (struct pollfd){ .fd = aur_pool_get_fd(pool), .events = POLLIN };
+
+    n = 2;
+    for (struct client_t *c = clients; c; c = c->next)
+      pfds[n++] = (struct pollfd){
+        .fd = c->fd,
+        .events = POLLIN | (c->out_len > 0 ? POLLOUT : 0),
+      };
+
+    if (poll(pfds, n, opt_ttl > INT_MAX / 1000 ? INT_MAX : (int)opt_ttl * 1000) < 0) {
+      if (errno == EINTR)
+        continue;
+      return -errno;
+    }
+
+    if (pfds[1].revents)
+      aur_pool_dispatch(pool);
+
+    n = 2;
+    for (struct client_t *c = clients; c; c = c->next, ++n) {
+      if (!c->closed && (pfds[n].revents & POLLOUT))
+        client_write(c);
+      if (!c->closed && (pfds[n].revents & (POLLIN | POLLHUP | POLLERR)))
+        client_read(c);
+    }
+
+    /* closed clients leave the list now, and are freed once no query
+     * of theirs is in flight any more */
+    p = &clients;
+    while (*p) {
+      struct client_t *c = *p;
+
+      if (c->closed) {
+        *p = c->next;
+        client_unref(c);
+      } else {
+        p = &c->next;
+      }
+    }
+
+    if (pfds[0].revents & POLLIN)
+      accept_client(listenfd);
+
+    cache_expire(now_usec());
+  }
+
+  return 0;
+}
+
+static void handle_signal(int sig) {
+  (void)sig;
+  stopping = 1;
+}
+
+static void usage(FILE *stream, const char *argv0) {
+  fprintf(stream, "usage: %s [options]\n\n", argv0);
+  fprintf(stream,
+         "Options:\n"
+         "   -h, --help            show this help\n"
+         "   -m, --mirror=DOMAIN   also use DOMAIN, whichever answers faster\n"
+         "   -s, --socket=PATH     listen on PATH\n"
+         "   -t, --ttl=SECONDS     keep responses for SECONDS (default: %d)\n"
+         "   -w, --workers=N       use N network threads (default: 1)\n",
+         DEFAULT_TTL_S);
+}
+
+static int parse_options(int argc, char **argv) {
+  static const struct option opts[] = {
+    { "help",     no_argument,       0, 'h' },
+    { "mirror",   required_argument, 0, 'm' },
+    { "socket",   required_argument, 0, 's' },
+    { "ttl",      required_argument, 0, 't' },
+    { "workers",  required_argument, 0, 'w' },
+    { 0, 0, 0, 0 },
+  };
+
+  for (;;) {
+    int opt = getopt_long(argc, argv, "hm:s:t:w:", opts, NULL);
+    if (opt < 0)
+      break;
+
+    switch (opt) {
+    case 'h':
+      usage(stdout, argv[0]);
+      exit(0);
+    case 'm':
+      if (opt_n_mirrors == ARRAYSIZE(opt_mirrors))
+        return -EINVAL;
+      opt_mirrors[opt_n_mirrors++] = optarg;
+      break;
+    case 's':
+      opt_socket = optarg;
+      break;
+    case 't':
+      opt_ttl = strtol(optarg, NULL, 10);
+      if (opt_ttl <= 0)
+        return -EINVAL;
+      break;
+    case 'w':
+      opt_workers = strtol(optarg, NULL, 10);
+      if (opt_workers <= 0)
+        return -EINVAL;
+      break;
+    default:
+      return -EINVAL;
+    }
+  }
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  _cleanup_free_ char *defpath = NULL;
+  struct sigaction sa = { .sa_handler = handle_signal };
+  int listenfd, r;
+
+  if (parse_options(argc, argv) < 0) {
+    usage(stderr, argv[0]);
+    return 1;
+  }
+
+  if (opt_socket == NULL) {
+    opt_socket = defpath = aur_daemon_socket_path();
+    if (opt_socket == NULL) {
+      fprintf(stderr, "error: no place for the socket: %s\n", strerror(errno));
+      return 1;
+    }
+  }
+
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  r = aur_pool_new(&pool, AUR_DOMAIN, 1, opt_workers, POOL_COMPLETE_ON_DISPATCH);
+  if (r < 0) {
+    fprintf(stderr, "error: aur_pool_new failed: %s\n", strerror(-r));
+    return 1;
+  }
+
+  for (int i = 0; i < aur_pool_get_worker_count(pool); ++i) {
+    aur_t *aur = aur_pool_get_worker(pool, i);
+
+    for (int m = 0; m < opt_n_mirrors; ++m) {
+      r = aur_add_endpoint(aur, opt_mirrors[m]);
+      if (r < 0) {
+        fprintf(stderr, "error: failed to add mirror %s: %s\n", opt_mirrors[m], strerror(-r));
+        aur_pool_free(pool);
+        return 1;
+      }
+    }
+
+    /* separate cow processes asking for one package each end up here */
+    aur_set_coalesce_window(aur, 2);
+    aur_prewarm(aur);
+  }
+
+  r = aur_pool_start(pool);
+  if (r < 0) {
+    fprintf(stderr, "error: aur_pool_start failed: %s\n", strerror(-r));
+    return 1;
+  }
+
+  listenfd = open_socket(opt_socket);
+  if (listenfd < 0) {
+    fprintf(stderr, "error: failed to listen on %s: %s\n", opt_socket, strerror(-listenfd));
+    aur_pool_free(pool);
+    return 1;
+  }
+
+  r = serve(listenfd);
+  if (r < 0)
+    fprintf(stderr, "error: %s\n", strerror(-r));
+
+  close(listenfd);
+  unlink(opt_socket);
+
+  aur_pool_free(pool);
+
+  return r < 0;
+}
+
+/* vim: set et ts=2 sw=2: */
@@ -0,0 +1,356 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aur-internal.h"
+#include "macro.h"
+
+/* Dependency strings (name, name>=1.2, "name: why" for optdepends) parsed
+ * once into a struct dependency_t: the name interned to a small integer,
+ * the operator, and the version as a key as aur_packages_sort_by_version
+ * uses them. Matching a dependency against what a package provides then
+ * compares integers, and only looks at the keys for versioned ones.
+ *
+ * Ids are handed out densely from 0, so they can index arrays. */
+
+/* keys[0] is never a key, so that version 0 can mean none */
+#define NO_VERSION 0
+
+struct aur_dep_table_t {
+  /* interned names, NUL terminated, at names + offsets[id] */
+  char *names;
+  size_t names_len;
+  size_t names_cap;
+  uint32_t *offsets;
+  uint32_t count;
+  uint32_t offsets_cap;
+
+  /* open addressing, id + 1 or 0 for an empty slot */
+  uint32_t *slots;
+  uint32_t nslots;
+
+  uint8_t *keys;
+  size_t keys_len;
+  size_t keys_cap;
+};
+
+static uint32_t name_hash(const char *s, size_t len) {
+  uint32_t h = 2166136261u;
+
+  for (size_t i = 0; i < len; ++i) {
+    h ^= (unsigned char)s[i];
+    h *= 16777619u;
+  }
+
+  return h;
+}
+
+int aur_dep_table_new(aur_dep_table_t **ret) {
+  aur_dep_table_t *t;
+
+  t = calloc(1, sizeof(*t));
+  if (t == NULL)
+    return -ENOMEM;
+
+  t->nslots = 256;
+  t->slots = calloc(t->nslots, sizeof(uint32_t));
+  t->keys_cap = 4096;
+  t->keys = malloc(t->keys_cap);
+  if (t->slots == NULL || t->keys == NULL) {
+    aur_dep_table_free(t);
+    return -ENOMEM;
+  }
+  t->keys_len = 1;
+
+  *ret = t;
+  return 0;
+}
+
+void aur_dep_table_free(aur_dep_table_t *table) {
+  if (table == NULL)
+    return;
+
+  free(table->names);
+  free(table->offsets);
+  free(table->slots);
+  free(table->keys);
+  free(table);
+}
+
+static uint32_t *find_slot(const aur_dep_table_t *t, const char *name, size_t len) {
+  uint32_t mask = t->nslots - 1;
+
+  for (uint32_t i = name_hash(name, len) & mask;; i = (i + 1) & mask) {
+    const char *n;
+
+    if (t->slots[i] == 0)
+      return &t->slots[i];
+
+    n = t->names + t->offsets[t->slots[i] - 1];
+    if (strncmp(n, name, len) == 0 && n[len] == '\0')
+      return &t->slots[i];
+  }
+}
+
+static int grow_slots(aur_dep_table_t *t) {
+  uint32_t *old = t->slots, oldn = t->nslots;
+
+  t->nslots *= 2;
+  t->slots = calloc(t->nslots, sizeof(uint32_t));
+  if (t->slots == NULL) {
+    t->slots = old;
+    t->nslots = oldn;
+    return -ENOMEM;
+  }
+
+  for (uint32_t i = 0; i < oldn; ++i) {
+    const char *n;
+
+    if (old[i] == 0)
+      continue;
+
+    n = t->names + t->offsets[old[i] - 1];
+    *find_slot(t, n, strlen(n)) = old[i];
+  }
+
+  free(old);
+  return 0;
+}
+
+static int intern(aur_dep_table_t *t, const char *name, size_t len) {
+  uint32_t *slot;
+
+  slot = find_slot(t, name, len);
+  if (*slot != 0)
+    return *slot - 1;
+
+  if (t->count >= INT32_MAX)
+    return -E2BIG;
+
+  if (t->names_len + len + 1 > t->names_cap) {
+    size_t cap = t->names_cap ? t->names_cap * 2 : 4096;
+    char *newalloc;
+
+    while (cap < t->names_len + len + 1)
+      cap *= 2;
+
+    newalloc = realloc(t->names, cap);
+    if (newalloc == NULL)
+      return -ENOMEM;
+    t->names = newalloc;
+    t->names_cap = cap;
+  }
+
+  if (t->count == t->offsets_cap) {
+    uint32_t cap = t->offsets_cap ? t->offsets_cap * 2 : 256;
+    uint32_t *newalloc = realloc(t->offsets, cap * sizeof(uint32_t));
+
+    if (newalloc == NULL)
+      return -ENOMEM;
+    t->offsets = newalloc;
+    t->offsets_cap = cap;
+  }
+
+  memcpy(t->names + t->names_len, name, len);
+  t->names[t->names_len + len] = '\0';
+  t->offsets[t->count] = t->names_len;
+  t->names_len += len + 1;
+  *slot = ++t->count;
+
+  /* keep the table at most half full */
+  if (t->count * 2 > t->nslots && grow_slots(t) < 0)
+    return -ENOMEM;
+
+  return t->count - 1;
+}
+
+/* Returns the id of name, making one up if it's new. */
+int aur_dep_table_intern(aur_dep_table_t *table, const char *name) {
+  return intern(table, name, strlen(name));
+}
+
+/* Returns the id of name, or -ENOENT if it was never interned. */
+int aur_dep_table_lookup(const aur_dep_table_t *table, const char *name) {
+  uint32_t slot = *find_slot(table, name, strlen(name));
+
+  return slot ? (int)slot - 1 : -ENOENT;
+}
+
+const char *aur_dep_table_get_name(const aur_dep_table_t *table, int id) {
+  if (id < 0 || (uint32_t)id >= table->count)
+    return NULL;
+
+  return table->names + table->offsets[id];
+}
+
+int aur_dep_table_get_count(const aur_dep_table_t *table) {
+  return table->count;
+}
+
+static int add_version_key(aur_dep_table_t *t, const char *version, size_t len, uint32_t *offset) {
+  size_t bound = version_key_bound_internal(len);
+  uint8_t *end;
+
+  if (t->keys_len + bound > t->keys_cap) {
+    size_t cap = t->keys_cap * 2;
+    uint8_t *newalloc;
+
+    while (cap < t->keys_len + bound)
+      cap *= 2;
+
+    if (cap > UINT32_MAX)
+      return -E2BIG;
+
+    newalloc = realloc(t->keys, cap);
+    if (newalloc == NULL)
+      return -ENOMEM;
+    t->keys = newalloc;
+    t->keys_cap = cap;
+  }
+
+  end = version_key_encode_internal(t->keys + t->keys_len, version, len);
+  *offset = t->keys_len;
+  t->keys_len = end - t->keys;
+
+  return 0;
+}
+
+/* Parses a depends, provides or optdepends entry. */
+int aur_dep_table_parse(aur_dep_table_t *table, const char *depstring, struct dependency_t *dep) {
+  const char *end, *op;
+  int id, r;
+
+  /* optdepends explain themselves after a colon */
+  end = strstr(depstring, ": ");
+  if (end == NULL)
+    end = depstring + strlen(depstring);
+
+  op = depstring;
+  while (op < end && *op != '<' && *op != '>' && *op != '=')
+    ++op;
+
+  if (op == depstring)
+    return -EINVAL;
+
+  id = intern(table, depstring, op - depstring);
+  if (id < 0)
+    return id;
+
+  dep->name = id;
+  dep->version = NO_VERSION;
+
+  if (op == end) {
+    dep->op = DEP_ANY;
+    return 0;
+  }
+
+  if (op[0] == '=') {
+    dep->op = DEP_EQ;
+    op += 1;
+  } else if (op[1] == '=') {
+    dep->op = op[0] == '<' ? DEP_LE : DEP_GE;
+    op += 2;
+  } else {
+    dep->op = op[0] == '<' ? DEP_LT : DEP_GT;
+    op += 1;
+  }
+
+  if (op >= end)
+    return -EINVAL;
+
+  r = add_version_key(table, op, end - op, &dep->version);
+  if (r < 0)
+    return r;
+
+  return 0;
+}
+
+/* Parses every entry of list (which may be NULL) into *deps, an array to
+ * be freed with free(). */
+int aur_dep_table_parse_list(aur_dep_table_t *table, char *const *list, struct dependency_t **deps, int *count) {
+  struct dependency_t *d;
+  int n = 0;
+
+  if (list != NULL)
+    while (list[n] != NULL)
+      ++n;
+
+  d = malloc((n ? n : 1) * sizeof(struct dependency_t));
+  if (d == NULL)
+    return -ENOMEM;
+
+  for (int i = 0; i < n; ++i) {
+    int r = aur_dep_table_parse(table, list[i], &d[i]);
+    if (r < 0) {
+      free(d);
+      return r;
+    }
+  }
+
+  *deps = d;
+  *count = n;
+  return 0;
+}
+
+/* What a package is as a provider of itself: its name at its version. */
+int aur_dep_table_package(aur_dep_table_t *table, const struct package_t *package, struct dependency_t *dep) {
+  int id, r;
+
+  if (package->name == NULL)
+    return -EINVAL;
+
+  id = intern(table, package->name, strlen(package->name));
+  if (id < 0)
+    return id;
+
+  dep->name = id;
+  dep->op = DEP_ANY;
+  dep->version = NO_VERSION;
+
+  if (package->version == NULL)
+    return 0;
+
+  r = add_version_key(table, package->version, strlen(package->version), &dep->version);
+  if (r < 0)
+    return r;
+
+  dep->op = DEP_EQ;
+  return 0;
+}
+
+/* Whether provider, a package or one of its provides entries, satisfies
+ * dep. Like pacman, a versioned dependency is only satisfied by a
+ * provider that states its version. */
+int aur_dep_table_satisfies(const aur_dep_table_t *table, const struct dependency_t *dep,
+    const struct dependency_t *provider) {
+  int c;
+
+  if (dep->name != provider->name)
+    return 0;
+
+  if (dep->op == DEP_ANY)
+    return 1;
+
+  if (provider->op != DEP_EQ)
+    return 0;
+
+  c = version_key_cmp_internal(table->keys + provider->version, table->keys + dep->version);
+
+  switch (dep->op) {
+  case DEP_EQ:
+    return c == 0;
+  case DEP_LT:
+    return c < 0;
+  case DEP_LE:
+    return c <= 0;
+  case DEP_GT:
+    return c > 0;
+  case DEP_GE:
+    return c >= 0;
+  default:
+    return 0;
+  }
+}
+
+/* vim: set et ts=2 sw=2: */
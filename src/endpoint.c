@@ -0,0 +1,109 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aur-internal.h"
+
+/* Endpoints are interchangeable hosts serving the same RPC interface and
+ * package snapshots. Each keeps an EWMA of time to first byte and of its
+ * error rate, and a transfer goes to whichever endpoint currently promises
+ * the quickest answer. An endpoint that has never been tried, or hasn't
+ * been tried for a while, is probed with the next request so that one
+ * bad stretch doesn't exile it for good. */
+
+#define PROBE_INTERVAL_US (30 * 1000000ULL)
+
+/* an endpoint failing every other transfer looks five times slower */
+#define ERROR_PENALTY 8
+
+/* Adds a mirror of the endpoint passed to aur_new, reached over the same
+ * protocol. Returns its index. */
+int aur_add_endpoint(aur_t *aur, const char *domainname) {
+  struct endpoint_t *e;
+
+  if (aur->n_endpoints == MAX_ENDPOINTS)
+    return -ENOSPC;
+
+  e = &aur->endpoints[aur->n_endpoints];
+  memset(e, 0, sizeof(*e));
+
+  e->domainname = strdup(domainname);
+  if (e->domainname == NULL)
+    return -ENOMEM;
+
+  return aur->n_endpoints++;
+}
+
+void endpoint_free_internal(aur_t *aur) {
+  for (int i = 0; i < aur->n_endpoints; ++i)
+    free(aur->endpoints[i].domainname);
+  aur->n_endpoints = 0;
+}
+
+static uint64_t endpoint_score(const struct endpoint_t *e, uint64_t now) {
+  if (e->used_us == 0)
+    return 0;
+
+  if (now - e->used_us > PROBE_INTERVAL_US)
+    return 0;
+
+  /* the first transfer is still on its way */
+  if (e->latency_ewma_us == 0)
+    return UINT64_MAX - 1;
+
+  return e->latency_ewma_us * (1 + ERROR_PENALTY * e->error_ewma);
+}
+
+/* The endpoint the next transfer should go to, avoiding those in exclude
+ * unless that rules out all of them. */
+int endpoint_pick_internal(aur_t *aur, uint32_t exclude, uint64_t now) {
+  uint64_t best_score = UINT64_MAX;
+  int best = -1;
+
+  for (int i = 0; i < aur->n_endpoints; ++i) {
+    uint64_t score;
+
+    if (exclude & (1u << i))
+      continue;
+
+    score = endpoint_score(&aur->endpoints[i], now);
+    if (score < best_score) {
+      best_score = score;
+      best = i;
+    }
+  }
+
+  if (best < 0)
+    return exclude ? endpoint_pick_internal(aur, 0, now) : -ENOENT;
+
+  aur->endpoints[best].used_us = now;
+
+  return best;
+}
+
+void endpoint_complete_internal(aur_t *aur, int endpoint, uint64_t latency_us, int failed) {
+  struct endpoint_t *e;
+
+  if (endpoint < 0 || endpoint >= aur->n_endpoints)
+    return;
+
+  e = &aur->endpoints[endpoint];
+
+  ++e->transfers;
+  if (failed)
+    ++e->failures;
+
+  e->error_ewma = e->error_ewma * 0.8 + (failed ? 0.2 : 0);
+
+  /* a refused connection says nothing about how fast answers are */
+  if (failed && latency_us == 0)
+    return;
+
+  if (e->latency_ewma_us == 0)
+    e->latency_ewma_us = latency_us ? latency_us : 1;
+  else
+    e->latency_ewma_us = (e->latency_ewma_us * 7 + latency_us) / 8;
+}
+
+/* vim: set et ts=2 sw=2: */
@@ -0,0 +1,299 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "aur-internal.h"
+
+/* pacman's local database: one directory per installed package under
+ * <dbpath>/local, its metadata in a desc file made of sections like
+ *
+ *   %NAME%
+ *   foo
+ *
+ * That's a couple of thousand small files on a typical system, so a few
+ * threads read them at once, each mapping its files instead of copying
+ * them in. */
+
+#define MAX_THREADS 8
+#define ENTRIES_PER_THREAD 64
+
+struct scan_t {
+  int dirfd;
+  char **entries;
+  int nentries;
+  struct local_package_t *packages;
+
+  int next;
+  int error;
+};
+
+/* Finds the first line of a %SECTION% in desc, which is all we need. */
+static int desc_field(const char *desc, size_t len, const char *section, const char **value, size_t *vlen) {
+  size_t slen = strlen(section);
+  const char *p = desc, *end = desc + len;
+
+  while (p < end) {
+    const char *eol = memchr(p, '\n', end - p);
+    if (eol == NULL)
+      eol = end;
+
+    if ((size_t)(eol - p) == slen && memcmp(p, section, slen) == 0) {
+      const char *v = eol + 1, *veol;
+
+      if (v >= end)
+        return -ENOENT;
+
+      veol = memchr(v, '\n', end - v);
+      if (veol == NULL)
+        veol = end;
+
+      *value = v;
+      *vlen = veol - v;
+      return 0;
+    }
+
+    p = eol + 1;
+  }
+
+  return -ENOENT;
+}
+
+static int read_desc(int dirfd, const char *entry, struct local_package_t *package) {
+  _cleanup_free_ char *path = NULL;
+  const char *value;
+  struct stat st;
+  size_t vlen;
+  char *desc;
+  int fd, r = 0;
+
+  if (asprintf(&path, "%s/desc", entry) < 0)
+    return -ENOMEM;
+
+  fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -errno;
+
+  if (fstat(fd, &st) < 0) {
+    r = -errno;
+    close(fd);
+    return r;
+  }
+
+  if (st.st_size == 0) {
+    close(fd);
+    return -EBADMSG;
+  }
+
+  desc = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (desc == MAP_FAILED)
+    return -errno;
+
+  if (desc_field(desc, st.st_size, "%NAME%", &value, &vlen) < 0) {
+    r = -EBADMSG;
+    goto finish;
+  }
+  package->name = strndup(value, vlen);
+
+  if (desc_field(desc, st.st_size, "%VERSION%", &value, &vlen) < 0) {
+    r = -EBADMSG;
+    goto finish;
+  }
+  package->version = strndup(value, vlen);
+
+  if (package->name == NULL || package->version == NULL) {
+    r = -ENOMEM;
+    goto finish;
+  }
+
+  /* Packages that came from a sync repository were checked against its
+   * checksums or signatures. What was installed from a file built locally
+   * wasn't. */
+  if (desc_field(desc, st.st_size, "%VALIDATION%", &value, &vlen) < 0)
+    package->foreign = 1;
+  else
+    package->foreign = vlen == 4 && memcmp(value, "none", 4) == 0;
+
+finish:
+  munmap(desc, st.st_size);
+
+  return r;
+}
+
+static void *scan_worker(void *userdata) {
+  struct scan_t *scan = userdata;
+
+  for (;;) {
+    int i = __atomic_fetch_add(&scan->next, 1, __ATOMIC_RELAXED);
+    int r;
+
+    if (i >= scan->nentries)
+      break;
+
+    r = read_desc(scan->dirfd, scan->entries[i], &scan->packages[i]);
+
+    /* a package without a readable desc is left out, it's most likely
+     * being installed or removed right now */
+    if (r == -ENOMEM)
+      __atomic_store_n(&scan->error, r, __ATOMIC_RELAXED);
+  }
+
+  return NULL;
+}
+
+static int list_entries(int dirfd, char ***ret, int *count) {
+  _cleanup_free_ char **entries = NULL;
+  struct dirent *ent;
+  int n = 0, cap = 0, fd;
+  DIR *dir;
+
+  fd = dup(dirfd);
+  if (fd < 0)
+    return -errno;
+
+  dir = fdopendir(fd);
+  if (dir == NULL) {
+    close(fd);
+    return -errno;
+  }
+
+  while ((ent = readdir(dir)) != NULL) {
+    if (ent->d_name[0] == '.')
+      continue;
+
+    /* there's an ALPM_DB_VERSION file next to the packages */
+    if (ent->d_type != DT_DIR && ent->d_type != DT_UNKNOWN)
+      continue;
+
+    if (n == cap) {
+      char **newalloc;
+
+      cap = cap ? cap * 2 : 256;
+      newalloc = realloc(entries, cap * sizeof(char *));
+      if (newalloc == NULL)
+        goto oom;
+      entries = newalloc;
+    }
+
+    entries[n] = strdup(ent->d_name);
+    if (entries[n] == NULL)
+      goto oom;
+    ++n;
+  }
+
+  closedir(dir);
+
+  *ret = entries;
+  *count = n;
+  entries = NULL;
+
+  return 0;
+
+oom:
+  closedir(dir);
+  for (int i = 0; i < n; ++i)
+    free(entries[i]);
+  return -ENOMEM;
+}
+
+static int local_package_cmp(const void *a, const void *b) {
+  const struct local_package_t *p = a, *q = b;
+
+  return strcmp(p->name, q->name);
+}
+
+/* Reads the packages installed according to the pacman database at dbpath,
+ * usually /var/lib/pacman. *packages is sorted by name, and ends in an
+ * entry without a name. */
+int aur_localdb_read(const char *dbpath, struct local_package_t **packages, int *count) {
+  struct scan_t scan = { .dirfd = -1 };
+  pthread_t threads[MAX_THREADS];
+  _cleanup_free_ char *path = NULL;
+  int nthreads, started = 0, n = 0, r = 0;
+
+  if (asprintf(&path, "%s/local", dbpath) < 0)
+    return -ENOMEM;
+
+  scan.dirfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (scan.dirfd < 0)
+    return -errno;
+
+  r = list_entries(scan.dirfd, &scan.entries, &scan.nentries);
+  if (r < 0)
+    goto finish;
+
+  scan.packages = calloc(scan.nentries + 1, sizeof(struct local_package_t));
+  if (scan.packages == NULL) {
+    r = -ENOMEM;
+    goto finish;
+  }
+
+  nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads > MAX_THREADS)
+    nthreads = MAX_THREADS;
+  if (nthreads > scan.nentries / ENTRIES_PER_THREAD)
+    nthreads = scan.nentries / ENTRIES_PER_THREAD;
+
+  /* this thread does its share too */
+  for (; started < nthreads - 1; ++started)
+    if (pthread_create(&threads[started], NULL, scan_worker, &scan) != 0)
+      break;
+
+  scan_worker(&scan);
+
+  for (int i = 0; i < started; ++i)
+    pthread_join(threads[i], NULL);
+
+  r = scan.error;
+
+  /* squeeze out the entries that couldn't be read */
+  for (int i = 0; i < scan.nentries; ++i) {
+    if (scan.packages[i].name == NULL || scan.packages[i].version == NULL) {
+      free(scan.packages[i].name);
+      free(scan.packages[i].version);
+      continue;
+    }
+
+    scan.packages[n++] = scan.packages[i];
+  }
+  memset(&scan.packages[n], 0, sizeof(struct local_package_t));
+
+  if (r < 0) {
+    aur_local_package_list_free(scan.packages);
+    goto finish;
+  }
+
+  qsort(scan.packages, n, sizeof(struct local_package_t), local_package_cmp);
+
+  *packages = scan.packages;
+  *count = n;
+
+finish:
+  for (int i = 0; i < scan.nentries; ++i)
+    free(scan.entries[i]);
+  free(scan.entries);
+  close(scan.dirfd);
+
+  return r;
+}
+
+void aur_local_package_list_free(struct local_package_t *packages) {
+  if (packages == NULL)
+    return;
+
+  for (struct local_package_t *p = packages; p->name; ++p) {
+    free(p->name);
+    free(p->version);
+  }
+
+  free(packages);
+}
+
+/* vim: set et ts=2 sw=2: */
@@ -9,5 +9,9 @@ static inline void freep(void *p) { free(*(void **)p); }
 
 #define ARRAYSIZE(x) (sizeof(x)/sizeof(x[0]))
 
+#define SWAP(a, b) do { __typeof__(a) _t = (a); (a) = (b); (b) = _t; } while (0)
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
 #endif  /* _MACRO_H */
 
@@ -0,0 +1,165 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "aur-internal.h"
+
+/* Log-linear buckets: values below 2^HISTOGRAM_SUB_BITS get a bucket each,
+ * every power of two above that is split into 2^HISTOGRAM_SUB_BITS linear
+ * buckets. That bounds the relative error of a reported percentile to
+ * 1/2^HISTOGRAM_SUB_BITS while the whole uint64_t range fits in a few
+ * hundred counters. */
+
+static int histogram_bucket(uint64_t v) {
+  int msb;
+
+  if (v < (1 << HISTOGRAM_SUB_BITS))
+    return v;
+
+  msb = 63 - __builtin_clzll(v);
+
+  return ((msb - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS) +
+    ((v >> (msb - HISTOGRAM_SUB_BITS)) & ((1 << HISTOGRAM_SUB_BITS) - 1));
+}
+
+/* largest value that falls into bucket i */
+static uint64_t histogram_bucket_upper(int i) {
+  int msb, sub;
+
+  if (i < (1 << HISTOGRAM_SUB_BITS))
+    return i;
+
+  msb = (i >> HISTOGRAM_SUB_BITS) + HISTOGRAM_SUB_BITS - 1;
+  sub = i & ((1 << HISTOGRAM_SUB_BITS) - 1);
+
+  return (((uint64_t)((1 << HISTOGRAM_SUB_BITS) + sub + 1)) << (msb - HISTOGRAM_SUB_BITS)) - 1;
+}
+
+void histogram_record(struct histogram_t *h, uint64_t v) {
+  ++h->counts[histogram_bucket(v)];
+
+  if (h->count == 0 || v < h->min)
+    h->min = v;
+  if (v > h->max)
+    h->max = v;
+
+  ++h->count;
+  h->sum += v;
+}
+
+uint64_t histogram_percentile(const struct histogram_t *h, double percentile) {
+  uint64_t rank, seen = 0;
+
+  if (h->count == 0)
+    return 0;
+
+  if (percentile <= 0)
+    return h->min;
+
+  rank = (uint64_t)(percentile / 100.0 * h->count + 0.5);
+  if (rank == 0)
+    rank = 1;
+
+  for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+    seen += h->counts[i];
+    if (seen >= rank) {
+      uint64_t upper = histogram_bucket_upper(i);
+      return upper < h->max ? upper : h->max;
+    }
+  }
+
+  return h->max;
+}
+
+static const char *metric_name(int metric) {
+  switch (metric) {
+  case METRIC_NAMELOOKUP:
+    return "namelookup";
+  case METRIC_CONNECT:
+    return "connect";
+  case METRIC_APPCONNECT:
+    return "tls";
+  case METRIC_STARTTRANSFER:
+    return "ttfb";
+  case METRIC_TOTAL:
+    return "total";
+  case METRIC_DECODE:
+    return "decode";
+  case METRIC_BYTES:
+    return "bytes";
+  default:
+    return "invalid";
+  }
+}
+
+void metrics_record_request(aur_t *aur, const struct request_timing_t *t) {
+  histogram_record(&aur->metrics[METRIC_NAMELOOKUP], t->namelookup_us);
+  histogram_record(&aur->metrics[METRIC_CONNECT], t->connect_us);
+  histogram_record(&aur->metrics[METRIC_APPCONNECT], t->appconnect_us);
+  histogram_record(&aur->metrics[METRIC_STARTTRANSFER], t->starttransfer_us);
+  histogram_record(&aur->metrics[METRIC_TOTAL], t->total_us);
+  histogram_record(&aur->metrics[METRIC_DECODE], t->decode_us);
+  histogram_record(&aur->metrics[METRIC_BYTES], t->bytes);
+}
+
+int aur_get_metric(aur_t *aur, int metric, struct metric_summary_t *summary) {
+  const struct histogram_t *h;
+
+  if (metric < 0 || metric >= _METRIC_MAX)
+    return -EINVAL;
+
+  h = &aur->metrics[metric];
+
+  summary->count = h->count;
+  summary->sum = h->sum;
+  summary->min = h->min;
+  summary->max = h->max;
+  summary->p50 = histogram_percentile(h, 50);
+  summary->p95 = histogram_percentile(h, 95);
+  summary->p99 = histogram_percentile(h, 99);
+
+  return 0;
+}
+
+int aur_get_metric_percentile(aur_t *aur, int metric, double percentile, uint64_t *value) {
+  if (metric < 0 || metric >= _METRIC_MAX || percentile < 0 || percentile > 100)
+    return -EINVAL;
+
+  *value = histogram_percentile(&aur->metrics[metric], percentile);
+  return 0;
+}
+
+void aur_dump_stats(aur_t *aur, FILE *stream) {
+  fprintf(stream, "%-12s %8s %12s %12s %12s %12s\n",
+      "metric", "count", "p50", "p95", "p99", "max");
+
+  for (int m = 0; m < _METRIC_MAX; ++m) {
+    struct metric_summary_t s;
+
+    aur_get_metric(aur, m, &s);
+
+    if (m == METRIC_BYTES)
+      fprintf(stream, "%-12s %8" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 "\n",
+          metric_name(m), s.count, s.p50, s.p95, s.p99, s.max);
+    else
+      fprintf(stream, "%-12s %8" PRIu64 " %10.3fms %10.3fms %10.3fms %10.3fms\n",
+          metric_name(m), s.count, s.p50 / 1000.0, s.p95 / 1000.0, s.p99 / 1000.0, s.max / 1000.0);
+  }
+
+  if (aur->n_endpoints < 2)
+    return;
+
+  fprintf(stream, "\n%-24s %8s %8s %12s %8s\n",
+      "endpoint", "count", "failed", "latency", "errors");
+
+  for (int i = 0; i < aur->n_endpoints; ++i) {
+    const struct endpoint_t *e = &aur->endpoints[i];
+
+    fprintf(stream, "%-24s %8" PRIu64 " %8" PRIu64 " %10.3fms %7.1f%%\n",
+        e->domainname, e->transfers, e->failures, e->latency_ewma_us / 1000.0, e->error_ewma * 100);
+  }
+}
+
+/* vim: set et ts=2 sw=2: */
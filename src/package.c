@@ -15,6 +15,34 @@
 static char const g_digits[] = "0123456789";
 static char const g_printf_flags[] = "'-+ #0I";
 
+const struct field_descriptor_t package_fields[] = {
+  [PACKAGE_FIELD_NAME]          = { offsetof(struct package_t, name),         sizeof(char *) },
+  [PACKAGE_FIELD_DESCRIPTION]   = { offsetof(struct package_t, description),  sizeof(char *) },
+  [PACKAGE_FIELD_MAINTAINER]    = { offsetof(struct package_t, maintainer),   sizeof(char *) },
+  [PACKAGE_FIELD_PKGBASE]       = { offsetof(struct package_t, pkgbase),      sizeof(char *) },
+  [PACKAGE_FIELD_UPSTREAM_URL]  = { offsetof(struct package_t, upstream_url), sizeof(char *) },
+  [PACKAGE_FIELD_AUR_URLPATH]   = { offsetof(struct package_t, aur_urlpath),  sizeof(char *) },
+  [PACKAGE_FIELD_VERSION]       = { offsetof(struct package_t, version),      sizeof(char *) },
+
+  [PACKAGE_FIELD_CATEGORY_ID]   = { offsetof(struct package_t, category_id),  sizeof(int) },
+  [PACKAGE_FIELD_PACKAGE_ID]    = { offsetof(struct package_t, package_id),   sizeof(int) },
+  [PACKAGE_FIELD_PKGBASEID]     = { offsetof(struct package_t, pkgbaseid),    sizeof(int) },
+  [PACKAGE_FIELD_OUT_OF_DATE]   = { offsetof(struct package_t, out_of_date),  sizeof(int) },
+  [PACKAGE_FIELD_VOTES]         = { offsetof(struct package_t, votes),        sizeof(int) },
+  [PACKAGE_FIELD_SUBMITTED]     = { offsetof(struct package_t, submitted_s),  sizeof(time_t) },
+  [PACKAGE_FIELD_MODIFIED]      = { offsetof(struct package_t, modified_s),   sizeof(time_t) },
+
+  [PACKAGE_FIELD_LICENSES]      = { offsetof(struct package_t, licenses),     sizeof(char **) },
+  [PACKAGE_FIELD_CONFLICTS]     = { offsetof(struct package_t, conflicts),    sizeof(char **) },
+  [PACKAGE_FIELD_DEPENDS]       = { offsetof(struct package_t, depends),      sizeof(char **) },
+  [PACKAGE_FIELD_GROUPS]        = { offsetof(struct package_t, groups),       sizeof(char **) },
+  [PACKAGE_FIELD_MAKEDEPENDS]   = { offsetof(struct package_t, makedepends),  sizeof(char **) },
+  [PACKAGE_FIELD_OPTDEPENDS]    = { offsetof(struct package_t, optdepends),   sizeof(char **) },
+  [PACKAGE_FIELD_CHECKDEPENDS]  = { offsetof(struct package_t, checkdepends), sizeof(char **) },
+  [PACKAGE_FIELD_PROVIDES]      = { offsetof(struct package_t, provides),     sizeof(char **) },
+  [PACKAGE_FIELD_REPLACES]      = { offsetof(struct package_t, replaces),     sizeof(char **) },
+};
+
 struct json_descriptor_t {
   const char *key;
   yajl_type type;
@@ -105,7 +133,7 @@ static void free_strv(char **strv) {
   free(strv);
 }
 
-static void package_reset(struct package_t *package) {
+void package_reset_internal(struct package_t *package) {
   free(package->name);
   free(package->description);
   free(package->maintainer);
@@ -127,7 +155,7 @@ static void package_reset(struct package_t *package) {
 
 void aur_package_list_free(struct package_t *packages) {
   for (struct package_t *p = packages; p->name; ++p)
-    package_reset(p);
+    package_reset_internal(p);
 
   free(packages);
 }
@@ -191,11 +219,65 @@ int aur_packages_from_json(const char *json, struct package_t **packages, int *c
   return 0;
 }
 
+/* The message of an error answer from the RPC interface, which comes with
+ * an empty results array, or NULL for any other answer. */
+char *rpc_error_internal(const char *json) {
+  const char *type_path[] = { "type", NULL }, *error_path[] = { "error", NULL };
+  char error_buffer[128], *error = NULL;
+  yajl_val node, type, message;
+
+  node = yajl_tree_parse(json, error_buffer, sizeof(error_buffer));
+  if (node == NULL)
+    return NULL;
+
+  type = yajl_tree_get(node, type_path, yajl_t_string);
+  message = yajl_tree_get(node, error_path, yajl_t_string);
+  if (type != NULL && strcmp(type->u.string, "error") == 0)
+    error = strdup(message ? message->u.string : "");
+
+  yajl_tree_free(node);
+
+  return error;
+}
+
 typedef void (*specifier_format_fn)(FILE *stream, const char *format, void *data, void *userdata);
 
 static void specifier_format_str(FILE *stream, const char *format, void *data, void *userdata) {
+  const char *s = *(const char **)data;
+
   (void) userdata;
-  fprintf(stream, format, (const char *)data);
+  fprintf(stream, format, s ? s : "");
+}
+
+static void specifier_format_int(FILE *stream, const char *format, void *data, void *userdata) {
+  (void) userdata;
+  fprintf(stream, format, *(int *)data);
+}
+
+/* the 'd' conversion is widened to fit a time_t */
+static void specifier_format_time(FILE *stream, const char *format, void *data, void *userdata) {
+  char fmt[MAX_FORMAT_LEN + 2];
+  size_t len = strlen(format);
+
+  (void) userdata;
+  memcpy(fmt, format, len - 1);
+  memcpy(fmt + len - 1, "lld", 4);
+  fprintf(stream, fmt, (long long)*(time_t *)data);
+}
+
+/* lists are space separated, the width applies to each item */
+static void specifier_format_list(FILE *stream, const char *format, void *data, void *userdata) {
+  char **l = *(char ***)data;
+
+  (void) userdata;
+  if (l == NULL)
+    return;
+
+  for (char **s = l; *s; ++s) {
+    if (s != l)
+      fputc(' ', stream);
+    fprintf(stream, format, *s);
+  }
 }
 
 struct specifier_t {
@@ -221,23 +303,23 @@ static const struct specifier_t *specmap_get_key(struct specifier_t table[], siz
 
 static int aur_package_format(FILE *stream, const char *format, const struct package_t *package, void *userdata) {
   struct specifier_t table[] = {
-    { 'C', 's', specifier_format_str, offsetof(struct package_t, conflicts) },
-    { 'D', 's', specifier_format_str, offsetof(struct package_t, depends) },
-    { 'M', 's', specifier_format_str, offsetof(struct package_t, makedepends) },
-    { 'O', 's', specifier_format_str, offsetof(struct package_t, optdepends) },
-    { 'P', 's', specifier_format_str, offsetof(struct package_t, provides) },
-    { 'R', 's', specifier_format_str, offsetof(struct package_t, replaces) },
-    { 'a', 'd', specifier_format_str, offsetof(struct package_t, modified_s) },
-    { 'c', 'd', specifier_format_str, offsetof(struct package_t, category_id) },
+    { 'C', 's', specifier_format_list, offsetof(struct package_t, conflicts) },
+    { 'D', 's', specifier_format_list, offsetof(struct package_t, depends) },
+    { 'M', 's', specifier_format_list, offsetof(struct package_t, makedepends) },
+    { 'O', 's', specifier_format_list, offsetof(struct package_t, optdepends) },
+    { 'P', 's', specifier_format_list, offsetof(struct package_t, provides) },
+    { 'R', 's', specifier_format_list, offsetof(struct package_t, replaces) },
+    { 'a', 'd', specifier_format_time, offsetof(struct package_t, modified_s) },
+    { 'c', 'd', specifier_format_int, offsetof(struct package_t, category_id) },
     { 'd', 's', specifier_format_str, offsetof(struct package_t, description) },
-    { 'i', 's', specifier_format_str, offsetof(struct package_t, package_id) },
-    { 'l', 's', specifier_format_str, offsetof(struct package_t, licenses) },
+    { 'i', 'd', specifier_format_int, offsetof(struct package_t, package_id) },
+    { 'l', 's', specifier_format_list, offsetof(struct package_t, licenses) },
     { 'm', 's', specifier_format_str, offsetof(struct package_t, maintainer) },
     { 'n', 's', specifier_format_str, offsetof(struct package_t, name) },
-    { 'o', 'd', specifier_format_str, offsetof(struct package_t, votes) },
+    { 'o', 'd', specifier_format_int, offsetof(struct package_t, votes) },
     { 'p', 's', specifier_format_str, offsetof(struct package_t, aur_urlpath) },
-    { 's', 'd', specifier_format_str, offsetof(struct package_t, submitted_s) },
-    { 't', 'd', specifier_format_str, offsetof(struct package_t, out_of_date) },
+    { 's', 'd', specifier_format_time, offsetof(struct package_t, submitted_s) },
+    { 't', 'd', specifier_format_int, offsetof(struct package_t, out_of_date) },
     { 'u', 's', specifier_format_str, offsetof(struct package_t, upstream_url) },
     { 'v', 's', specifier_format_str, offsetof(struct package_t, version) },
   };
@@ -0,0 +1,361 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "aur-internal.h"
+
+/* Every worker thread drives an aur_t of its own. Requests reach a worker
+ * through a lock-free stack which the worker takes over whole and reverses
+ * into submission order. Completions meant for the dispatching thread
+ * travel back the same way, with an eventfd to wake it up. */
+
+struct pool_worker_t {
+  aur_pool_t *pool;
+  aur_t *aur;
+  pthread_t thread;
+  int started;
+
+  /* both accessed atomically */
+  aur_request_t *submitted;
+  int load;
+};
+
+struct aur_pool_t {
+  struct pool_worker_t *workers;
+  int nworkers;
+  int complete_on;
+
+  /* all accessed atomically */
+  int stopping;
+  int outstanding;
+  aur_request_t *completed;
+
+  int efd;
+};
+
+static void stack_push(aur_request_t **top, aur_request_t *request) {
+  aur_request_t *head = __atomic_load_n(top, __ATOMIC_RELAXED);
+
+  do {
+    request->pool_next = head;
+  } while (!__atomic_compare_exchange_n(top, &head, request, 1,
+        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* takes everything pushed so far, oldest first */
+static aur_request_t *stack_take_all(aur_request_t **top) {
+  aur_request_t *r, *fifo = NULL;
+
+  r = __atomic_exchange_n(top, NULL, __ATOMIC_ACQUIRE);
+  while (r) {
+    aur_request_t *next = r->pool_next;
+
+    r->pool_next = fifo;
+    fifo = r;
+    r = next;
+  }
+
+  return fifo;
+}
+
+static void pool_notify(aur_pool_t *pool) {
+  uint64_t one = 1;
+
+  while (write(pool->efd, &one, sizeof(one)) < 0 && errno == EINTR)
+    ;
+}
+
+static void pool_finish_request(aur_pool_t *pool) {
+  __atomic_sub_fetch(&pool->outstanding, 1, __ATOMIC_ACQ_REL);
+}
+
+static int pool_done(aur_t *aur, aur_request_t *request, const void *response, int responselen) {
+  struct pool_worker_t *w = request->worker;
+
+  __atomic_sub_fetch(&w->load, 1, __ATOMIC_RELAXED);
+
+  if (w->pool->complete_on == POOL_COMPLETE_ON_WORKER) {
+    if (request->pool_done_fn)
+      request->pool_done_fn(aur, request, response, responselen);
+    return 0;
+  }
+
+  request->pool_responselen = responselen;
+
+  return 0;
+}
+
+/* The request is only handed over to the dispatching thread once the
+ * worker is done with it, timing and all. */
+static void pool_completed(aur_t *aur, aur_request_t *request) {
+  aur_pool_t *pool = request->worker->pool;
+
+  (void)aur;
+
+  if (pool->complete_on == POOL_COMPLETE_ON_WORKER)
+    pool_finish_request(pool);
+  else
+    stack_push(&pool->completed, aur_request_ref(request));
+
+  pool_notify(pool);
+}
+
+static void take_submissions(struct pool_worker_t *w) {
+  aur_request_t *next;
+
+  for (aur_request_t *r = stack_take_all(&w->submitted); r; r = next) {
+    int q;
+
+    next = r->pool_next;
+
+    q = aur_queue_request(w->aur, r);
+    if (q < 0) {
+      r->result = q;
+      pool_done(w->aur, r, NULL, 0);
+      pool_completed(w->aur, r);
+    }
+
+    aur_request_unref(r);
+  }
+}
+
+/* completes requests that were submitted too late for the worker to see */
+static void cancel_submissions(struct pool_worker_t *w) {
+  aur_request_t *next;
+
+  for (aur_request_t *r = stack_take_all(&w->submitted); r; r = next) {
+    next = r->pool_next;
+
+    r->result = -ECANCELED;
+    pool_done(w->aur, r, NULL, 0);
+    pool_completed(w->aur, r);
+    aur_request_unref(r);
+  }
+}
+
+static void *worker_main(void *arg) {
+  struct pool_worker_t *w = arg;
+
+  while (!__atomic_load_n(&w->pool->stopping, __ATOMIC_ACQUIRE)) {
+    take_submissions(w);
+
+    if (run_once_internal(w->aur, 1) < 0)
+      fprintf(stderr, "error: pool worker: event loop failed\n");
+
+    /* there's no aur_run for done_fn to abort */
+    w->aur->aborted = 0;
+  }
+
+  take_submissions(w);
+  abort_all_requests_internal(w->aur, -ECANCELED);
+
+  return NULL;
+}
+
+/* frees a pool whose workers aren't running */
+static void pool_destroy(aur_pool_t *pool) {
+  for (int i = 0; i < pool->nworkers; ++i)
+    aur_free(pool->workers[i].aur);
+
+  if (pool->efd >= 0)
+    close(pool->efd);
+  free(pool->workers);
+  free(pool);
+}
+
+/* Creates a pool of nworkers threads, one per online CPU if nworkers is 0.
+ * complete_on selects whether done_fn runs on the worker that ran the
+ * request, or on whichever thread calls aur_pool_dispatch. */
+int aur_pool_new(aur_pool_t **ret, const char *domainname, int secure, int nworkers, int complete_on) {
+  aur_pool_t *pool;
+  int r;
+
+  if (nworkers < 0 || complete_on < 0 || complete_on >= _POOL_COMPLETE_MAX)
+    return -EINVAL;
+
+  if (nworkers == 0) {
+    nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nworkers < 1)
+      nworkers = 1;
+  }
+
+  pool = calloc(1, sizeof(*pool));
+  if (pool == NULL)
+    return -ENOMEM;
+
+  pool->efd = -1;
+  pool->complete_on = complete_on;
+
+  pool->workers = calloc(nworkers, sizeof(struct pool_worker_t));
+  if (pool->workers == NULL) {
+    r = -ENOMEM;
+    goto fail;
+  }
+  pool->nworkers = nworkers;
+
+  pool->efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (pool->efd < 0) {
+    r = -errno;
+    goto fail;
+  }
+
+  for (int i = 0; i < nworkers; ++i) {
+    pool->workers[i].pool = pool;
+
+    r = aur_new(&pool->workers[i].aur, domainname, secure);
+    if (r < 0)
+      goto fail;
+  }
+
+  *ret = pool;
+
+  return 0;
+
+fail:
+  pool_destroy(pool);
+  return r;
+}
+
+int aur_pool_get_worker_count(aur_pool_t *pool) {
+  return pool->nworkers;
+}
+
+/* Returns the aur_t driven by worker i, so it can be configured. Only safe
+ * to use before aur_pool_start. */
+aur_t *aur_pool_get_worker(aur_pool_t *pool, int i) {
+  if (i < 0 || i >= pool->nworkers)
+    return NULL;
+
+  return pool->workers[i].aur;
+}
+
+int aur_pool_start(aur_pool_t *pool) {
+  for (int i = 0; i < pool->nworkers; ++i) {
+    struct pool_worker_t *w = &pool->workers[i];
+    int r;
+
+    if (w->started)
+      continue;
+
+    r = pthread_create(&w->thread, NULL, worker_main, w);
+    if (r != 0)
+      return -r;
+
+    w->started = 1;
+  }
+
+  return 0;
+}
+
+/* May be called from any thread, including from done_fn. The request goes
+ * to the least loaded worker. */
+int aur_pool_submit(aur_pool_t *pool, aur_request_t *request) {
+  struct pool_worker_t *w = &pool->workers[0];
+
+  if (__atomic_load_n(&pool->stopping, __ATOMIC_ACQUIRE))
+    return -ESHUTDOWN;
+
+  for (int i = 1; i < pool->nworkers; ++i)
+    if (__atomic_load_n(&pool->workers[i].load, __ATOMIC_RELAXED) <
+        __atomic_load_n(&w->load, __ATOMIC_RELAXED))
+      w = &pool->workers[i];
+
+  request->worker = w;
+  request->completed_fn = pool_completed;
+
+  /* a request submitted again already has its done_fn tucked away */
+  if (request->done_fn != pool_done) {
+    request->pool_done_fn = request->done_fn;
+    request->done_fn = pool_done;
+  }
+
+  __atomic_add_fetch(&w->load, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&pool->outstanding, 1, __ATOMIC_ACQ_REL);
+
+  stack_push(&w->submitted, aur_request_ref(request));
+  curl_multi_wakeup(w->aur->curlm);
+
+  return 0;
+}
+
+/* becomes readable when a request completes */
+int aur_pool_get_fd(aur_pool_t *pool) {
+  return pool->efd;
+}
+
+/* Runs done_fn for requests completed since the last call, when completions
+ * are delivered on the dispatching thread. done_fn is passed a NULL aur_t,
+ * and the response is only valid until it returns. Returns the number of
+ * requests completed. */
+int aur_pool_dispatch(aur_pool_t *pool) {
+  aur_request_t *next;
+  uint64_t n;
+  int count = 0;
+
+  /* the eventfd is non-blocking, and may well have been drained already */
+  while (read(pool->efd, &n, sizeof(n)) < 0 && errno == EINTR)
+    ;
+
+  for (aur_request_t *r = stack_take_all(&pool->completed); r; r = next) {
+    next = r->pool_next;
+
+    if (r->pool_done_fn)
+      r->pool_done_fn(NULL, r, aur_request_get_response(r), r->pool_responselen);
+
+    aur_request_unref(r);
+    pool_finish_request(pool);
+    ++count;
+  }
+
+  return count;
+}
+
+/* blocks until every submitted request has completed */
+int aur_pool_wait(aur_pool_t *pool) {
+  while (__atomic_load_n(&pool->outstanding, __ATOMIC_ACQUIRE) > 0) {
+    struct pollfd pfd = { .fd = pool->efd, .events = POLLIN };
+
+    if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+      return -errno;
+
+    aur_pool_dispatch(pool);
+  }
+
+  return 0;
+}
+
+/* Requests still outstanding complete with -ECANCELED. */
+void aur_pool_free(aur_pool_t *pool) {
+  if (pool == NULL)
+    return;
+
+  __atomic_store_n(&pool->stopping, 1, __ATOMIC_RELEASE);
+
+  for (int i = 0; i < pool->nworkers; ++i) {
+    struct pool_worker_t *w = &pool->workers[i];
+
+    /* cancels whatever was submitted to it, right here */
+    if (!w->started) {
+      worker_main(w);
+      continue;
+    }
+
+    curl_multi_wakeup(w->aur->curlm);
+    pthread_join(w->thread, NULL);
+  }
+
+  /* a submit that got past the stopping check may have pushed after the
+   * worker took its last look */
+  for (int i = 0; i < pool->nworkers; ++i)
+    cancel_submissions(&pool->workers[i]);
+
+  aur_pool_dispatch(pool);
+
+  pool_destroy(pool);
+}
+
+/* vim: set et ts=2 sw=2: */
@@ -0,0 +1,321 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "aur-internal.h"
+
+/* RPC requests can be answered by a running cowd instead of going out over
+ * the network. Queries are sent as one line each,
+ *
+ *   <id>\t<method>\t<arg>[\t<arg>...]\n
+ *
+ * and answered, in whatever order they complete, with a header line
+ * followed by the response body:
+ *
+ *   <id> <result> <http status> <length>\n<body>
+ *
+ * Should the daemon go away, the requests it still owed us are sent over
+ * the network after all. */
+
+/* Makes sure dir is a directory only we can get into, creating it if need
+ * be, so that nobody else can put a socket of theirs there. */
+static int private_dir(const char *dir) {
+  struct stat st;
+
+  if (mkdir(dir, 0700) < 0 && errno != EEXIST)
+    return -errno;
+
+  if (lstat(dir, &st) < 0)
+    return -errno;
+
+  if (!S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 0077) != 0)
+    return -EPERM;
+
+  return 0;
+}
+
+/* Returns the path of the daemon's socket, or NULL with errno set. Without
+ * $XDG_RUNTIME_DIR it lives in a directory of ours under /tmp. */
+char *aur_daemon_socket_path(void) {
+  const char *dir = getenv("XDG_RUNTIME_DIR");
+  _cleanup_free_ char *tmpdir = NULL;
+  char *path;
+  int r;
+
+  if (dir == NULL || *dir == '\0') {
+    if (asprintf(&tmpdir, "/tmp/cowd-%u", (unsigned int)getuid()) < 0) {
+      errno = ENOMEM;
+      return NULL;
+    }
+
+    r = private_dir(tmpdir);
+    if (r < 0) {
+      errno = -r;
+      return NULL;
+    }
+
+    dir = tmpdir;
+  }
+
+  if (asprintf(&path, "%s/cowd.sock", dir) < 0) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  return path;
+}
+
+/* Whatever answers on the socket is trusted with package info, so it had
+ * better be ours. */
+static int check_peer(int fd) {
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+    return -errno;
+
+  if (cred.uid != getuid())
+    return -EPERM;
+
+  return 0;
+}
+
+/* Connects to the daemon listening on path, or at aur_daemon_socket_path()
+ * if path is NULL. RPC requests queued afterwards are sent to it. */
+int aur_connect_daemon(aur_t *aur, const char *path) {
+  union {
+    struct sockaddr sa;
+    struct sockaddr_un un;
+  } addr = { .un.sun_family = AF_UNIX };
+  _cleanup_free_ char *defpath = NULL;
+  int fd, r;
+
+  if (path == NULL) {
+    path = defpath = aur_daemon_socket_path();
+    if (path == NULL)
+      return -errno;
+  }
+
+  if (strlen(path) >= sizeof(addr.un.sun_path))
+    return -ENAMETOOLONG;
+  strcpy(addr.un.sun_path, path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -errno;
+
+  if (connect(fd, &addr.sa, sizeof(addr.un)) < 0) {
+    r = -errno;
+    close(fd);
+    return r;
+  }
+
+  r = check_peer(fd);
+  if (r < 0) {
+    close(fd);
+    return r;
+  }
+
+  remote_disconnect_internal(aur);
+  aur->daemon_fd = fd;
+
+  return 0;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -errno;
+    }
+
+    buf += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+static const char *method_name(int request_type) {
+  switch (request_type) {
+  case REQUEST_INFO:
+    return "info";
+  case REQUEST_MULTIINFO:
+    return "multiinfo";
+  case REQUEST_SEARCH:
+    return "search";
+  case REQUEST_MSEARCH:
+    return "msearch";
+  default:
+    return NULL;
+  }
+}
+
+/* Returns 1 if the request was handed to the daemon, 0 if it has to go
+ * over the network. */
+int remote_queue_internal(aur_t *aur, aur_request_t *request) {
+  _cleanup_free_ char *line = NULL;
+  const char *method;
+  size_t len = 0;
+  FILE *fp;
+
+  /* cowd answers from its cache, which has no headers to go by */
+  if (aur->daemon_fd < 0 || request->headers != NULL)
+    return 0;
+
+  method = method_name(request->request_type);
+  if (method == NULL)
+    return 0;
+
+  for (size_t i = 0; i < request->args.size; ++i)
+    if (strpbrk(request->args.argv[i], "\t\n") != NULL)
+      return 0;
+
+  fp = open_memstream(&line, &len);
+  if (fp == NULL)
+    return -ENOMEM;
+
+  fprintf(fp, "%llu\t%s", (unsigned long long)aur->remote_seq + 1, method);
+  for (size_t i = 0; i < request->args.size; ++i)
+    fprintf(fp, "\t%s", request->args.argv[i]);
+  fputc('\n', fp);
+
+  if (fclose(fp) != 0)
+    return -ENOMEM;
+
+  if (write_all(aur->daemon_fd, line, len) < 0) {
+    remote_disconnect_internal(aur);
+    return 0;
+  }
+
+  request->remote_id = ++aur->remote_seq;
+  request_list_append(&aur->remote, aur_request_ref(request));
+
+  return 1;
+}
+
+/* Drops the connection, sending whatever is still outstanding over the
+ * network instead. */
+void remote_disconnect_internal(aur_t *aur) {
+  if (aur->daemon_fd < 0)
+    return;
+
+  close(aur->daemon_fd);
+  aur->daemon_fd = -1;
+  aur->remote_in_len = 0;
+
+  while (aur->remote.head) {
+    aur_request_t *r = aur->remote.head;
+    uint64_t deadline = r->deadline_us;
+    int q;
+
+    request_list_remove(r);
+    r->remote_id = 0;
+
+    q = aur_queue_request(aur, r);
+    r->deadline_us = deadline;
+    if (q < 0) {
+      r->result = q;
+      complete_request_internal(aur, r, -1);
+      continue;
+    }
+
+    aur_request_unref(r);
+  }
+}
+
+static aur_request_t *find_remote(aur_t *aur, uint64_t id) {
+  for (aur_request_t *r = aur->remote.head; r; r = r->next)
+    if (r->remote_id == id)
+      return r;
+
+  return NULL;
+}
+
+/* consumes one frame from the input buffer, if it holds a complete one */
+static int handle_frame(aur_t *aur) {
+  unsigned long long id;
+  int result, status, q = 0;
+  size_t len, off;
+  char *eol;
+  aur_request_t *r;
+
+  eol = memchr(aur->remote_in, '\n', aur->remote_in_len);
+  if (eol == NULL)
+    return 0;
+
+  *eol = '\0';
+  if (sscanf(aur->remote_in, "%llu %d %d %zu", &id, &result, &status, &len) != 4)
+    return -EBADMSG;
+  *eol = '\n';
+
+  off = eol - aur->remote_in + 1;
+  if (aur->remote_in_len - off < len)
+    return 0;
+
+  /* responses to cancelled requests are dropped */
+  r = find_remote(aur, id);
+  if (r != NULL)
+    q = request_set_body_internal(r, &aur->remote_in[off], len);
+
+  /* done_fn may queue more requests, or even lose the connection */
+  aur->remote_in_len -= off + len;
+  memmove(aur->remote_in, &aur->remote_in[off + len], aur->remote_in_len);
+
+  if (r != NULL) {
+    r->result = q < 0 ? q : result;
+    r->http_status = status;
+    complete_request_internal(aur, r, len);
+  }
+
+  return 1;
+}
+
+void remote_dispatch_internal(aur_t *aur) {
+  for (;;) {
+    ssize_t n;
+    int r;
+
+    if (aur->daemon_fd < 0)
+      return;
+
+    if (aur->remote_in_cap - aur->remote_in_len < 4096) {
+      size_t newcap = aur->remote_in_cap ? aur->remote_in_cap * 2 : 16384;
+      char *newalloc = realloc(aur->remote_in, newcap);
+      if (newalloc == NULL) {
+        remote_disconnect_internal(aur);
+        return;
+      }
+
+      aur->remote_in = newalloc;
+      aur->remote_in_cap = newcap;
+    }
+
+    n = recv(aur->daemon_fd, &aur->remote_in[aur->remote_in_len],
+        aur->remote_in_cap - aur->remote_in_len, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+      return;
+    if (n <= 0) {
+      remote_disconnect_internal(aur);
+      return;
+    }
+
+    aur->remote_in_len += n;
+
+    while ((r = handle_frame(aur)) > 0)
+      ;
+    if (r < 0) {
+      remote_disconnect_internal(aur);
+      return;
+    }
+  }
+}
+
+/* vim: set et ts=2 sw=2: */
@@ -56,7 +56,10 @@ static int strbuf_append(struct strbuf_t *s, const char *str) {
 }
 
 static char *strbuf_cstr(struct strbuf_t *s) {
-  if (s->data[s->size - 1] != '\0') {
+  if (s->data == NULL && strbuf_init(s) < 0)
+    return NULL;
+
+  if (s->size == 0 || s->data[s->size - 1] != '\0') {
     if (strbuf_append_mem(s, "", 1) < 0)
       return NULL;
   }
@@ -81,7 +84,7 @@ static int strbuf_appendvf(struct strbuf_t *s, const char *format, va_list ap) {
   va_copy(aq, ap);
 
   len = vsnprintf(&s->data[s->size], 0, format, aq);
-  while ((size_t)len > s->capacity - s->size) {
+  while ((size_t)len >= s->capacity - s->size) {
     if (strbuf_grow(s) < 0)
       return -ENOMEM;
   }
@@ -175,7 +178,25 @@ static int arglist_append(struct arglist_t *a, const char *arg) {
   return 0;
 }
 
-static int arglist_build_multi(struct arglist_t *a, struct strbuf_t *s) {
+/* Returns the length arg adds to a multiinfo's request line, "&arg[]="
+ * included, for batching arguments within AUR_MAX_QUERY_LEN. curl leaves
+ * only the unreserved characters alone, and turns every other byte into a
+ * %XX. */
+size_t aur_request_arg_length(const char *arg) {
+  size_t len = strlen("&arg[]=");
+
+  for (const char *c = arg; *c; ++c) {
+    if ((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') ||
+        strchr("-._~", *c) != NULL)
+      len += 1;
+    else
+      len += 3;
+  }
+
+  return len;
+}
+
+static int arglist_build_multi(const struct arglist_t *a, struct strbuf_t *s) {
   int r;
 
   for (size_t i = 0; i < a->size; ++i) {
@@ -193,7 +214,7 @@ static int arglist_build_multi(struct arglist_t *a, struct strbuf_t *s) {
   return 0;
 }
 
-static int arglist_build_single(struct arglist_t *a, struct strbuf_t *s) {
+static int arglist_build_single(const struct arglist_t *a, struct strbuf_t *s) {
   _cleanup_free_ char *e = NULL;
   int r;
 
@@ -226,25 +247,73 @@ static const char *rpc_method_name(int request_type) {
   }
 }
 
-static int arglist_build(struct arglist_t *a, struct strbuf_t *s, int multi) {
+static int arglist_build(const struct arglist_t *a, struct strbuf_t *s, int multi) {
   if (multi)
     return arglist_build_multi(a, s);
   else
     return arglist_build_single(a, s);
 }
 
+/* userdata is the body of the transfer, which is either the request's own
+ * or that of its hedge */
 size_t request_write_handler_internal(void *ptr, size_t nmemb, size_t size, void *userdata) {
-  struct aur_request_t *request = userdata;
-
-  if (request->body.data == NULL && strbuf_init(&request->body) < 0)
-      return 0;
+  struct body_t *body = userdata;
 
-  if (strbuf_append_mem(&request->body, ptr, size * nmemb))
+  if (body_append(body, ptr, size * nmemb) < 0)
     return 0;
 
   return size * nmemb;
 }
 
+void request_reset_body_internal(aur_request_t *request) {
+  body_reset(&request->response->body);
+  response_reset_headers_internal(request->response);
+}
+
+int request_set_body_internal(aur_request_t *request, const void *data, size_t len) {
+  aur_response_t *response;
+  int r;
+
+  r = response_new_internal(&response, NULL, NULL);
+  if (r < 0)
+    return r;
+
+  r = body_append(&response->body, data, len);
+  if (r < 0) {
+    aur_response_unref(response);
+    return r;
+  }
+
+  body_finish(&response->body);
+
+  aur_response_unref(request->response);
+  request->response = response;
+
+  return 0;
+}
+
+/* answers request with the very response from got, without a copy */
+void request_share_response_internal(aur_request_t *request, aur_request_t *from) {
+  aur_response_unref(request->response);
+  request->response = from->response ? aur_response_ref(from->response) : NULL;
+}
+
+curl_off_t request_response_size_internal(aur_request_t *request) {
+  if (request->response == NULL)
+    return -1;
+
+  return aur_response_get_size(request->response);
+}
+
+/* the caller takes care of removing the handle from the multi handle */
+void request_drop_hedge_internal(aur_request_t *request) {
+  curl_easy_cleanup(request->hedge_curl);
+  request->hedge_curl = NULL;
+
+  aur_response_unref(request->hedge_response);
+  request->hedge_response = NULL;
+}
+
 int aur_request_new(aur_request_t **ret, int request_type, aur_request_done_fn done_fn) {
   aur_request_t *r;
 
@@ -261,13 +330,14 @@ int aur_request_new(aur_request_t **ret, int request_type, aur_request_done_fn d
 
   r->refcount = 1;
   r->request_type = request_type;
+  r->priority = PRIORITY_NORMAL;
   r->done_fn = done_fn;
 
   *ret = r;
   return 0;
 }
 
-static int request_build_rpc(aur_request_t *request, int rpc_version, struct strbuf_t *s) {
+static int request_build_rpc(const aur_request_t *request, int rpc_version, struct strbuf_t *s) {
   int r;
 
   r = strbuf_appendf(s, "/rpc.php?v=%d&type=%s", rpc_version,
@@ -275,43 +345,91 @@ static int request_build_rpc(aur_request_t *request, int rpc_version, struct str
   if (r < 0)
     return r;
 
-  r = arglist_build(&request->args, s,
+  return arglist_build(&request->args, s,
       request->request_type == REQUEST_MULTIINFO);
-  if (r < 0)
-    return r;
+}
 
-  request->url = strbuf_steal(s);
-  return 0;
+static int request_build_download(const aur_request_t *request, struct strbuf_t *s) {
+  return strbuf_append(s, request->args.argv[0]);
 }
 
-static int request_build_download(aur_request_t *request, struct strbuf_t *s) {
+int request_build_url_internal(const aur_request_t *request, const char *protocol, const char *domain,
+    int rpc_version, char **url) {
+  struct strbuf_t s;
   int r;
 
-  r = strbuf_append(s, request->args.argv[0]);
+  r = strbuf_init(&s);
   if (r < 0)
     return r;
 
-  request->url = strbuf_steal(s);
-  return 0;
+  r = strbuf_cat(&s, protocol, "://", domain, NULL);
+  if (r < 0)
+    goto fail;
+
+  if (request->request_type == REQUEST_DOWNLOAD)
+    r = request_build_download(request, &s);
+  else
+    r = request_build_rpc(request, rpc_version, &s);
+  if (r < 0)
+    goto fail;
+
+  *url = strbuf_steal(&s);
+  return *url ? 0 : -ENOMEM;
+
+fail:
+  strbuf_reset(&s);
+  return r;
 }
 
+/* requests are built again whenever they move to another endpoint */
 int request_build_internal(aur_request_t *request, const char *protocol, const char *domain,
     int rpc_version) {
-  struct strbuf_t s;
+  char *url;
   int r;
 
-  r = strbuf_init(&s);
+  r = request_build_url_internal(request, protocol, domain, rpc_version, &url);
   if (r < 0)
     return r;
 
-  r = strbuf_cat(&s, protocol, "://", domain, NULL);
-  if (r < 0)
-    return r;
+  free(request->url);
+  request->url = url;
 
-  if (request->request_type == REQUEST_DOWNLOAD)
-    return request_build_download(request, &s);
+  return 0;
+}
+
+void request_list_append(struct request_list_t *list, aur_request_t *request) {
+  request->list = list;
+  request->next = NULL;
+  request->prev = list->tail;
+
+  if (list->tail)
+    list->tail->next = request;
+  else
+    list->head = request;
+
+  list->tail = request;
+  ++list->size;
+}
+
+void request_list_remove(aur_request_t *request) {
+  struct request_list_t *list = request->list;
+
+  if (list == NULL)
+    return;
+
+  if (request->prev)
+    request->prev->next = request->next;
+  else
+    list->head = request->next;
+
+  if (request->next)
+    request->next->prev = request->prev;
   else
-    return request_build_rpc(request, rpc_version, &s);
+    list->tail = request->prev;
+
+  request->prev = request->next = NULL;
+  request->list = NULL;
+  --list->size;
 }
 
 void aur_request_free(aur_request_t *request) {
@@ -319,18 +437,19 @@ void aur_request_free(aur_request_t *request) {
     return;
 
   curl_easy_cleanup(request->curl);
+  request_drop_hedge_internal(request);
 
   arglist_reset(&request->args);
-  strbuf_reset(&request->body);
+  curl_slist_free_all(request->headers);
+  aur_response_unref(request->response);
 
   free(request->url);
   free(request);
 }
 
+/* requests may be shared with the worker threads of an aur_pool_t */
 aur_request_t *aur_request_unref(aur_request_t *request) {
-  --request->refcount;
-
-  if (request->refcount == 0) {
+  if (__atomic_sub_fetch(&request->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
     aur_request_free(request);
     request = NULL;
   }
@@ -339,7 +458,7 @@ aur_request_t *aur_request_unref(aur_request_t *request) {
 }
 
 aur_request_t *aur_request_ref(aur_request_t *request) {
-  ++request->refcount;
+  __atomic_add_fetch(&request->refcount, 1, __ATOMIC_RELAXED);
   return request;
 }
 
@@ -359,12 +478,85 @@ int aur_request_get_debug(aur_request_t *request) {
   return request->debug;
 }
 
+int aur_request_set_priority(aur_request_t *request, int priority) {
+  if (priority < 0 || priority >= _PRIORITY_MAX)
+    return -EINVAL;
+
+  request->priority = priority;
+
+  return 0;
+}
+
+int aur_request_get_priority(aur_request_t *request) {
+  return request->priority;
+}
+
+/* Bounds the time from aur_queue_request until completion, including time
+ * spent waiting for admission and retries. A request that runs out of time
+ * completes with -ETIMEDOUT. */
+void aur_request_set_timeout(aur_request_t *request, long timeout_ms) {
+  request->timeout_ms = timeout_ms;
+}
+
+/* Retry failed transfers (transport errors, 429 and 5xx) up to max_retries
+ * times, backing off exponentially from base_delay_ms with jitter. */
+void aur_request_set_retry(aur_request_t *request, int max_retries, long base_delay_ms) {
+  request->max_retries = max_retries;
+  request->retry_base_ms = base_delay_ms;
+}
+
+/* Start a duplicate transfer if no response has arrived after after_ms.
+ * Whichever finishes first wins and the other one is cancelled. */
+void aur_request_set_hedge(aur_request_t *request, long after_ms) {
+  request->hedge_after_ms = after_ms;
+}
+
+int aur_request_get_result(aur_request_t *request) {
+  return request->result;
+}
+
 int aur_request_append_arg(aur_request_t *request, const char *arg) {
   return arglist_append(&request->args, arg);
 }
 
+/* The response stays with the request and is freed along with it, unless
+ * a reference to it is taken with aur_request_ref_response. */
 char *aur_request_get_response(aur_request_t *request) {
-  return strbuf_steal(&request->body);
+  static char empty[1];
+
+  if (request->response == NULL)
+    return empty;
+
+  return body_finish(&request->response->body);
+}
+
+/* Sends header, a complete "Name: value" line, along with the request.
+ * Requests with headers of their own always go over the network. */
+int aur_request_add_header(aur_request_t *request, const char *header) {
+  struct curl_slist *headers;
+
+  headers = curl_slist_append(request->headers, header);
+  if (headers == NULL)
+    return -ENOMEM;
+
+  request->headers = headers;
+  return 0;
+}
+
+const char *aur_request_get_header(aur_request_t *request, const char *name) {
+  if (request->response == NULL)
+    return NULL;
+
+  return aur_response_get_header(request->response, name);
+}
+
+/* Returns a new reference to the response, or NULL if there is none. */
+aur_response_t *aur_request_ref_response(aur_request_t *request) {
+  if (request->response == NULL)
+    return NULL;
+
+  body_finish(&request->response->body);
+  return aur_response_ref(request->response);
 }
 
 int aur_request_get_type(aur_request_t *request) {
@@ -382,11 +574,37 @@ const char *aur_request_get_url(aur_request_t *request) {
 int aur_request_get_http_status(aur_request_t *request) {
   long status;
 
+  /* coalesced requests never run a transfer of their own */
+  if (request->http_status != 0)
+    return request->http_status;
+
   curl_easy_getinfo(request->curl, CURLINFO_RESPONSE_CODE, &status);
 
   return (int) status;
 }
 
+void request_collect_timing_internal(aur_request_t *request) {
+  struct request_timing_t *t = &request->timing;
+  curl_off_t v;
+
+  if (curl_easy_getinfo(request->curl, CURLINFO_NAMELOOKUP_TIME_T, &v) == CURLE_OK)
+    t->namelookup_us = v;
+  if (curl_easy_getinfo(request->curl, CURLINFO_CONNECT_TIME_T, &v) == CURLE_OK)
+    t->connect_us = v;
+  if (curl_easy_getinfo(request->curl, CURLINFO_APPCONNECT_TIME_T, &v) == CURLE_OK)
+    t->appconnect_us = v;
+  if (curl_easy_getinfo(request->curl, CURLINFO_STARTTRANSFER_TIME_T, &v) == CURLE_OK)
+    t->starttransfer_us = v;
+  if (curl_easy_getinfo(request->curl, CURLINFO_TOTAL_TIME_T, &v) == CURLE_OK)
+    t->total_us = v;
+  if (curl_easy_getinfo(request->curl, CURLINFO_SIZE_DOWNLOAD_T, &v) == CURLE_OK)
+    t->bytes = v;
+}
+
+void aur_request_get_timing(aur_request_t *request, struct request_timing_t *timing) {
+  *timing = request->timing;
+}
+
 char *const *aur_request_get_args(aur_request_t *request, int *argc) {
   *argc = request->args.size;
 
@@ -0,0 +1,403 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "aur-internal.h"
+
+/* Response bodies, as written by curl. A body is presized from the
+ * Content-Length header when there is one. Small bodies live on the heap;
+ * past LARGE_BODY they move to an anonymous mapping, which mremap grows
+ * without copying what has been received so far.
+ *
+ * Everything held by transfers still in flight counts against the budget
+ * of their aur_t. A body that would take the total over it is spilled to an
+ * unlinked temporary file instead, and mapped once the transfer is done so
+ * that decoding reads it just like any other body. Either way, a finished
+ * body is NUL terminated, in room kept free for it all along.
+ *
+ * Bodies are wrapped in a reference counted aur_response_t, which a caller
+ * can hold on to past the request it came from, along with the headers
+ * they came with. */
+
+#define LARGE_BODY (64 * 1024)
+#define DEFAULT_BUDGET (64 * 1024 * 1024)
+
+static char empty_body[1];
+
+void body_budget_init(struct body_budget_t *budget) {
+  budget->limit = DEFAULT_BUDGET;
+  budget->used = 0;
+}
+
+/* Caps the memory held by bodies of transfers in flight, 0 for no limit.
+ * Bodies that don't fit go to disk. */
+int aur_set_memory_budget(aur_t *aur, size_t bytes) {
+  aur->budget.limit = bytes;
+
+  return 0;
+}
+
+static size_t page_align(size_t n) {
+  size_t page = sysconf(_SC_PAGESIZE);
+
+  return (n + page - 1) & ~(page - 1);
+}
+
+static void body_uncharge(struct body_t *b) {
+  if (b->budget != NULL)
+    b->budget->used -= b->charged;
+  b->charged = 0;
+}
+
+void body_reset(struct body_t *b) {
+  body_uncharge(b);
+
+  if (b->mapped)
+    munmap(b->data, b->capacity);
+  else if (b->data != empty_body)
+    free(b->data);
+
+  if (b->spilled)
+    close(b->fd);
+
+  b->data = NULL;
+  b->size = 0;
+  b->capacity = 0;
+  b->mapped = 0;
+  b->spilled = 0;
+  b->finished = 0;
+  b->error = 0;
+}
+
+void body_init(struct body_t *b, CURL *curl, struct body_budget_t *budget) {
+  body_reset(b);
+
+  b->curl = curl;
+  b->budget = budget;
+}
+
+static int open_spill_file(void) {
+  const char *dir = getenv("TMPDIR");
+  _cleanup_free_ char *path = NULL;
+  int fd;
+
+  if (dir == NULL || *dir == '\0')
+    dir = "/tmp";
+
+  fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  if (fd >= 0 || (errno != EOPNOTSUPP && errno != EISDIR))
+    return fd < 0 ? -errno : fd;
+
+  /* no O_TMPFILE support in this file system */
+  if (asprintf(&path, "%s/libaur-XXXXXX", dir) < 0)
+    return -ENOMEM;
+
+  fd = mkostemp(path, O_CLOEXEC);
+  if (fd < 0)
+    return -errno;
+
+  unlink(path);
+
+  return fd;
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -errno;
+    }
+
+    data += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+/* moves what has been received so far to disk, freeing the memory */
+static int body_spill(struct body_t *b) {
+  int fd, r;
+
+  fd = open_spill_file();
+  if (fd < 0)
+    return fd;
+
+  r = write_all(fd, b->data, b->size);
+  if (r < 0) {
+    close(fd);
+    return r;
+  }
+
+  body_uncharge(b);
+  if (b->mapped)
+    munmap(b->data, b->capacity);
+  else
+    free(b->data);
+
+  b->data = NULL;
+  b->capacity = 0;
+  b->mapped = 0;
+  b->spilled = 1;
+  b->fd = fd;
+
+  return 0;
+}
+
+static int body_resize(struct body_t *b, size_t capacity) {
+  void *newalloc;
+
+  if (b->mapped) {
+    newalloc = mremap(b->data, b->capacity, capacity, MREMAP_MAYMOVE);
+    if (newalloc == MAP_FAILED)
+      return -ENOMEM;
+  } else if (capacity > LARGE_BODY) {
+    newalloc = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (newalloc == MAP_FAILED)
+      return -ENOMEM;
+
+    /* the one copy a large body ever gets */
+    if (b->size > 0)
+      memcpy(newalloc, b->data, b->size);
+    free(b->data);
+    b->mapped = 1;
+  } else {
+    newalloc = realloc(b->data, capacity);
+    if (newalloc == NULL)
+      return -ENOMEM;
+  }
+
+  b->data = newalloc;
+  b->capacity = capacity;
+
+  return 0;
+}
+
+/* makes room for at least len more bytes and a terminating NUL */
+static int body_reserve(struct body_t *b, size_t len) {
+  size_t needed = b->size + len + 1, capacity;
+
+  if (needed <= b->capacity)
+    return 0;
+
+  capacity = b->capacity * 2;
+  if (capacity < needed)
+    capacity = needed;
+  if (capacity > LARGE_BODY)
+    capacity = page_align(capacity);
+
+  if (b->budget != NULL && b->budget->limit > 0 &&
+      b->budget->used - b->charged + capacity > b->budget->limit) {
+    /* a body that fits on its own is given just what it needs */
+    if (b->budget->used - b->charged + needed > b->budget->limit)
+      return body_spill(b);
+    capacity = needed;
+  }
+
+  if (body_resize(b, capacity) < 0)
+    return -ENOMEM;
+
+  if (b->budget != NULL) {
+    b->budget->used += capacity - b->charged;
+    b->charged = capacity;
+  }
+
+  return 0;
+}
+
+int body_append(struct body_t *b, const void *data, size_t len) {
+  int r;
+
+  /* headers are in by the time the first data arrives */
+  if (b->data == NULL && !b->spilled && b->curl != NULL) {
+    curl_off_t length = -1;
+
+    curl_easy_getinfo(b->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+    if (length > 0 && (size_t)length > len) {
+      r = body_reserve(b, length);
+      if (r < 0)
+        return r;
+    }
+  }
+
+  if (!b->spilled) {
+    r = body_reserve(b, len);
+    if (r < 0)
+      return r;
+  }
+
+  if (b->spilled) {
+    r = write_all(b->fd, data, len);
+    if (r < 0)
+      return r;
+
+    b->size += len;
+    return 0;
+  }
+
+  memcpy(&b->data[b->size], data, len);
+  b->size += len;
+
+  return 0;
+}
+
+/* Called once nothing more is going to be appended. Hands the memory
+ * budget back, and maps a spilled body. Returns the NUL terminated data,
+ * which is empty with b->error set if the spilled body is lost. */
+char *body_finish(struct body_t *b) {
+  void *map;
+
+  if (b->finished)
+    return b->data;
+
+  b->finished = 1;
+  body_uncharge(b);
+  b->budget = NULL;
+
+  if (!b->spilled) {
+    if (b->data == NULL) {
+      b->data = empty_body;
+      return b->data;
+    }
+
+    b->data[b->size] = '\0';
+    return b->data;
+  }
+
+  /* the file grows by the NUL, so the mapping never reaches past its end */
+  if (ftruncate(b->fd, b->size + 1) < 0)
+    goto fail;
+
+  map = mmap(NULL, b->size + 1, PROT_READ, MAP_PRIVATE, b->fd, 0);
+  if (map == MAP_FAILED)
+    goto fail;
+
+  close(b->fd);
+  b->spilled = 0;
+  b->data = map;
+  b->capacity = b->size + 1;
+  b->mapped = 1;
+
+  return b->data;
+
+fail:
+  b->error = -errno;
+  close(b->fd);
+  b->spilled = 0;
+  b->size = 0;
+  b->data = empty_body;
+  return b->data;
+}
+
+int response_new_internal(aur_response_t **ret, CURL *curl, struct body_budget_t *budget) {
+  aur_response_t *response;
+
+  response = calloc(1, sizeof(*response));
+  if (response == NULL)
+    return -ENOMEM;
+
+  response->refcount = 1;
+  body_init(&response->body, curl, budget);
+
+  *ret = response;
+  return 0;
+}
+
+void response_reset_headers_internal(aur_response_t *response) {
+  response->headers_len = 0;
+}
+
+/* Keeps header lines without their line endings. A status line starts over,
+ * as there's another set of headers coming after a redirect. */
+size_t response_header_handler_internal(char *ptr, size_t size, size_t nmemb, void *userdata) {
+  aur_response_t *response = userdata;
+  size_t len = size * nmemb, n = len;
+
+  while (n > 0 && (ptr[n - 1] == '\r' || ptr[n - 1] == '\n'))
+    --n;
+
+  if (n >= 5 && memcmp(ptr, "HTTP/", 5) == 0) {
+    response->headers_len = 0;
+    return len;
+  }
+
+  if (n == 0)
+    return len;
+
+  if (response->headers_len + n + 1 > response->headers_cap) {
+    size_t cap = response->headers_cap ? response->headers_cap * 2 : 512;
+    char *newalloc;
+
+    while (cap < response->headers_len + n + 1)
+      cap *= 2;
+
+    newalloc = realloc(response->headers, cap);
+    if (newalloc == NULL)
+      return 0;
+    response->headers = newalloc;
+    response->headers_cap = cap;
+  }
+
+  memcpy(response->headers + response->headers_len, ptr, n);
+  response->headers[response->headers_len + n] = '\0';
+  response->headers_len += n + 1;
+
+  return len;
+}
+
+/* responses may be shared with the worker threads of an aur_pool_t */
+aur_response_t *aur_response_unref(aur_response_t *response) {
+  if (response == NULL)
+    return NULL;
+
+  if (__atomic_sub_fetch(&response->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+    body_reset(&response->body);
+    free(response->headers);
+    free(response);
+    response = NULL;
+  }
+
+  return response;
+}
+
+aur_response_t *aur_response_ref(aur_response_t *response) {
+  __atomic_add_fetch(&response->refcount, 1, __ATOMIC_RELAXED);
+  return response;
+}
+
+/* NUL terminated, though the data itself may contain NULs */
+const char *aur_response_get_data(aur_response_t *response) {
+  return body_finish(&response->body);
+}
+
+size_t aur_response_get_size(aur_response_t *response) {
+  body_finish(&response->body);
+  return response->body.size;
+}
+
+/* The value of the first header called name, or NULL if there was none.
+ * Only responses that came over the network have headers. */
+const char *aur_response_get_header(aur_response_t *response, const char *name) {
+  size_t nlen = strlen(name);
+
+  for (size_t i = 0; i < response->headers_len; i += strlen(response->headers + i) + 1) {
+    const char *line = response->headers + i;
+
+    if (strncasecmp(line, name, nlen) == 0 && line[nlen] == ':') {
+      line += nlen + 1;
+      while (*line == ' ' || *line == '\t')
+        ++line;
+      return line;
+    }
+  }
+
+  return NULL;
+}
+
+/* vim: set et ts=2 sw=2: */
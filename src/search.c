@@ -0,0 +1,329 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "aur-internal.h"
+
+/* Searches for packages matching every one of several terms. The RPC
+ * interface only takes one term per search, matched against names and
+ * descriptions, so the term most likely to narrow things down is sent on
+ * its own and what comes back is filtered against the others here.
+ *
+ * Longer terms are taken to be the more selective ones. A term that turns
+ * out to match too much for the AUR to answer is given up on, and then the
+ * remaining terms all go out at once; their answers are intersected by
+ * package ID. */
+
+/* the AUR refuses to search for anything shorter */
+#define MIN_TERM_LEN 2
+
+struct search_t {
+  aur_t *aur;
+  aur_search_done_fn done_fn;
+  void *userdata;
+
+  char **terms;
+  int nterms;
+
+  /* terms worth asking about, most selective first */
+  int *candidates;
+  int ncandidates;
+
+  /* one result set per candidate asked about */
+  struct package_t **results;
+  int *counts;
+  int pending;
+  int error;
+};
+
+static void search_free(struct search_t *s) {
+  for (int i = 0; i < s->ncandidates; ++i)
+    if (s->results[i] != NULL)
+      aur_package_list_free(s->results[i]);
+
+  for (int i = 0; i < s->nterms; ++i)
+    free(s->terms[i]);
+
+  free(s->terms);
+  free(s->candidates);
+  free(s->results);
+  free(s->counts);
+  free(s);
+}
+
+static int matches_all(const struct search_t *s, const struct package_t *p) {
+  for (int i = 0; i < s->nterms; ++i) {
+    if (p->name != NULL && strcasestr(p->name, s->terms[i]) != NULL)
+      continue;
+    if (p->description != NULL && strcasestr(p->description, s->terms[i]) != NULL)
+      continue;
+    return 0;
+  }
+
+  return 1;
+}
+
+/* drops the packages missing one of the terms, as soon as they're decoded */
+static int filter(const struct search_t *s, struct package_t *packages, int count) {
+  int n = 0;
+
+  for (int i = 0; i < count; ++i) {
+    if (!matches_all(s, &packages[i])) {
+      package_reset_internal(&packages[i]);
+      continue;
+    }
+    packages[n++] = packages[i];
+  }
+
+  memset(&packages[n], 0, sizeof(struct package_t));
+
+  return n;
+}
+
+static int package_id_cmp(const void *a, const void *b) {
+  int x = *(const int *)a, y = *(const int *)b;
+
+  return (x > y) - (x < y);
+}
+
+/* drops the packages that other doesn't have */
+static int keep_common(struct package_t *packages, int count, const struct package_t *other, int nother) {
+  _cleanup_free_ int *ids = NULL;
+  int n = 0;
+
+  ids = malloc((nother ? nother : 1) * sizeof(int));
+  if (ids == NULL)
+    return -ENOMEM;
+
+  for (int i = 0; i < nother; ++i)
+    ids[i] = other[i].package_id;
+  qsort(ids, nother, sizeof(int), package_id_cmp);
+
+  for (int i = 0; i < count; ++i) {
+    if (bsearch(&packages[i].package_id, ids, nother, sizeof(int), package_id_cmp) == NULL) {
+      package_reset_internal(&packages[i]);
+      continue;
+    }
+    packages[n++] = packages[i];
+  }
+
+  memset(&packages[n], 0, sizeof(struct package_t));
+
+  return n;
+}
+
+/* Keeps those packages of the first result set that every other one has,
+ * in the order the AUR gave them. */
+static int intersect(struct search_t *s, struct package_t **ret) {
+  struct package_t *first = NULL;
+  int count = 0;
+
+  for (int i = 0; i < s->ncandidates; ++i) {
+    if (s->results[i] == NULL)
+      continue;
+
+    if (first == NULL) {
+      first = s->results[i];
+      count = s->counts[i];
+      s->results[i] = NULL;
+      continue;
+    }
+
+    count = keep_common(first, count, s->results[i], s->counts[i]);
+    if (count < 0) {
+      aur_package_list_free(first);
+      return count;
+    }
+  }
+
+  *ret = first;
+  return count;
+}
+
+static void search_finish(struct search_t *s) {
+  struct package_t *packages = NULL;
+  int count = 0;
+
+  if (s->error == 0) {
+    count = intersect(s, &packages);
+    if (count < 0) {
+      s->error = count;
+      count = 0;
+    }
+  }
+
+  if (packages == NULL && s->error == 0)
+    s->error = -ENOENT;
+
+  s->done_fn(s->aur, packages, count, s->error, s->userdata);
+  search_free(s);
+}
+
+static int queue_term(struct search_t *s, int candidate);
+
+static int search_done(aur_t *aur, aur_request_t *req, const void *response, int responselen) {
+  struct search_t *s = aur_request_get_userdata(req);
+  _cleanup_free_ char *error = NULL;
+  struct package_t *packages;
+  char *const *args;
+  int r, count, argc, candidate = 0;
+
+  (void)aur; (void)responselen;
+
+  /* candidates are unique, so the term tells which one this is */
+  args = aur_request_get_args(req, &argc);
+  for (int i = 0; i < s->ncandidates; ++i)
+    if (strcmp(args[0], s->terms[s->candidates[i]]) == 0)
+      candidate = i;
+
+  --s->pending;
+
+  r = aur_request_get_result(req);
+  if (r < 0)
+    goto failed;
+
+  r = aur_packages_from_json(response, &packages, &count);
+  if (r < 0)
+    goto failed;
+
+  if (count == 0) {
+    error = rpc_error_internal(response);
+    if (error != NULL) {
+      aur_package_list_free(packages);
+      r = -E2BIG;
+      goto failed;
+    }
+  }
+
+  s->counts[candidate] = filter(s, packages, count);
+  s->results[candidate] = packages;
+
+  if (s->pending == 0)
+    search_finish(s);
+  return 0;
+
+failed:
+  /* the first term was too broad, or the AUR wouldn't say: try the others,
+   * all at once */
+  if (candidate == 0) {
+    for (int i = 1; i < s->ncandidates; ++i)
+      if (queue_term(s, i) < 0)
+        break;
+  }
+
+  if (s->pending > 0)
+    return 0;
+
+  /* failed terms don't take part in the intersection, but if none got an
+   * answer that's the error */
+  s->error = r;
+  for (int i = 0; i < s->ncandidates; ++i)
+    if (s->results[i] != NULL)
+      s->error = 0;
+
+  search_finish(s);
+  return 0;
+}
+
+static int queue_term(struct search_t *s, int candidate) {
+  aur_request_t *req;
+  int r;
+
+  r = aur_request_new(&req, REQUEST_SEARCH, search_done);
+  if (r < 0)
+    return r;
+
+  r = aur_request_append_arg(req, s->terms[s->candidates[candidate]]);
+  if (r < 0)
+    goto finish;
+
+  aur_request_set_userdata(req, s);
+  aur_request_set_retry(req, 3, 250);
+
+  ++s->pending;
+  r = aur_queue_request(s->aur, req);
+  if (r < 0)
+    --s->pending;
+
+finish:
+  aur_request_unref(req);
+  return r;
+}
+
+static int is_candidate(const struct search_t *s, const char *term) {
+  for (int i = 0; i < s->ncandidates; ++i)
+    if (strcasecmp(s->terms[s->candidates[i]], term) == 0)
+      return 1;
+
+  return 0;
+}
+
+static int candidate_cmp(const void *a, const void *b, void *userdata) {
+  char **terms = userdata;
+  int x = *(const int *)a, y = *(const int *)b;
+  size_t lx = strlen(terms[x]), ly = strlen(terms[y]);
+
+  if (lx != ly)
+    return lx < ly ? 1 : -1;
+
+  return x - y;
+}
+
+/* Queues a search for packages whose name or description contains each of
+ * terms, case insensitively. done_fn gets the packages, or a negative errno
+ * value if there was no answer, once aur_run has them; they're the
+ * caller's to free with aur_package_list_free. */
+int aur_search_all(aur_t *aur, char *const *terms, int nterms, aur_search_done_fn done_fn, void *userdata) {
+  struct search_t *s;
+  int r;
+
+  if (nterms <= 0 || done_fn == NULL)
+    return -EINVAL;
+
+  s = calloc(1, sizeof(*s));
+  if (s == NULL)
+    return -ENOMEM;
+
+  s->aur = aur;
+  s->done_fn = done_fn;
+  s->userdata = userdata;
+
+  s->terms = calloc(nterms, sizeof(char *));
+  s->candidates = calloc(nterms, sizeof(int));
+  s->results = calloc(nterms, sizeof(struct package_t *));
+  s->counts = calloc(nterms, sizeof(int));
+  if (s->terms == NULL || s->candidates == NULL || s->results == NULL || s->counts == NULL) {
+    search_free(s);
+    return -ENOMEM;
+  }
+
+  for (int i = 0; i < nterms; ++i) {
+    s->terms[i] = strdup(terms[i]);
+    if (s->terms[i] == NULL) {
+      search_free(s);
+      return -ENOMEM;
+    }
+    s->nterms = i + 1;
+
+    if (strlen(terms[i]) >= MIN_TERM_LEN && !is_candidate(s, terms[i]))
+      s->candidates[s->ncandidates++] = i;
+  }
+
+  if (s->ncandidates == 0) {
+    search_free(s);
+    return -EINVAL;
+  }
+
+  qsort_r(s->candidates, s->ncandidates, sizeof(int), candidate_cmp, s->terms);
+
+  r = queue_term(s, 0);
+  if (r < 0) {
+    search_free(s);
+    return r;
+  }
+
+  return 0;
+}
+
+/* vim: set et ts=2 sw=2: */
@@ -0,0 +1,460 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "aur-internal.h"
+#include "macro.h"
+
+/* .SRCINFO, as written by makepkg --printsrcinfo:
+ *
+ *   pkgbase = foo
+ *   	pkgver = 1.0
+ *   	depends = bar
+ *   	depends_x86_64 = baz
+ *
+ *   pkgname = foo
+ *
+ *   pkgname = foo-docs
+ *   	depends =
+ *
+ * The pkgbase section holds what every package gets, and each pkgname
+ * section starts a package. A key set in a package's own section replaces
+ * all of the pkgbase's values for it, an empty value clearing the list.
+ *
+ * The file is read into a single buffer and split up in place: every key
+ * and value, and every string in the packages built from them, points into
+ * it. */
+
+#define MAX_THREADS 32
+
+struct srcinfo_entry_t {
+  const char *key;
+  const char *value;
+};
+
+struct srcinfo_section_t {
+  int first;
+  int count;
+};
+
+struct aur_srcinfo_t {
+  char *data;
+
+  struct srcinfo_entry_t *entries;
+  int nentries;
+
+  /* sections[0] is the pkgbase, sections[1 + i] package i */
+  struct srcinfo_section_t *sections;
+  int npackages;
+
+  struct package_t *packages;
+  char **lists;
+  char *version;
+};
+
+static const struct {
+  const char *key;
+  size_t offset;
+} srcinfo_strings[] = {
+  { "pkgdesc", offsetof(struct package_t, description) },
+  { "url",     offsetof(struct package_t, upstream_url) },
+}, srcinfo_lists[] = {
+  { "license",      offsetof(struct package_t, licenses) },
+  { "conflicts",    offsetof(struct package_t, conflicts) },
+  { "depends",      offsetof(struct package_t, depends) },
+  { "groups",       offsetof(struct package_t, groups) },
+  { "makedepends",  offsetof(struct package_t, makedepends) },
+  { "optdepends",   offsetof(struct package_t, optdepends) },
+  { "checkdepends", offsetof(struct package_t, checkdepends) },
+  { "provides",     offsetof(struct package_t, provides) },
+  { "replaces",     offsetof(struct package_t, replaces) },
+};
+
+void aur_srcinfo_free(aur_srcinfo_t *srcinfo) {
+  if (srcinfo == NULL)
+    return;
+
+  free(srcinfo->data);
+  free(srcinfo->entries);
+  free(srcinfo->sections);
+  free(srcinfo->packages);
+  free(srcinfo->lists);
+  free(srcinfo->version);
+  free(srcinfo);
+}
+
+static int is_blank(char c) {
+  return c == ' ' || c == '\t';
+}
+
+/* splits data into entries, NUL terminating keys and values */
+static int srcinfo_tokenize(aur_srcinfo_t *s, size_t len) {
+  char *p = s->data, *end = s->data + len;
+  int cap = 0;
+
+  while (p < end) {
+    char *eol = memchr(p, '\n', end - p), *key, *eq, *k;
+
+    if (eol == NULL)
+      eol = end;
+    *eol = '\0';
+    if (eol > p && eol[-1] == '\r')
+      eol[-1] = '\0';
+
+    key = p;
+    p = eol + 1;
+
+    while (is_blank(*key))
+      ++key;
+    if (*key == '\0' || *key == '#')
+      continue;
+
+    eq = strchr(key, '=');
+    if (eq == NULL)
+      return -EBADMSG;
+
+    for (k = eq; k > key && is_blank(k[-1]); --k)
+      ;
+    if (k == key)
+      return -EBADMSG;
+    *k = '\0';
+
+    for (++eq; is_blank(*eq); ++eq)
+      ;
+
+    if (s->nentries == cap) {
+      struct srcinfo_entry_t *newalloc;
+
+      cap = cap ? cap * 2 : 64;
+      newalloc = realloc(s->entries, cap * sizeof(struct srcinfo_entry_t));
+      if (newalloc == NULL)
+        return -ENOMEM;
+      s->entries = newalloc;
+    }
+
+    s->entries[s->nentries].key = key;
+    s->entries[s->nentries].value = eq;
+    ++s->nentries;
+  }
+
+  return 0;
+}
+
+static int srcinfo_sectionize(aur_srcinfo_t *s) {
+  int n = 0;
+
+  if (s->nentries == 0 || strcmp(s->entries[0].key, "pkgbase") != 0)
+    return -EBADMSG;
+
+  for (int i = 0; i < s->nentries; ++i)
+    n += strcmp(s->entries[i].key, "pkgname") == 0;
+
+  s->sections = calloc(n + 1, sizeof(struct srcinfo_section_t));
+  if (s->sections == NULL)
+    return -ENOMEM;
+
+  n = 0;
+  for (int i = 0; i < s->nentries; ++i) {
+    if (strcmp(s->entries[i].key, "pkgname") == 0)
+      s->sections[++n].first = i;
+    ++s->sections[n].count;
+  }
+
+  s->npackages = n;
+
+  return 0;
+}
+
+/* the section of package i, or of the pkgbase, that says what key is */
+static const struct srcinfo_section_t *section_for(const aur_srcinfo_t *s, int i, const char *key) {
+  const struct srcinfo_section_t *own = &s->sections[1 + i];
+
+  for (int e = own->first; e < own->first + own->count; ++e)
+    if (strcmp(s->entries[e].key, key) == 0)
+      return own;
+
+  return &s->sections[0];
+}
+
+/* the last value of key in sec */
+static const char *section_value(const aur_srcinfo_t *s, const struct srcinfo_section_t *sec, const char *key) {
+  const char *value = NULL;
+
+  for (int e = sec->first; e < sec->first + sec->count; ++e)
+    if (strcmp(s->entries[e].key, key) == 0)
+      value = s->entries[e].value;
+
+  return value;
+}
+
+static int srcinfo_build_version(aur_srcinfo_t *s) {
+  const char *epoch = section_value(s, &s->sections[0], "epoch");
+  const char *pkgver = section_value(s, &s->sections[0], "pkgver");
+  const char *pkgrel = section_value(s, &s->sections[0], "pkgrel");
+  int r;
+
+  if (pkgver == NULL || pkgrel == NULL)
+    return -EBADMSG;
+
+  if (epoch != NULL && *epoch != '\0' && strcmp(epoch, "0") != 0)
+    r = asprintf(&s->version, "%s:%s-%s", epoch, pkgver, pkgrel);
+  else
+    r = asprintf(&s->version, "%s-%s", pkgver, pkgrel);
+
+  return r < 0 ? -ENOMEM : 0;
+}
+
+static int srcinfo_build_packages(aur_srcinfo_t *s) {
+  size_t nlists = 0;
+  char **l;
+
+  s->packages = calloc(s->npackages + 1, sizeof(struct package_t));
+  if (s->packages == NULL)
+    return -ENOMEM;
+
+  for (int i = 0; i < s->npackages; ++i) {
+    for (size_t f = 0; f < ARRAYSIZE(srcinfo_lists); ++f) {
+      int n = aur_srcinfo_get_list_size(s, i, srcinfo_lists[f].key);
+      if (n > 0)
+        nlists += n + 1;
+    }
+  }
+
+  s->lists = malloc((nlists ? nlists : 1) * sizeof(char *));
+  if (s->lists == NULL)
+    return -ENOMEM;
+
+  l = s->lists;
+  for (int i = 0; i < s->npackages; ++i) {
+    struct package_t *p = &s->packages[i];
+
+    p->name = (char *)s->entries[s->sections[1 + i].first].value;
+    p->pkgbase = (char *)s->entries[0].value;
+    p->version = s->version;
+
+    for (size_t f = 0; f < ARRAYSIZE(srcinfo_strings); ++f)
+      *(const char **)((char *)p + srcinfo_strings[f].offset) =
+        section_value(s, section_for(s, i, srcinfo_strings[f].key), srcinfo_strings[f].key);
+
+    /* lists nobody mentions, or that were cleared, are left NULL */
+    for (size_t f = 0; f < ARRAYSIZE(srcinfo_lists); ++f) {
+      const char *key = srcinfo_lists[f].key;
+      const struct srcinfo_section_t *sec;
+
+      if (aur_srcinfo_get_list_size(s, i, key) <= 0)
+        continue;
+
+      *(char ***)((char *)p + srcinfo_lists[f].offset) = l;
+
+      sec = section_for(s, i, key);
+      for (int e = sec->first; e < sec->first + sec->count; ++e)
+        if (strcmp(s->entries[e].key, key) == 0 && *s->entries[e].value != '\0')
+          *l++ = (char *)s->entries[e].value;
+      *l++ = NULL;
+    }
+  }
+
+  return 0;
+}
+
+/* Parses a .SRCINFO. The buffer is taken over, and must hold one byte past
+ * len. */
+static int srcinfo_parse_buffer(aur_srcinfo_t **ret, char *data, size_t len) {
+  aur_srcinfo_t *s;
+  int r;
+
+  s = calloc(1, sizeof(*s));
+  if (s == NULL) {
+    free(data);
+    return -ENOMEM;
+  }
+
+  s->data = data;
+  s->data[len] = '\0';
+
+  r = srcinfo_tokenize(s, len);
+  if (r == 0)
+    r = srcinfo_sectionize(s);
+  if (r == 0)
+    r = srcinfo_build_version(s);
+  if (r == 0)
+    r = srcinfo_build_packages(s);
+
+  if (r < 0) {
+    aur_srcinfo_free(s);
+    return r;
+  }
+
+  *ret = s;
+  return 0;
+}
+
+int aur_srcinfo_parse(aur_srcinfo_t **ret, const char *data, size_t len) {
+  char *copy;
+
+  copy = malloc(len + 1);
+  if (copy == NULL)
+    return -ENOMEM;
+  memcpy(copy, data, len);
+
+  return srcinfo_parse_buffer(ret, copy, len);
+}
+
+/* Reads the .SRCINFO in the checkout at dir. */
+int aur_srcinfo_read(aur_srcinfo_t **ret, const char *dir) {
+  _cleanup_free_ char *path = NULL;
+  struct stat st;
+  size_t len = 0;
+  char *data;
+  int fd;
+
+  if (asprintf(&path, "%s/.SRCINFO", dir) < 0)
+    return -ENOMEM;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -errno;
+
+  if (fstat(fd, &st) < 0) {
+    int r = -errno;
+    close(fd);
+    return r;
+  }
+
+  data = malloc(st.st_size + 1);
+  if (data == NULL) {
+    close(fd);
+    return -ENOMEM;
+  }
+
+  while (len < (size_t)st.st_size) {
+    ssize_t n = read(fd, data + len, st.st_size - len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    len += n;
+  }
+
+  close(fd);
+
+  return srcinfo_parse_buffer(ret, data, len);
+}
+
+struct batch_t {
+  aur_srcinfo_t **srcinfos;
+  const char *const *dirs;
+  int count;
+
+  int next;
+  int parsed;
+};
+
+static void *batch_worker(void *userdata) {
+  struct batch_t *b = userdata;
+
+  for (;;) {
+    int i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED);
+
+    if (i >= b->count)
+      break;
+
+    if (aur_srcinfo_read(&b->srcinfos[i], b->dirs[i]) < 0)
+      b->srcinfos[i] = NULL;
+    else
+      __atomic_add_fetch(&b->parsed, 1, __ATOMIC_RELAXED);
+  }
+
+  return NULL;
+}
+
+/* Reads the .SRCINFO of count checkouts on nthreads threads, or one per
+ * online CPU if nthreads is 0. srcinfos[i] is left NULL for checkouts
+ * that couldn't be read. Returns the number that could. */
+int aur_srcinfo_read_many(aur_srcinfo_t **srcinfos, const char *const *dirs, int count, int nthreads) {
+  struct batch_t b = { .srcinfos = srcinfos, .dirs = dirs, .count = count };
+  pthread_t threads[MAX_THREADS];
+  int started = 0;
+
+  if (count < 0 || nthreads < 0)
+    return -EINVAL;
+
+  if (nthreads == 0)
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads > MAX_THREADS)
+    nthreads = MAX_THREADS;
+  if (nthreads > count)
+    nthreads = count;
+
+  /* this thread does its share too */
+  for (; started < nthreads - 1; ++started)
+    if (pthread_create(&threads[started], NULL, batch_worker, &b) != 0)
+      break;
+
+  batch_worker(&b);
+
+  for (int i = 0; i < started; ++i)
+    pthread_join(threads[i], NULL);
+
+  return b.parsed;
+}
+
+/* The packages built by this .SRCINFO, ending in one without a name. Their
+ * strings belong to the srcinfo: they're not to be freed with
+ * aur_package_list_free, and go away with aur_srcinfo_free. */
+const struct package_t *aur_srcinfo_get_packages(const aur_srcinfo_t *srcinfo, int *count) {
+  if (count != NULL)
+    *count = srcinfo->npackages;
+
+  return srcinfo->packages;
+}
+
+/* The values of any key for package index, arch specific ones included
+ * (depends_x86_64, say). Returns -1 if neither the package nor the pkgbase
+ * mention key, and 0 if the list was cleared. */
+int aur_srcinfo_get_list_size(const aur_srcinfo_t *srcinfo, int index, const char *key) {
+  const struct srcinfo_section_t *sec;
+  int n = 0, found = 0;
+
+  if (index < 0 || index >= srcinfo->npackages)
+    return -1;
+
+  sec = section_for(srcinfo, index, key);
+  for (int e = sec->first; e < sec->first + sec->count; ++e) {
+    if (strcmp(srcinfo->entries[e].key, key) != 0)
+      continue;
+
+    found = 1;
+    n += *srcinfo->entries[e].value != '\0';
+  }
+
+  return found ? n : -1;
+}
+
+const char *aur_srcinfo_get_list_item(const aur_srcinfo_t *srcinfo, int index, const char *key, int n) {
+  const struct srcinfo_section_t *sec;
+
+  if (index < 0 || index >= srcinfo->npackages || n < 0)
+    return NULL;
+
+  sec = section_for(srcinfo, index, key);
+  for (int e = sec->first; e < sec->first + sec->count; ++e) {
+    const struct srcinfo_entry_t *entry = &srcinfo->entries[e];
+
+    if (strcmp(entry->key, key) != 0 || *entry->value == '\0')
+      continue;
+
+    if (n-- == 0)
+      return entry->value;
+  }
+
+  return NULL;
+}
+
+/* vim: set et ts=2 sw=2: */
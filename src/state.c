@@ -0,0 +1,265 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aur-internal.h"
+
+/* Connection state that outlives an aur_t: the addresses hosts resolved to
+ * and, where libcurl can export them, TLS session tickets. Both are kept in
+ * a small text file so that short-lived processes skip the DNS lookup and
+ * resume the TLS session of a previous run:
+ *
+ *   dns <expires> <host:port:address>
+ *   tls <expires> <hmac> <session data> <session key>
+ */
+
+#define DNS_TTL_S 600
+
+static int dns_remember(aur_t *aur, const char *entry, time_t expires) {
+  const char *port = strchr(entry, ':');
+  const char *addr = port ? strchr(port + 1, ':') : NULL;
+  size_t prefixlen;
+  int i;
+
+  if (addr == NULL)
+    return -EINVAL;
+
+  /* one address per host:port, the most recent one wins */
+  prefixlen = addr - entry + 1;
+  for (i = 0; i < aur->n_dns; ++i)
+    if (strncmp(aur->dns[i].entry, entry, prefixlen) == 0)
+      break;
+
+  if (i == MAX_DNS_ENTRIES)
+    return -ENOSPC;
+
+  if (i == aur->n_dns)
+    ++aur->n_dns;
+  else
+    free(aur->dns[i].entry);
+
+  aur->dns[i].entry = strdup(entry);
+  if (aur->dns[i].entry == NULL)
+    return -ENOMEM;
+  aur->dns[i].expires = expires;
+
+  return 0;
+}
+
+void state_record_transfer_internal(aur_t *aur, CURL *curl) {
+  _cleanup_free_ char *entry = NULL;
+  char *url = NULL, *ip = NULL, *host = NULL;
+  long port = 0;
+  CURLU *u;
+
+  curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &url);
+  curl_easy_getinfo(curl, CURLINFO_PRIMARY_IP, &ip);
+  curl_easy_getinfo(curl, CURLINFO_PRIMARY_PORT, &port);
+  if (url == NULL || ip == NULL || *ip == '\0' || port <= 0)
+    return;
+
+  u = curl_url();
+  if (u == NULL)
+    return;
+
+  if (curl_url_set(u, CURLUPART_URL, url, 0) == CURLUE_OK &&
+      curl_url_get(u, CURLUPART_HOST, &host, 0) == CURLUE_OK &&
+      host[0] != '[' && strcmp(host, ip) != 0 &&
+      asprintf(&entry, strchr(ip, ':') ? "%s:%ld:[%s]" : "%s:%ld:%s", host, port, ip) >= 0)
+    dns_remember(aur, entry, time(NULL) + DNS_TTL_S);
+
+  curl_free(host);
+  curl_url_cleanup(u);
+}
+
+void state_free_internal(aur_t *aur) {
+  for (int i = 0; i < aur->n_dns; ++i)
+    free(aur->dns[i].entry);
+  aur->n_dns = 0;
+
+  curl_slist_free_all(aur->resolve);
+  aur->resolve = NULL;
+}
+
+#if LIBCURL_VERSION_NUM >= 0x080c00
+static void hex_write(FILE *fp, const unsigned char *data, size_t len) {
+  for (size_t i = 0; i < len; ++i)
+    fprintf(fp, "%02x", data[i]);
+}
+
+static unsigned char *hex_read(const char *hex, size_t *len) {
+  size_t n = strlen(hex) / 2;
+  unsigned char *data;
+
+  data = malloc(n ? n : 1);
+  if (data == NULL)
+    return NULL;
+
+  for (size_t i = 0; i < n; ++i) {
+    unsigned int b;
+
+    if (sscanf(&hex[i * 2], "%2x", &b) != 1) {
+      free(data);
+      return NULL;
+    }
+    data[i] = b;
+  }
+
+  *len = n;
+  return data;
+}
+
+static CURLcode export_session(CURL *handle, void *userptr, const char *session_key,
+    const unsigned char *shmac, size_t shmac_len, const unsigned char *sdata, size_t sdata_len,
+    curl_off_t valid_until, int ietf_tls_id, const char *alpn, size_t earlydata_max) {
+  FILE *fp = userptr;
+
+  if (valid_until <= time(NULL) || strchr(session_key, '\n'))
+    return CURLE_OK;
+
+  fprintf(fp, "tls %lld ", (long long)valid_until);
+  hex_write(fp, shmac, shmac_len);
+  fputc(' ', fp);
+  hex_write(fp, sdata, sdata_len);
+  fprintf(fp, " %s\n", session_key);
+
+  return CURLE_OK;
+}
+
+static void import_session(CURL *curl, const char *line) {
+  _cleanup_free_ unsigned char *shmac = NULL, *sdata = NULL;
+  _cleanup_free_ char *hmac_hex = NULL, *data_hex = NULL;
+  size_t shmac_len, sdata_len;
+  int off = 0;
+
+  if (sscanf(line, "%ms %ms %n", &hmac_hex, &data_hex, &off) < 2 || off == 0)
+    return;
+
+  shmac = hex_read(hmac_hex, &shmac_len);
+  sdata = hex_read(data_hex, &sdata_len);
+  if (shmac == NULL || sdata == NULL)
+    return;
+
+  curl_easy_ssls_import(curl, &line[off], shmac, shmac_len, sdata, sdata_len);
+}
+#endif
+
+static int resolve_has(const struct curl_slist *l, const char *entry) {
+  for (; l; l = l->next)
+    if (strcmp(l->data, entry) == 0)
+      return 1;
+
+  return 0;
+}
+
+/* Restores state saved by aur_save_state, skipping whatever has expired
+ * since. Only takes effect for requests queued afterwards. */
+int aur_load_state(aur_t *aur, const char *path) {
+  _cleanup_free_ char *line = NULL;
+  size_t linelen = 0;
+  time_t now = time(NULL);
+  CURL *curl;
+  FILE *fp;
+
+  fp = fopen(path, "re");
+  if (fp == NULL)
+    return -errno;
+
+  /* sessions are imported into the share through a throwaway handle */
+  curl = curl_easy_init();
+  if (curl == NULL) {
+    fclose(fp);
+    return -ENOMEM;
+  }
+  curl_easy_setopt(curl, CURLOPT_SHARE, aur->share);
+
+  while (getline(&line, &linelen, fp) > 0) {
+    long long expires;
+    char kind[4];
+    int off = 0;
+
+    line[strcspn(line, "\n")] = '\0';
+
+    if (sscanf(line, "%3s %lld %n", kind, &expires, &off) < 2 || off == 0 || expires <= now)
+      continue;
+
+    if (strcmp(kind, "dns") == 0) {
+      struct curl_slist *l;
+
+      if (dns_remember(aur, &line[off], expires) < 0)
+        continue;
+
+      /* queued requests point at the list, so it only ever grows; a newer
+       * address for the same host:port goes after the older one, which is
+       * the one curl ends up using */
+      if (resolve_has(aur->resolve, &line[off]))
+        continue;
+
+      l = curl_slist_append(aur->resolve, &line[off]);
+      if (l != NULL)
+        aur->resolve = l;
+    }
+#if LIBCURL_VERSION_NUM >= 0x080c00
+    else if (strcmp(kind, "tls") == 0)
+      import_session(curl, &line[off]);
+#endif
+  }
+
+  curl_easy_cleanup(curl);
+  fclose(fp);
+
+  return 0;
+}
+
+/* The file holds TLS session secrets, so it is created private to the user
+ * and replaced atomically. */
+int aur_save_state(aur_t *aur, const char *path) {
+  _cleanup_free_ char *tmp = NULL;
+  time_t now = time(NULL);
+  FILE *fp;
+  int fd;
+
+  if (asprintf(&tmp, "%s.XXXXXX", path) < 0)
+    return -ENOMEM;
+
+  fd = mkostemp(tmp, O_CLOEXEC);
+  if (fd < 0)
+    return -errno;
+
+  fp = fdopen(fd, "w");
+  if (fp == NULL) {
+    close(fd);
+    unlink(tmp);
+    return -ENOMEM;
+  }
+
+  for (int i = 0; i < aur->n_dns; ++i)
+    if (aur->dns[i].expires > now)
+      fprintf(fp, "dns %lld %s\n", (long long)aur->dns[i].expires, aur->dns[i].entry);
+
+#if LIBCURL_VERSION_NUM >= 0x080c00
+  {
+    CURL *curl = curl_easy_init();
+
+    if (curl != NULL) {
+      curl_easy_setopt(curl, CURLOPT_SHARE, aur->share);
+      curl_easy_ssls_export(curl, export_session, fp);
+      curl_easy_cleanup(curl);
+    }
+  }
+#endif
+
+  if (fclose(fp) != 0 || rename(tmp, path) < 0) {
+    int r = -errno;
+    unlink(tmp);
+    return r;
+  }
+
+  return 0;
+}
+
+/* vim: set et ts=2 sw=2: */
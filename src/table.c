@@ -0,0 +1,413 @@
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aur-internal.h"
+#include "macro.h"
+
+/* rows per inner loop iteration in the filter kernels. The inner loop has a
+ * constant trip count so that the compiler can turn it into vector compares
+ * even at -O2. */
+#define FILTER_BLOCK 16
+
+#define STRING_NULL UINT32_MAX
+
+struct aur_package_table_t {
+  int count;
+
+  void *integers[N_INTEGER_FIELDS];
+  uint32_t *strings[N_STRING_FIELDS];
+
+  char *blob;
+  size_t blobsize;
+};
+
+static const char *package_string(const struct package_t *package, int field) {
+  return *(char *const *)((const uint8_t *)package + package_fields[field].offset);
+}
+
+static void *column_alloc(size_t n, size_t width) {
+  void *p;
+
+  /* cache line aligned, and never a zero sized allocation */
+  if (posix_memalign(&p, 64, (n ? n : 1) * width) != 0)
+    return NULL;
+
+  return p;
+}
+
+void aur_package_table_free(aur_package_table_t *table) {
+  if (table == NULL)
+    return;
+
+  for (size_t i = 0; i < N_INTEGER_FIELDS; ++i)
+    free(table->integers[i]);
+
+  for (size_t i = 0; i < N_STRING_FIELDS; ++i)
+    free(table->strings[i]);
+
+  free(table->blob);
+  free(table);
+}
+
+static int table_fill_integers(aur_package_table_t *t, const struct package_t *packages) {
+  for (size_t c = 0; c < N_INTEGER_FIELDS; ++c) {
+    const struct field_descriptor_t *desc = &package_fields[PACKAGE_FIELD_CATEGORY_ID + c];
+
+    t->integers[c] = column_alloc(t->count, desc->width);
+    if (t->integers[c] == NULL)
+      return -ENOMEM;
+
+    for (int i = 0; i < t->count; ++i) {
+      const uint8_t *src = (const uint8_t *)&packages[i] + desc->offset;
+
+      if (desc->width == sizeof(int64_t))
+        ((int64_t *)t->integers[c])[i] = *(const time_t *)src;
+      else
+        ((int32_t *)t->integers[c])[i] = *(const int *)src;
+    }
+  }
+
+  return 0;
+}
+
+static int table_fill_strings(aur_package_table_t *t, const struct package_t *packages) {
+  size_t blobsize = 0;
+  char *p;
+
+  for (int i = 0; i < t->count; ++i) {
+    for (size_t c = 0; c < N_STRING_FIELDS; ++c) {
+      const char *s = package_string(&packages[i], PACKAGE_FIELD_NAME + c);
+
+      if (s != NULL)
+        blobsize += strlen(s) + 1;
+    }
+  }
+
+  if (blobsize >= STRING_NULL)
+    return -E2BIG;
+
+  t->blob = malloc(blobsize ? blobsize : 1);
+  if (t->blob == NULL)
+    return -ENOMEM;
+  t->blobsize = blobsize;
+
+  for (size_t c = 0; c < N_STRING_FIELDS; ++c) {
+    t->strings[c] = column_alloc(t->count, sizeof(uint32_t));
+    if (t->strings[c] == NULL)
+      return -ENOMEM;
+  }
+
+  /* lay the blob out row major so that one package's strings share cache
+   * lines when they're read back together */
+  p = t->blob;
+  for (int i = 0; i < t->count; ++i) {
+    for (size_t c = 0; c < N_STRING_FIELDS; ++c) {
+      const char *s = package_string(&packages[i], PACKAGE_FIELD_NAME + c);
+      size_t len;
+
+      if (s == NULL) {
+        t->strings[c][i] = STRING_NULL;
+        continue;
+      }
+
+      len = strlen(s) + 1;
+      memcpy(p, s, len);
+      t->strings[c][i] = p - t->blob;
+      p += len;
+    }
+  }
+
+  return 0;
+}
+
+int aur_package_table_new(aur_package_table_t **ret, const struct package_t *packages, int count) {
+  aur_package_table_t *t;
+  int r;
+
+  if (count < 0)
+    return -EINVAL;
+
+  t = calloc(1, sizeof(*t));
+  if (t == NULL)
+    return -ENOMEM;
+
+  t->count = count;
+
+  r = table_fill_integers(t, packages);
+  if (r < 0)
+    goto fail;
+
+  r = table_fill_strings(t, packages);
+  if (r < 0)
+    goto fail;
+
+  *ret = t;
+  return 0;
+
+fail:
+  aur_package_table_free(t);
+  return r;
+}
+
+int aur_package_table_get_count(const aur_package_table_t *table) {
+  return table->count;
+}
+
+int64_t aur_package_table_get_integer(const aur_package_table_t *table, int field, int row) {
+  int c = field - PACKAGE_FIELD_CATEGORY_ID;
+
+  if (!FIELD_IS_INTEGER(field) || row < 0 || row >= table->count)
+    return 0;
+
+  if (package_fields[field].width == sizeof(int64_t))
+    return ((const int64_t *)table->integers[c])[row];
+  else
+    return ((const int32_t *)table->integers[c])[row];
+}
+
+const char *aur_package_table_get_string(const aur_package_table_t *table, int field, int row) {
+  uint32_t offset;
+
+  if (!FIELD_IS_STRING(field) || row < 0 || row >= table->count)
+    return NULL;
+
+  offset = table->strings[field - PACKAGE_FIELD_NAME][row];
+  if (offset == STRING_NULL)
+    return NULL;
+
+  return table->blob + offset;
+}
+
+#define DEFINE_FILTER_KERNEL(name, type, cmp)                                 \
+  static void name(const type *restrict col, type v, uint8_t *restrict mask,  \
+      size_t n) {                                                              \
+    size_t i = 0;                                                              \
+                                                                               \
+    for (; i + FILTER_BLOCK <= n; i += FILTER_BLOCK)                           \
+      for (size_t j = 0; j < FILTER_BLOCK; ++j)                                \
+        mask[i + j] &= col[i + j] cmp v;                                       \
+                                                                               \
+    for (; i < n; ++i)                                                         \
+      mask[i] &= col[i] cmp v;                                                 \
+  }
+
+DEFINE_FILTER_KERNEL(filter_eq32, int32_t, ==)
+DEFINE_FILTER_KERNEL(filter_ne32, int32_t, !=)
+DEFINE_FILTER_KERNEL(filter_lt32, int32_t, <)
+DEFINE_FILTER_KERNEL(filter_le32, int32_t, <=)
+DEFINE_FILTER_KERNEL(filter_gt32, int32_t, >)
+DEFINE_FILTER_KERNEL(filter_ge32, int32_t, >=)
+
+DEFINE_FILTER_KERNEL(filter_eq64, int64_t, ==)
+DEFINE_FILTER_KERNEL(filter_ne64, int64_t, !=)
+DEFINE_FILTER_KERNEL(filter_lt64, int64_t, <)
+DEFINE_FILTER_KERNEL(filter_le64, int64_t, <=)
+DEFINE_FILTER_KERNEL(filter_gt64, int64_t, >)
+DEFINE_FILTER_KERNEL(filter_ge64, int64_t, >=)
+
+static int filter32(const int32_t *col, int op, int64_t value, uint8_t *mask, size_t n) {
+  /* a value outside of the column's range either matches every row or none
+   * of them, so there's no need to widen the column */
+  if (value > INT32_MAX || value < INT32_MIN) {
+    int above = value > INT32_MAX, keep;
+
+    switch (op) {
+    case FILTER_EQ:
+      keep = 0;
+      break;
+    case FILTER_NE:
+      keep = 1;
+      break;
+    case FILTER_LT:
+    case FILTER_LE:
+      keep = above;
+      break;
+    case FILTER_GT:
+    case FILTER_GE:
+      keep = !above;
+      break;
+    default:
+      return -EINVAL;
+    }
+
+    if (!keep)
+      memset(mask, 0, n);
+
+    return 0;
+  }
+
+  switch (op) {
+  case FILTER_EQ:
+    filter_eq32(col, value, mask, n);
+    break;
+  case FILTER_NE:
+    filter_ne32(col, value, mask, n);
+    break;
+  case FILTER_LT:
+    filter_lt32(col, value, mask, n);
+    break;
+  case FILTER_LE:
+    filter_le32(col, value, mask, n);
+    break;
+  case FILTER_GT:
+    filter_gt32(col, value, mask, n);
+    break;
+  case FILTER_GE:
+    filter_ge32(col, value, mask, n);
+    break;
+  default:
+    return -EINVAL;
+  }
+
+  return 0;
+}
+
+static int filter64(const int64_t *col, int op, int64_t value, uint8_t *mask, size_t n) {
+  switch (op) {
+  case FILTER_EQ:
+    filter_eq64(col, value, mask, n);
+    break;
+  case FILTER_NE:
+    filter_ne64(col, value, mask, n);
+    break;
+  case FILTER_LT:
+    filter_lt64(col, value, mask, n);
+    break;
+  case FILTER_LE:
+    filter_le64(col, value, mask, n);
+    break;
+  case FILTER_GT:
+    filter_gt64(col, value, mask, n);
+    break;
+  case FILTER_GE:
+    filter_ge64(col, value, mask, n);
+    break;
+  default:
+    return -EINVAL;
+  }
+
+  return 0;
+}
+
+/* Narrows mask, one byte per row holding 0 or 1, to the rows for which
+ * field <op> value holds. Filters compose by calling this repeatedly on the
+ * same mask. */
+int aur_package_table_filter(const aur_package_table_t *table, int field, int op, int64_t value, uint8_t *mask) {
+  int c = field - PACKAGE_FIELD_CATEGORY_ID;
+
+  if (!FIELD_IS_INTEGER(field))
+    return -EINVAL;
+
+  if (package_fields[field].width == sizeof(int64_t))
+    return filter64(table->integers[c], op, value, mask, table->count);
+  else
+    return filter32(table->integers[c], op, value, mask, table->count);
+}
+
+int aur_package_table_select(const aur_package_table_t *table, const uint8_t *mask, uint32_t *rows) {
+  int n = 0;
+
+  /* branchless compaction: always store, only advance on a match */
+  for (int i = 0; i < table->count; ++i) {
+    rows[n] = i;
+    n += mask[i] != 0;
+  }
+
+  return n;
+}
+
+/* LSD radix sort of rows by a 64-bit key, one byte per pass. Passes where
+ * every key shares the same byte (the high bytes of vote counts, say) are
+ * skipped entirely. Stable, so sorting by several fields in turn works. */
+static int radix_sort_rows(uint64_t *keys, uint32_t *rows, size_t n) {
+  _cleanup_free_ uint64_t *tmpkeys = NULL;
+  _cleanup_free_ uint32_t *tmprows = NULL;
+  size_t counts[8][256] = { { 0 } };
+  uint64_t *ksrc = keys, *kdst;
+  uint32_t *rsrc = rows, *rdst;
+
+  if (n < 2)
+    return 0;
+
+  tmpkeys = malloc(n * sizeof(uint64_t));
+  tmprows = malloc(n * sizeof(uint32_t));
+  if (tmpkeys == NULL || tmprows == NULL)
+    return -ENOMEM;
+
+  kdst = tmpkeys;
+  rdst = tmprows;
+
+  for (size_t i = 0; i < n; ++i)
+    for (int b = 0; b < 8; ++b)
+      ++counts[b][(keys[i] >> (b * 8)) & 0xff];
+
+  for (int b = 0; b < 8; ++b) {
+    size_t offsets[256], sum = 0;
+    int skip = 0;
+
+    for (int d = 0; d < 256; ++d) {
+      if (counts[b][d] == n) {
+        skip = 1;
+        break;
+      }
+
+      offsets[d] = sum;
+      sum += counts[b][d];
+    }
+
+    if (skip)
+      continue;
+
+    for (size_t i = 0; i < n; ++i) {
+      size_t o = offsets[(ksrc[i] >> (b * 8)) & 0xff]++;
+
+      kdst[o] = ksrc[i];
+      rdst[o] = rsrc[i];
+    }
+
+    SWAP(ksrc, kdst);
+    SWAP(rsrc, rdst);
+  }
+
+  if (rsrc != rows)
+    memcpy(rows, rsrc, n * sizeof(uint32_t));
+
+  return 0;
+}
+
+/* Sorts rows, typically the output of aur_package_table_select, by an
+ * integer field. */
+int aur_package_table_sort(const aur_package_table_t *table, int field, int descending, uint32_t *rows, int nrows) {
+  _cleanup_free_ uint64_t *keys = NULL;
+  int c = field - PACKAGE_FIELD_CATEGORY_ID;
+  uint64_t flip;
+
+  if (!FIELD_IS_INTEGER(field) || nrows < 0)
+    return -EINVAL;
+
+  keys = malloc((nrows ? nrows : 1) * sizeof(uint64_t));
+  if (keys == NULL)
+    return -ENOMEM;
+
+  /* map signed order onto unsigned order, and reverse it for descending */
+  flip = descending ? INT64_MAX : (uint64_t)INT64_MIN;
+
+  if (package_fields[field].width == sizeof(int64_t)) {
+    const int64_t *col = table->integers[c];
+
+    for (int i = 0; i < nrows; ++i)
+      keys[i] = (uint64_t)col[rows[i]] ^ flip;
+  } else {
+    const int32_t *col = table->integers[c];
+
+    for (int i = 0; i < nrows; ++i)
+      keys[i] = (uint64_t)(int64_t)col[rows[i]] ^ flip;
+  }
+
+  return radix_sort_rows(keys, rows, nrows);
+}
+
+/* vim: set et ts=2 sw=2: */
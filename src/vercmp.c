@@ -0,0 +1,438 @@
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aur-internal.h"
+#include "macro.h"
+
+/* Version comparison as pacman does it: [epoch:]version[-release], each
+ * part split into runs of digits and of letters which are compared in
+ * turn. Digit runs compare numerically and beat letter runs, and letters
+ * left over at the end lose, so 1.0rc1 < 1.0 < 1.0.1 < 1.1.
+ *
+ * aur_vercmp works on the strings as they are, without copying them. For
+ * comparing many versions against each other, each is first turned into a
+ * key: its runs, with the separators before them counted and leading zeros
+ * dropped, so that comparing two keys is a walk over bytes that are known
+ * to matter. The rules aren't a total order in some corner cases (1.0.,
+ * with its trailing dot, is one), so keys are compared by the same steps
+ * rather than with memcmp. */
+
+struct evr_t {
+  const char *epoch, *epoch_end;
+  const char *version, *version_end;
+  const char *release, *release_end;
+};
+
+static int isalnum_c(char c) {
+  return isalnum((unsigned char)c);
+}
+
+static int isalpha_c(char c) {
+  return isalpha((unsigned char)c);
+}
+
+static int isdigit_c(char c) {
+  return isdigit((unsigned char)c);
+}
+
+/* the character at p, or NUL past the end of its range */
+static char at(const char *p, const char *end) {
+  return p < end ? *p : '\0';
+}
+
+static int segments_cmp(const char *one, const char *end1, const char *two, const char *end2) {
+  const char *ptr1 = one, *ptr2 = two;
+
+  if (end1 - one == end2 - two && memcmp(one, two, end1 - one) == 0)
+    return 0;
+
+  while (one < end1 && two < end2) {
+    size_t len1, len2;
+    int isnum, r;
+
+    while (one < end1 && !isalnum_c(*one))
+      ++one;
+    while (two < end2 && !isalnum_c(*two))
+      ++two;
+
+    if (one == end1 || two == end2)
+      break;
+
+    /* 1.0 and 1..0 aren't the same version */
+    if (one - ptr1 != two - ptr2)
+      return one - ptr1 < two - ptr2 ? -1 : 1;
+
+    ptr1 = one;
+    ptr2 = two;
+
+    if (isdigit_c(*ptr1)) {
+      while (ptr1 < end1 && isdigit_c(*ptr1))
+        ++ptr1;
+      while (ptr2 < end2 && isdigit_c(*ptr2))
+        ++ptr2;
+      isnum = 1;
+    } else {
+      while (ptr1 < end1 && isalpha_c(*ptr1))
+        ++ptr1;
+      while (ptr2 < end2 && isalpha_c(*ptr2))
+        ++ptr2;
+      isnum = 0;
+    }
+
+    /* a digit run beats a letter run */
+    if (ptr2 == two)
+      return isnum ? 1 : -1;
+
+    if (isnum) {
+      while (one < ptr1 && *one == '0')
+        ++one;
+      while (two < ptr2 && *two == '0')
+        ++two;
+
+      if (ptr1 - one != ptr2 - two)
+        return ptr1 - one < ptr2 - two ? -1 : 1;
+    }
+
+    len1 = ptr1 - one;
+    len2 = ptr2 - two;
+    r = memcmp(one, two, MIN(len1, len2));
+    if (r == 0 && len1 != len2)
+      r = len1 < len2 ? -1 : 1;
+    if (r != 0)
+      return r < 0 ? -1 : 1;
+
+    one = ptr1;
+    two = ptr2;
+  }
+
+  if (one == end1 && two == end2)
+    return 0;
+
+  /* whatever is left wins, unless it's letters: 1.0 is newer than 1.0rc */
+  if ((one == end1 && !isalpha_c(at(two, end2))) || isalpha_c(at(one, end1)))
+    return -1;
+
+  return 1;
+}
+
+static void parse_evr(const char *evr, const char *end, struct evr_t *out) {
+  const char *s = evr, *dash;
+  static const char zero[] = "0";
+
+  while (s < end && isdigit_c(*s))
+    ++s;
+
+  if (s < end && *s == ':' && s > evr) {
+    out->epoch = evr;
+    out->epoch_end = s++;
+  } else {
+    out->epoch = zero;
+    out->epoch_end = zero + 1;
+    s = s < end && *s == ':' ? s + 1 : evr;
+  }
+
+  out->version = s;
+
+  dash = memrchr(s, '-', end - s);
+  if (dash != NULL) {
+    out->version_end = dash;
+    out->release = dash + 1;
+    out->release_end = end;
+  } else {
+    out->version_end = end;
+    out->release = out->release_end = NULL;
+  }
+}
+
+/* Returns less than, equal to or greater than zero as a is older than, the
+ * same as or newer than b. The release is only compared if both have one. */
+int aur_vercmp(const char *a, const char *b) {
+  struct evr_t e1, e2;
+  int r;
+
+  if (a == NULL || b == NULL)
+    return (a != NULL) - (b != NULL);
+
+  if (strcmp(a, b) == 0)
+    return 0;
+
+  parse_evr(a, a + strlen(a), &e1);
+  parse_evr(b, b + strlen(b), &e2);
+
+  r = segments_cmp(e1.epoch, e1.epoch_end, e2.epoch, e2.epoch_end);
+  if (r == 0)
+    r = segments_cmp(e1.version, e1.version_end, e2.version, e2.version_end);
+  if (r == 0 && e1.release != NULL && e2.release != NULL)
+    r = segments_cmp(e1.release, e1.release_end, e2.release, e2.release_end);
+
+  return r;
+}
+
+/* Compares n pairs of versions, storing aur_vercmp(a[i], b[i]) in
+ * results[i]. */
+int aur_vercmp_batch(const char *const *a, const char *const *b, int n, int *results) {
+  if (n < 0)
+    return -EINVAL;
+
+  for (int i = 0; i < n; ++i)
+    results[i] = aur_vercmp(a[i], b[i]);
+
+  return 0;
+}
+
+/* A key is a byte string, for each of epoch, version and release:
+ *
+ *   run:  'N' <separators before it, 2 bytes> <length, 2 bytes> <digits>
+ *      |  'A' <separators before it, 2 bytes> <letters> '\0'
+ *   end:  '\0' <1 if separators trail the last run, else 0>
+ *
+ * The release is preceded by a byte saying whether there is one, and the
+ * whole key by one saying whether there's a version at all. */
+
+#define KEY_RUN_NUMBER 'N'
+#define KEY_RUN_LETTERS 'A'
+
+/* a one character run takes at most 5 bytes, the parts' framing a few more
+ * and an implied epoch 5 of its own */
+size_t version_key_bound_internal(size_t len) {
+  return len * 5 + 16;
+}
+
+static uint8_t *put16(uint8_t *k, size_t v) {
+  v = MIN(v, UINT16_MAX);
+  *k++ = v >> 8;
+  *k++ = v & 0xff;
+  return k;
+}
+
+static size_t get16(const uint8_t *k) {
+  return k[0] << 8 | k[1];
+}
+
+static uint8_t *key_encode_part(uint8_t *k, const char *s, const char *end) {
+  while (s < end) {
+    const char *run = s, *p;
+
+    while (run < end && !isalnum_c(*run))
+      ++run;
+
+    if (run == end) {
+      *k++ = 0;
+      *k++ = 1;
+      return k;
+    }
+
+    if (isdigit_c(*run)) {
+      size_t len;
+
+      for (p = run; p < end && isdigit_c(*p); ++p)
+        ;
+
+      *k++ = KEY_RUN_NUMBER;
+      k = put16(k, run - s);
+
+      while (run < p && *run == '0')
+        ++run;
+
+      len = MIN((size_t)(p - run), UINT16_MAX);
+      k = put16(k, len);
+      memcpy(k, run, len);
+      k += len;
+    } else {
+      for (p = run; p < end && isalpha_c(*p); ++p)
+        ;
+
+      *k++ = KEY_RUN_LETTERS;
+      k = put16(k, run - s);
+      memcpy(k, run, p - run);
+      k += p - run;
+      *k++ = 0;
+    }
+
+    s = p;
+  }
+
+  *k++ = 0;
+  *k++ = 0;
+  return k;
+}
+
+/* Writes the key for the len bytes of version at k, or the key that sorts
+ * before all others if version is NULL. Returns the end of the key. */
+uint8_t *version_key_encode_internal(uint8_t *k, const char *version, size_t len) {
+  struct evr_t e;
+
+  if (version == NULL) {
+    *k++ = 0;
+    return k;
+  }
+
+  parse_evr(version, version + len, &e);
+
+  *k++ = 1;
+  k = key_encode_part(k, e.epoch, e.epoch_end);
+  k = key_encode_part(k, e.version, e.version_end);
+  *k++ = e.release != NULL;
+  if (e.release != NULL)
+    k = key_encode_part(k, e.release, e.release_end);
+
+  return k;
+}
+
+/* skips over the run at k */
+static const uint8_t *key_next_run(const uint8_t *k) {
+  if (k[0] == KEY_RUN_NUMBER)
+    return k + 5 + get16(k + 3);
+
+  return k + 3 + strlen((const char *)k + 3) + 1;
+}
+
+/* compares the parts at *a and *b, leaving both pointing past them if
+ * they're equal */
+static int key_part_cmp(const uint8_t **a, const uint8_t **b) {
+  const uint8_t *one = *a, *two = *b;
+
+  while (*one != 0 && *two != 0) {
+    size_t seps1 = get16(one + 1), seps2 = get16(two + 1);
+    int r;
+
+    if (seps1 != seps2)
+      return seps1 < seps2 ? -1 : 1;
+
+    if (one[0] != two[0])
+      return one[0] == KEY_RUN_NUMBER ? 1 : -1;
+
+    if (one[0] == KEY_RUN_NUMBER) {
+      size_t len1 = get16(one + 3), len2 = get16(two + 3);
+
+      if (len1 != len2)
+        return len1 < len2 ? -1 : 1;
+
+      r = memcmp(one + 5, two + 5, len1);
+    } else {
+      r = strcmp((const char *)one + 3, (const char *)two + 3);
+    }
+
+    if (r != 0)
+      return r < 0 ? -1 : 1;
+
+    one = key_next_run(one);
+    two = key_next_run(two);
+  }
+
+  if (*one == 0 && *two == 0) {
+    *a = one + 2;
+    *b = two + 2;
+    return one[1] - two[1];
+  }
+
+  /* One side ran out of runs. What decides is whatever the other side has
+   * next: its separators, unless it has none or this side had trailing
+   * separators of its own, which pacman skips along with the other's. */
+  if (*one == 0) {
+    if (one[1] == 0 && get16(two + 1) > 0)
+      return -1;
+    return two[0] == KEY_RUN_LETTERS ? 1 : -1;
+  }
+
+  if (two[1] == 0 && get16(one + 1) > 0)
+    return 1;
+  return one[0] == KEY_RUN_LETTERS ? -1 : 1;
+}
+
+int version_key_cmp_internal(const uint8_t *a, const uint8_t *b) {
+  int r;
+
+  if (a[0] == 0 || b[0] == 0)
+    return a[0] - b[0];
+
+  ++a;
+  ++b;
+
+  r = key_part_cmp(&a, &b);
+  if (r == 0)
+    r = key_part_cmp(&a, &b);
+  if (r != 0 || *a == 0 || *b == 0)
+    return r;
+
+  ++a;
+  ++b;
+
+  return key_part_cmp(&a, &b);
+}
+
+struct version_sort_t {
+  const uint8_t *keys;
+  const size_t *offsets;
+  int descending;
+};
+
+static int index_version_cmp(const void *a, const void *b, void *userdata) {
+  const struct version_sort_t *s = userdata;
+  uint32_t i = *(const uint32_t *)a, j = *(const uint32_t *)b;
+  int r;
+
+  r = version_key_cmp_internal(s->keys + s->offsets[i], s->keys + s->offsets[j]);
+  if (s->descending)
+    r = -r;
+
+  /* equal versions keep their order */
+  if (r == 0)
+    r = i < j ? -1 : i > j;
+
+  return r;
+}
+
+/* Sorts packages by version, oldest first unless descending is set. Each
+ * version is turned into a key just once. Packages with the same version
+ * keep their order. */
+int aur_packages_sort_by_version(struct package_t *packages, int count, int descending) {
+  _cleanup_free_ uint8_t *keys = NULL;
+  _cleanup_free_ size_t *offsets = NULL;
+  _cleanup_free_ uint32_t *index = NULL;
+  _cleanup_free_ struct package_t *sorted = NULL;
+  struct version_sort_t sort;
+  size_t size = 0;
+  uint8_t *k;
+
+  if (count < 0)
+    return -EINVAL;
+  if (count < 2)
+    return 0;
+
+  for (int i = 0; i < count; ++i) {
+    const char *v = packages[i].version;
+    size += v ? version_key_bound_internal(strlen(v)) : 1;
+  }
+
+  keys = malloc(size);
+  offsets = malloc(count * sizeof(size_t));
+  index = malloc(count * sizeof(uint32_t));
+  sorted = malloc(count * sizeof(struct package_t));
+  if (keys == NULL || offsets == NULL || index == NULL || sorted == NULL)
+    return -ENOMEM;
+
+  k = keys;
+  for (int i = 0; i < count; ++i) {
+    offsets[i] = k - keys;
+    index[i] = i;
+    k = version_key_encode_internal(k, packages[i].version,
+        packages[i].version ? strlen(packages[i].version) : 0);
+  }
+
+  sort.keys = keys;
+  sort.offsets = offsets;
+  sort.descending = descending;
+  qsort_r(index, count, sizeof(uint32_t), index_version_cmp, &sort);
+
+  for (int i = 0; i < count; ++i)
+    sorted[i] = packages[index[i]];
+  memcpy(packages, sorted, count * sizeof(struct package_t));
+
+  return 0;
+}
+
+/* vim: set et ts=2 sw=2: */
@@ -0,0 +1,481 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "aur-internal.h"
+
+/* Keeps track of a set of packages by polling the AUR for them, and reports
+ * only what changed since the last poll: a package showing up, a new
+ * version or LastModified, a package going away.
+ *
+ * The names are sorted and cut into batches, one multiinfo request each, as
+ * many to a batch as fit in a request line. Each batch remembers the ETag of
+ * its last answer and sends it back as If-None-Match, so that a batch in
+ * which nothing changed costs a 304 and no decoding at all. The ETags are
+ * saved along with the packages, for polls that are a process apart. */
+
+struct watch_entry_t {
+  char *name;
+
+  /* NULL while the AUR isn't known to have the package */
+  char *version;
+  time_t modified_s;
+
+  int seen;
+};
+
+struct watch_batch_t {
+  aur_watch_t *watch;
+  int first;
+  int count;
+  const char *first_name;
+  const char *last_name;
+  char *etag;
+};
+
+struct aur_watch_t {
+  aur_t *aur;
+  aur_watch_event_fn event_fn;
+  void *userdata;
+
+  struct watch_entry_t *entries;
+  int count;
+  int capacity;
+
+  struct watch_batch_t *batches;
+  int nbatches;
+
+  /* entries past laid_out were added since the batches were cut */
+  int laid_out;
+  int inflight;
+};
+
+int aur_watch_new(aur_watch_t **ret, aur_t *aur, aur_watch_event_fn event_fn, void *userdata) {
+  aur_watch_t *watch;
+
+  watch = calloc(1, sizeof(*watch));
+  if (watch == NULL)
+    return -ENOMEM;
+
+  watch->aur = aur;
+  watch->event_fn = event_fn;
+  watch->userdata = userdata;
+
+  *ret = watch;
+  return 0;
+}
+
+static void free_batches(struct watch_batch_t *batches, int nbatches) {
+  for (int i = 0; i < nbatches; ++i)
+    free(batches[i].etag);
+  free(batches);
+}
+
+/* Requests of a poll still in flight point at the watch, so a round has to
+ * be run to the end before it's freed. */
+void aur_watch_free(aur_watch_t *watch) {
+  if (watch == NULL)
+    return;
+
+  for (int i = 0; i < watch->count; ++i) {
+    free(watch->entries[i].name);
+    free(watch->entries[i].version);
+  }
+  free(watch->entries);
+
+  free_batches(watch->batches, watch->nbatches);
+  free(watch);
+}
+
+/* Names go into the saved state as words, so they can't contain blanks. */
+int aur_watch_add(aur_watch_t *watch, const char *name) {
+  struct watch_entry_t *e;
+
+  if (*name == '\0' || strpbrk(name, " \t\n") != NULL)
+    return -EINVAL;
+
+  if (watch->inflight > 0)
+    return -EBUSY;
+
+  if (watch->count == watch->capacity) {
+    int cap = watch->capacity ? watch->capacity * 2 : 64;
+    struct watch_entry_t *newalloc;
+
+    newalloc = realloc(watch->entries, cap * sizeof(struct watch_entry_t));
+    if (newalloc == NULL)
+      return -ENOMEM;
+    watch->entries = newalloc;
+    watch->capacity = cap;
+  }
+
+  e = &watch->entries[watch->count];
+  memset(e, 0, sizeof(*e));
+  e->name = strdup(name);
+  if (e->name == NULL)
+    return -ENOMEM;
+
+  ++watch->count;
+
+  return 0;
+}
+
+static int entry_cmp(const void *a, const void *b) {
+  const struct watch_entry_t *p = a, *q = b;
+
+  return strcmp(p->name, q->name);
+}
+
+static int entry_name_cmp(const void *a, const void *b) {
+  const struct watch_entry_t *e = b;
+
+  return strcmp(a, e->name);
+}
+
+static struct watch_entry_t *find_entry(aur_watch_t *watch, int first, int count, const char *name) {
+  return bsearch(name, &watch->entries[first], count, sizeof(struct watch_entry_t), entry_name_cmp);
+}
+
+static struct watch_batch_t *find_batch(struct watch_batch_t *batches, int nbatches,
+    const char *first, const char *last, int count) {
+  for (int i = 0; i < nbatches; ++i) {
+    struct watch_batch_t *b = &batches[i];
+
+    if (b->count == count && strcmp(b->first_name, first) == 0 && strcmp(b->last_name, last) == 0)
+      return b;
+  }
+
+  return NULL;
+}
+
+/* Sorts in the names added since the last call, dropping duplicates, and
+ * cuts the lot into batches. Batches that came out the same as before keep
+ * their ETag. */
+static int layout(aur_watch_t *watch) {
+  struct watch_batch_t *batches, *old = watch->batches;
+  int n = watch->laid_out, nbatches = 0, nold = watch->nbatches;
+  size_t len = 0;
+
+  if (watch->laid_out == watch->count)
+    return 0;
+
+  /* entries laid out before are sorted and unique already, and never go
+   * away, so the names the old batches point at stay valid */
+  qsort(&watch->entries[n], watch->count - n, sizeof(struct watch_entry_t), entry_cmp);
+  for (int i = watch->laid_out; i < watch->count; ++i) {
+    struct watch_entry_t *e = &watch->entries[i];
+
+    if ((n > watch->laid_out && strcmp(watch->entries[n - 1].name, e->name) == 0) ||
+        find_entry(watch, 0, watch->laid_out, e->name) != NULL) {
+      free(e->name);
+      continue;
+    }
+    watch->entries[n++] = *e;
+  }
+  watch->count = n;
+  qsort(watch->entries, watch->count, sizeof(struct watch_entry_t), entry_cmp);
+
+  batches = calloc(watch->count ? watch->count : 1, sizeof(struct watch_batch_t));
+  if (batches == NULL)
+    return -ENOMEM;
+
+  for (int i = 0; i < watch->count; ++i) {
+    size_t arglen = aur_request_arg_length(watch->entries[i].name);
+
+    if (nbatches == 0 || len + arglen > AUR_MAX_QUERY_LEN) {
+      batches[nbatches].watch = watch;
+      batches[nbatches].first = i;
+      batches[nbatches].first_name = watch->entries[i].name;
+      ++nbatches;
+      len = 0;
+    }
+
+    batches[nbatches - 1].last_name = watch->entries[i].name;
+    ++batches[nbatches - 1].count;
+    len += arglen;
+  }
+
+  for (int i = 0; i < nbatches; ++i) {
+    struct watch_batch_t *b = &batches[i], *o;
+
+    o = find_batch(old, nold, b->first_name, b->last_name, b->count);
+    if (o != NULL) {
+      b->etag = o->etag;
+      o->etag = NULL;
+    }
+  }
+
+  free_batches(old, nold);
+  watch->batches = batches;
+  watch->nbatches = nbatches;
+  watch->laid_out = watch->count;
+
+  return 0;
+}
+
+static void emit(aur_watch_t *watch, int type, const struct watch_entry_t *e,
+    const char *old_version, int error) {
+  struct watch_event_t event = {
+    .type = type,
+    .name = e ? e->name : NULL,
+    .old_version = old_version,
+    .new_version = e ? e->version : NULL,
+    .modified_s = e ? e->modified_s : 0,
+    .error = error,
+  };
+
+  if (watch->event_fn)
+    watch->event_fn(watch, &event, watch->userdata);
+}
+
+static void update_entry(aur_watch_t *watch, struct watch_entry_t *e, const struct package_t *p) {
+  char *old = e->version;
+
+  e->seen = 1;
+
+  if (old != NULL && e->modified_s == p->modified_s && strcmp(old, p->version) == 0)
+    return;
+
+  e->version = strdup(p->version);
+  if (e->version == NULL) {
+    e->version = old;
+    return;
+  }
+  e->modified_s = p->modified_s;
+
+  emit(watch, old ? WATCH_UPDATED : WATCH_ADDED, e, old, 0);
+  free(old);
+}
+
+static int watch_done(aur_t *aur, aur_request_t *req, const void *response, int responselen) {
+  struct watch_batch_t *batch = aur_request_get_userdata(req);
+  aur_watch_t *watch = batch->watch;
+  struct package_t *pkgs;
+  const char *etag;
+  int r, c, status;
+
+  (void)aur; (void)responselen;
+
+  --watch->inflight;
+
+  r = aur_request_get_result(req);
+  if (r < 0) {
+    emit(watch, WATCH_FAILED, NULL, NULL, r);
+    return 0;
+  }
+
+  /* nothing changed in the whole batch */
+  status = aur_request_get_http_status(req);
+  if (status == 304)
+    return 0;
+
+  r = aur_packages_from_json(response, &pkgs, &c);
+  if (r < 0) {
+    emit(watch, WATCH_FAILED, NULL, NULL, r);
+    return 0;
+  }
+
+  for (int i = 0; i < batch->count; ++i)
+    watch->entries[batch->first + i].seen = 0;
+
+  for (int i = 0; i < c; ++i) {
+    struct watch_entry_t *e;
+
+    if (pkgs[i].name == NULL || pkgs[i].version == NULL)
+      continue;
+
+    e = find_entry(watch, batch->first, batch->count, pkgs[i].name);
+    if (e != NULL)
+      update_entry(watch, e, &pkgs[i]);
+  }
+
+  aur_package_list_free(pkgs);
+
+  for (int i = 0; i < batch->count; ++i) {
+    struct watch_entry_t *e = &watch->entries[batch->first + i];
+    char *old = e->version;
+
+    if (e->seen || old == NULL)
+      continue;
+
+    e->version = NULL;
+    e->modified_s = 0;
+    emit(watch, WATCH_REMOVED, e, old, 0);
+    free(old);
+  }
+
+  /* only an answer that was taken in is worth asking about again */
+  free(batch->etag);
+  etag = aur_request_get_header(req, "ETag");
+  batch->etag = etag ? strdup(etag) : NULL;
+
+  return 0;
+}
+
+static int queue_batch(aur_watch_t *watch, struct watch_batch_t *batch) {
+  aur_request_t *req;
+  int r;
+
+  r = aur_request_new(&req, REQUEST_MULTIINFO, watch_done);
+  if (r < 0)
+    return r;
+
+  for (int i = 0; i < batch->count; ++i) {
+    r = aur_request_append_arg(req, watch->entries[batch->first + i].name);
+    if (r < 0)
+      goto finish;
+  }
+
+  if (batch->etag != NULL) {
+    _cleanup_free_ char *header = NULL;
+
+    if (asprintf(&header, "If-None-Match: %s", batch->etag) < 0) {
+      r = -ENOMEM;
+      goto finish;
+    }
+
+    r = aur_request_add_header(req, header);
+    if (r < 0)
+      goto finish;
+  }
+
+  aur_request_set_userdata(req, batch);
+  aur_request_set_priority(req, PRIORITY_BULK);
+  aur_request_set_retry(req, 3, 250);
+
+  ++watch->inflight;
+  r = aur_queue_request(watch->aur, req);
+  if (r < 0)
+    --watch->inflight;
+
+finish:
+  aur_request_unref(req);
+  return r;
+}
+
+/* Queues one round of requests covering every name, whose events come in as
+ * aur_run gets answers. Returns the number of requests queued. */
+int aur_watch_poll(aur_watch_t *watch) {
+  int r;
+
+  if (watch->inflight > 0)
+    return -EBUSY;
+
+  r = layout(watch);
+  if (r < 0)
+    return r;
+
+  for (int i = 0; i < watch->nbatches; ++i) {
+    r = queue_batch(watch, &watch->batches[i]);
+    if (r < 0)
+      return r;
+  }
+
+  return watch->nbatches;
+}
+
+/* Restores what aur_watch_save saved, for the names added so far. Those
+ * added afterwards start out unknown. */
+int aur_watch_load(aur_watch_t *watch, const char *path) {
+  _cleanup_free_ char *line = NULL;
+  size_t linelen = 0;
+  FILE *fp;
+  int r;
+
+  if (watch->inflight > 0)
+    return -EBUSY;
+
+  r = layout(watch);
+  if (r < 0)
+    return r;
+
+  fp = fopen(path, "re");
+  if (fp == NULL)
+    return -errno;
+
+  while (getline(&line, &linelen, fp) > 0) {
+    char name[256], last[256];
+    long long modified;
+    int off = 0, count;
+
+    line[strcspn(line, "\n")] = '\0';
+
+    if (sscanf(line, "pkg %255s %lld %n", name, &modified, &off) == 2 && off > 0) {
+      struct watch_entry_t *e = find_entry(watch, 0, watch->count, name);
+      char *version;
+
+      if (e == NULL || line[off] == '\0')
+        continue;
+
+      version = strdup(&line[off]);
+      if (version == NULL)
+        break;
+
+      free(e->version);
+      e->version = version;
+      e->modified_s = modified;
+    } else if (sscanf(line, "etag %255s %255s %d %n", name, last, &count, &off) == 3 && off > 0) {
+      struct watch_batch_t *b;
+
+      b = find_batch(watch->batches, watch->nbatches, name, last, count);
+      if (b == NULL || line[off] == '\0')
+        continue;
+
+      free(b->etag);
+      b->etag = strdup(&line[off]);
+    }
+  }
+
+  fclose(fp);
+
+  return 0;
+}
+
+/* Saves the packages as last seen, and the ETags that go with them. The
+ * file is replaced atomically. */
+int aur_watch_save(aur_watch_t *watch, const char *path) {
+  _cleanup_free_ char *tmp = NULL;
+  FILE *fp;
+  int fd;
+
+  if (asprintf(&tmp, "%s.XXXXXX", path) < 0)
+    return -ENOMEM;
+
+  fd = mkostemp(tmp, O_CLOEXEC);
+  if (fd < 0)
+    return -errno;
+
+  fp = fdopen(fd, "w");
+  if (fp == NULL) {
+    close(fd);
+    unlink(tmp);
+    return -ENOMEM;
+  }
+
+  for (int i = 0; i < watch->count; ++i) {
+    const struct watch_entry_t *e = &watch->entries[i];
+
+    if (e->version != NULL)
+      fprintf(fp, "pkg %s %lld %s\n", e->name, (long long)e->modified_s, e->version);
+  }
+
+  /* a batch laid out after the last poll has no ETag yet */
+  for (int i = 0; i < watch->nbatches; ++i) {
+    const struct watch_batch_t *b = &watch->batches[i];
+
+    if (b->etag != NULL)
+      fprintf(fp, "etag %s %s %d %s\n", b->first_name, b->last_name, b->count, b->etag);
+  }
+
+  if (fclose(fp) != 0 || rename(tmp, path) < 0) {
+    int r = -errno;
+    unlink(tmp);
+    return r;
+  }
+
+  return 0;
+}
+
+/* vim: set et ts=2 sw=2: */
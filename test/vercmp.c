@@ -0,0 +1,159 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aur.h"
+#include "aur-internal.h"
+#include "macro.h"
+
+/* pacman's vercmp test table, from test/util/vercmptest.sh. Each pair is
+ * also checked the other way around, and through the sort keys. */
+static const struct {
+  const char *a;
+  const char *b;
+  int expected;
+} tests[] = {
+  /* all similar length, no pkgrel */
+  { "1.5.0", "1.5.0", 0 },
+  { "1.5.1", "1.5.0", 1 },
+
+  /* mixed length */
+  { "1.5.1", "1.5", 1 },
+
+  /* with pkgrel, simple */
+  { "1.5.0-1", "1.5.0-1", 0 },
+  { "1.5.0-1", "1.5.0-2", -1 },
+  { "1.5.0-1", "1.5.1-1", -1 },
+  { "1.5.0-2", "1.5.1-1", -1 },
+
+  /* with pkgrel, mixed lengths */
+  { "1.5-1", "1.5.1-1", -1 },
+  { "1.5-2", "1.5.1-1", -1 },
+  { "1.5-2", "1.5.1-2", -1 },
+
+  /* mixed pkgrel inclusion */
+  { "1.5", "1.5-1", 0 },
+  { "1.5-1", "1.5", 0 },
+  { "1.1-1", "1.1", 0 },
+  { "1.0-1", "1.1", -1 },
+  { "1.1-1", "1.0", 1 },
+
+  /* alphanumeric versions */
+  { "1.5b-1", "1.5-1", -1 },
+  { "1.5b", "1.5", -1 },
+  { "1.5b-1", "1.5", -1 },
+  { "1.5b", "1.5.1", -1 },
+
+  /* from the manpage */
+  { "1.0a", "1.0alpha", -1 },
+  { "1.0alpha", "1.0b", -1 },
+  { "1.0b", "1.0beta", -1 },
+  { "1.0beta", "1.0rc", -1 },
+  { "1.0rc", "1.0", -1 },
+
+  /* going crazy? alpha-dotted versions */
+  { "1.5.a", "1.5", 1 },
+  { "1.5.b", "1.5.a", 1 },
+  { "1.5.1", "1.5.b", 1 },
+
+  /* alpha dots and dashes */
+  { "1.5.b-1", "1.5.b", 0 },
+  { "1.5-1", "1.5.b", -1 },
+
+  /* same/similar content, differing separators */
+  { "2.0", "2_0", 0 },
+  { "2.0_a", "2_0.a", 0 },
+  { "2.0a", "2.0.a", -1 },
+  { "2___a", "2_a", 1 },
+
+  /* epoch included version comparisons */
+  { "0:1.0", "0:1.0", 0 },
+  { "0:1.0", "0:1.1", -1 },
+  { "1:1.0", "0:1.0", 1 },
+  { "1:1.0", "0:1.1", 1 },
+  { "1:1.0", "2:1.1", -1 },
+
+  /* epoch + sometimes present pkgrel */
+  { "1:1.0", "0:1.0-1", 1 },
+  { "1:1.0-1", "0:1.1-1", 1 },
+
+  /* epoch included on one version */
+  { "0:1.0", "1.0", 0 },
+  { "0:1.1", "1.0", 1 },
+  { "0:1.1", "1.1", 0 },
+  { "1:1.0", "1.0", 1 },
+  { "1:1.1", "1.1", 1 },
+  { "1:1.1", "1.11", 1 },
+
+  /* trailing separators and leading zeroes, which the table above doesn't
+   * reach */
+  { "1.0.", "1.0", 1 },
+  { "1.0_", "1.0", 1 },
+  { "1.0a.", "1.0a", 1 },
+  { "1.0..", "1.0.", 0 },
+  { "1.0-", "1.0", 0 },
+  { "01", "1", 0 },
+  { "1.001", "1.1", 0 },
+  { "1.0a", "1.0.1", -1 },
+};
+
+static int sign(int r) {
+  return (r > 0) - (r < 0);
+}
+
+static int key_cmp(const char *a, const char *b) {
+  _cleanup_free_ uint8_t *ka = malloc(version_key_bound_internal(strlen(a)));
+  _cleanup_free_ uint8_t *kb = malloc(version_key_bound_internal(strlen(b)));
+
+  if (ka == NULL || kb == NULL) {
+    fprintf(stderr, "error: out of memory\n");
+    exit(2);
+  }
+
+  version_key_encode_internal(ka, a, strlen(a));
+  version_key_encode_internal(kb, b, strlen(b));
+
+  return version_key_cmp_internal(ka, kb);
+}
+
+static int check(const char *what, const char *a, const char *b, int r, int expected) {
+  if (sign(r) == expected)
+    return 0;
+
+  printf("FAIL: %s(%s, %s) = %d, expected %d\n", what, a, b, sign(r), expected);
+  return 1;
+}
+
+int main(void) {
+  const char *a[ARRAYSIZE(tests)], *b[ARRAYSIZE(tests)];
+  int results[ARRAYSIZE(tests)];
+  int failed = 0;
+
+  for (size_t i = 0; i < ARRAYSIZE(tests); ++i) {
+    const char *x = tests[i].a, *y = tests[i].b;
+    int expected = tests[i].expected;
+
+    failed += check("aur_vercmp", x, y, aur_vercmp(x, y), expected);
+    failed += check("aur_vercmp", y, x, aur_vercmp(y, x), -expected);
+    failed += check("key", x, y, key_cmp(x, y), expected);
+    failed += check("key", y, x, key_cmp(y, x), -expected);
+
+    a[i] = x;
+    b[i] = y;
+  }
+
+  if (aur_vercmp_batch(a, b, ARRAYSIZE(tests), results) < 0) {
+    printf("FAIL: aur_vercmp_batch\n");
+    ++failed;
+  } else {
+    for (size_t i = 0; i < ARRAYSIZE(tests); ++i)
+      failed += check("aur_vercmp_batch", a[i], b[i], results[i], tests[i].expected);
+  }
+
+  printf("%zu comparisons, %d failed\n", 5 * ARRAYSIZE(tests), failed);
+
+  return failed > 0;
+}
+
+/* vim: set et ts=2 sw=2: */